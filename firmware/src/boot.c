@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include "boot.h"
+
+struct boot_stage_info
+{
+    const char *name;
+    int64_t begin_ms;
+    int64_t end_ms;
+    int err;
+};
+
+static struct boot_stage_info boot_stages[BOOT_STAGE_COUNT] = {
+    [BOOT_STAGE_CAN] = {.name = "can"},
+    [BOOT_STAGE_HUBS] = {.name = "hubs"},
+    [BOOT_STAGE_SD] = {.name = "sd"},
+    [BOOT_STAGE_USB] = {.name = "usb"},
+    [BOOT_STAGE_BT] = {.name = "bt"},
+    [BOOT_STAGE_ADV] = {.name = "adv"},
+};
+
+/* One bit per ended stage, ok holds the ones without error */
+K_EVENT_DEFINE(boot_done);
+static atomic_t boot_ok;
+
+void boot_stage_begin(enum boot_stage stage)
+{
+    boot_stages[stage].begin_ms = k_uptime_get();
+}
+
+void boot_stage_end(enum boot_stage stage, int err)
+{
+    struct boot_stage_info *info = &boot_stages[stage];
+
+    if (k_event_test(&boot_done, BIT(stage)))
+    {
+        return;
+    }
+
+    info->end_ms = k_uptime_get();
+    info->err = err;
+    if (err == 0)
+    {
+        atomic_or(&boot_ok, BIT(stage));
+    }
+    else
+    {
+        printk("Boot: %s failed [%d]\n", info->name, err);
+    }
+
+    /* Posting returns the stages that had ended before */
+    if ((k_event_post(&boot_done, BIT(stage)) | BIT(stage)) == BOOT_STAGE_ALL)
+    {
+        printk("Boot: ready after %lld ms, advertising after %lld ms\n",
+               info->end_ms, boot_stages[BOOT_STAGE_ADV].end_ms);
+    }
+}
+
+bool boot_stage_ok(enum boot_stage stage)
+{
+    return (atomic_get(&boot_ok) & BIT(stage)) != 0;
+}
+
+int boot_wait(uint32_t stages, k_timeout_t timeout)
+{
+    return k_event_wait_all(&boot_done, stages, false, timeout) != 0 ? 0 : -EAGAIN;
+}
+
+static int cmd_hub_boot(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    uint32_t done = k_event_test(&boot_done, BOOT_STAGE_ALL);
+
+    shell_print(sh, "%-6s %8s %8s %8s %6s", "stage", "begin", "end", "took", "err");
+    for (size_t i = 0; i < BOOT_STAGE_COUNT; i++)
+    {
+        struct boot_stage_info *info = &boot_stages[i];
+
+        if (!(done & BIT(i)))
+        {
+            shell_print(sh, "%-6s %8lld %8s %8s %6s", info->name, info->begin_ms, "-", "-",
+                        "-");
+            continue;
+        }
+        shell_print(sh, "%-6s %8lld %8lld %8lld %6d", info->name, info->begin_ms,
+                    info->end_ms, info->end_ms - info->begin_ms, info->err);
+    }
+    shell_print(sh, "times in ms since reset, %s", done == BOOT_STAGE_ALL ? "ready" : "booting");
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), boot, NULL, "Boot stage timings", cmd_hub_boot, 1, 0);
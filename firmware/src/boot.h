@@ -0,0 +1,55 @@
+#ifndef BOOT_H
+#define BOOT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/*
+ * Boot stages.
+ *
+ * main() only starts the subsystems; each one brings itself up in its own
+ * thread or callback and ends its stage when done. Code that depends on a
+ * subsystem checks or waits for that stage instead of sleeping. Once every
+ * stage has ended the device is ready and the stage timings are printed,
+ * "hub boot" shows them again.
+ */
+
+enum boot_stage
+{
+    BOOT_STAGE_CAN,  /* controller started, ingest running */
+    BOOT_STAGE_HUBS, /* every hub answered its status request or gave up */
+    BOOT_STAGE_SD,   /* SD card mounted */
+    BOOT_STAGE_USB,  /* USB device enabled */
+    BOOT_STAGE_BT,   /* Bluetooth stack up */
+    BOOT_STAGE_ADV,  /* advertising */
+    BOOT_STAGE_COUNT,
+};
+
+#define BOOT_STAGE_ALL (BIT(BOOT_STAGE_COUNT) - 1)
+
+/**
+ * @brief Record that a stage started, from any thread
+ */
+void boot_stage_begin(enum boot_stage stage);
+
+/**
+ * @brief Record that a stage ended, with 0 or the error it failed with
+ *
+ * Only the first call per stage counts. A failed stage still ends: the
+ * device comes up without that subsystem.
+ */
+void boot_stage_end(enum boot_stage stage, int err);
+
+/**
+ * @brief True once the stage ended without error
+ */
+bool boot_stage_ok(enum boot_stage stage);
+
+/**
+ * @brief Wait until all stages in the BIT(stage) mask ended
+ *
+ * @return 0, or -EAGAIN on timeout
+ */
+int boot_wait(uint32_t stages, k_timeout_t timeout);
+
+#endif /* BOOT_H */
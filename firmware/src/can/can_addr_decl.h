@@ -3,27 +3,22 @@
 #include <zephyr/canbus/isotp.h>
 #include <zephyr/drivers/can.h>
 
-const struct isotp_fc_opts fc_opts_sensorhub1_sensor1 = {.bs = 0, .stmin = 0};
-const struct isotp_fc_opts fc_opts_sensorhub1_sensor2 = {.bs = 0, .stmin = 0};
-const struct isotp_fc_opts fc_opts_sensorhub1_sensor3 = {.bs = 0, .stmin = 0};
 const struct isotp_fc_opts fc_opts_sensorhub1_cmd = {.bs = 0, .stmin = 0};
-const struct isotp_fc_opts fc_opts_sensorhub2_sensor1 = {.bs = 0, .stmin = 0};
 const struct isotp_fc_opts fc_opts_sensorhub2_cmd = {.bs = 0, .stmin = 0};
+const struct isotp_fc_opts fc_opts_sample = {.bs = 0, .stmin = 0};
 #define BROADCAST_CAN_ID 0x000
 
-const struct isotp_msg_id rx_sensorhub2_sensor1 = {
-    .std_id = 0x160,
+/*
+ * Sample stream IDs come from sensor_registry[], the ISO-TP addresses of the
+ * sample channels are built from them with these options.
+ */
 #ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
+#define SAMPLE_ISOTP_FLAGS (ISOTP_MSG_FDF | ISOTP_MSG_BRS)
+#define SAMPLE_ISOTP_DL 64
+#else
+#define SAMPLE_ISOTP_FLAGS 0
+#define SAMPLE_ISOTP_DL 0
 #endif
-};
-const struct isotp_msg_id tx_sensorhub2_sensor1 = {
-    .std_id = 0x60,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .dl = 64,
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
 
 const struct isotp_msg_id rx_sensorhub2_cmd = {
     .std_id = 0x121,
@@ -40,45 +35,6 @@ const struct isotp_msg_id tx_sensorhub2_cmd = {
 #endif
 };
 
-const struct isotp_msg_id rx_sensorhub1_sensor1 = {
-    .std_id = 0x180,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
-const struct isotp_msg_id tx_sensorhub1_sensor1 = {
-    .std_id = 0x080,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .dl = 64,
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
-const struct isotp_msg_id rx_sensorhub1_sensor2 = {
-    .std_id = 0x101,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
-const struct isotp_msg_id tx_sensorhub1_sensor2 = {
-    .std_id = 0x01,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .dl = 64,
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
-const struct isotp_msg_id rx_sensorhub1_sensor3 = {
-    .std_id = 0x150,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
-const struct isotp_msg_id tx_sensorhub1_sensor3 = {
-    .std_id = 0x50,
-#ifdef CONFIG_SAMPLE_CAN_FD_MODE
-    .dl = 64,
-    .flags = ISOTP_MSG_FDF | ISOTP_MSG_BRS,
-#endif
-};
 const struct isotp_msg_id rx_sensorhub1_cmd = {
     .std_id = 0x010,
 #ifdef CONFIG_SAMPLE_CAN_FD_MODE
@@ -1,10 +1,28 @@
 #ifndef CAN_RX_TYPES_H
 #define CAN_RX_TYPES_H
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Samples start with a compact header: the stream id followed by the frame id
+ * of the stream. The stream id is (hub id << 4) | sensor number on that hub,
+ * with the hub id as reported in system_status_t.id and sensors counted from
+ * 1. Stream names live in the stream registry, see stream_registry.h.
+ */
+#define SAMPLE_STREAM_ID(hub, sensor) ((uint8_t)(((hub) << 4) | ((sensor) & 0x0F)))
+#define SAMPLE_STREAM_HUB(stream_id) ((stream_id) >> 4)
+#define SAMPLE_STREAM_SENSOR(stream_id) ((stream_id) & 0x0F)
+
+typedef struct __attribute__((__packed__))
+{
+    uint8_t stream_id;
+    uint32_t frame_id;
+} sample_header_t;
 
 typedef struct __attribute__((__packed__))
 {
-    char sensor_name[8];
+    uint8_t stream_id;
     uint32_t frame_id;
     struct
     {
@@ -14,7 +32,7 @@ typedef struct __attribute__((__packed__))
 
 typedef struct __attribute__((__packed__))
 {
-    char sensor_name[8];
+    uint8_t stream_id;
     uint32_t frame_id;
     struct
     {
@@ -32,7 +50,7 @@ typedef struct __attribute__((__packed__))
 
 typedef struct __attribute__((__packed__))
 {
-    char sensor_name[8];
+    uint8_t stream_id;
     uint32_t frame_id;
     struct
     {
@@ -43,7 +61,7 @@ typedef struct __attribute__((__packed__))
 
 typedef struct __attribute__((__packed__))
 {
-    char sensor_name[8];
+    uint8_t stream_id;
     uint32_t frame_id;
     struct
     {
@@ -76,6 +94,17 @@ typedef struct
     char sensor2_name[8];
 } system_status_t;
 
+/* Every sample struct starts with the fields of sample_header_t */
+#define SAMPLE_FRAME_ID_OFFSET offsetof(sample_header_t, frame_id)
+
+static inline uint32_t sample_frame_id(const void *sample)
+{
+    uint32_t frame_id;
+
+    memcpy(&frame_id, (const uint8_t *)sample + SAMPLE_FRAME_ID_OFFSET, sizeof(frame_id));
+    return frame_id;
+}
+
 #define SAMPLE2_BUFFER_SIZE sizeof(sample_sensor2_t)
 #define SAMPLE_BUFFER_SIZE sizeof(sample_sensor1_t)
 
@@ -3,85 +3,228 @@
 #include <zephyr/drivers/can.h>
 #include "can_addr_decl.h"
 #include "can_rx_types.h"
+#include "can_transport.h"
+#include "sample_seq.h"
+#include "stream_registry.h"
+#include "hub_cmd.h"
+#include "hub_sync.h"
+#include "boot.h"
+#include "sensors/sensor_registry.h"
 #include <session/session.h>
-#include <zephyr/drivers/uart.h>
+#include <session/sample_pipeline.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/shell/shell.h>
 
 #define CAN_CMD_LEN 1 // start/stop are single-byte
-#define SYSTEM_CMD_STOP 0
-#define SYSTEM_CMD_START 1
-#define SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_1 2
-#define SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_2 3
-#define SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_3 4
-#define SYSTEM_CMD_GET_STATUS 5
-#define SYSTEM_CMD_GET_NUM_SAMPLES_SENSOR_1 6
-#define SYSTEM_CMD_GET_NUM_SAMPLES_SENSOR_2 7
-#define SYSTEM_CMD_GET_NUM_SAMPLES_SENSOR_3 8
+
+/*
+ * Retransmit request: [cmd][first frame_id, LE32][count]. Several requests
+ * for the same hub are packed back to back into one ISO-TP PDU.
+ */
+#define RETRANSMIT_REQ_LEN 6
+#define RETRANSMIT_BATCH_MAX 8
+/* Collect gaps for this long before asking the hub */
+#define RETRANSMIT_BATCH_DELAY_MS 5
+
+/* Time a hub has to answer a status request */
+#define HUB_STATUS_TIMEOUT_MS 300
+/* A hub may still be starting up itself when we first ask */
+#define HUB_STATUS_ATTEMPTS 3
 
 const struct device *can_dev;
-struct isotp_recv_ctx recv_ctx_sensorhub1_cmd;
-struct isotp_recv_ctx recv_ctx_sensorhub1_sensor1;
-struct isotp_recv_ctx recv_ctx_sensorhub1_sensor2;
-struct isotp_recv_ctx recv_ctx_sensorhub1_sensor3;
-
-struct isotp_recv_ctx recv_ctx_sensorhub2_cmd;
-struct isotp_recv_ctx recv_ctx_sensorhub2_sensor1;
-static const struct device *const uart_dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
-
-K_THREAD_STACK_DEFINE(rx_sensorhub_sensor1_thread_stack, 1024);
-K_THREAD_STACK_DEFINE(rx_sensorhub_sensor2_thread_stack, 1024);
-K_THREAD_STACK_DEFINE(rx_sensorhub_sensor3_thread_stack, 1024);
-struct k_thread rx_sensorhub_sensor1_thread_data;
-struct k_thread rx_sensorhub_sensor2_thread_data;
-struct k_thread rx_sensorhub_sensor3_thread_data;
-
-K_THREAD_STACK_DEFINE(rx_sensorhub2_sensor1_thread_stack, 1024);
-struct k_thread rx_sensorhub2_sensor1_thread_data;
-
-
-#define MAX_FRAME_WINDOW 20
-
-#define VL_RING_SIZE    (MAX_FRAME_WINDOW * sizeof(sample_sensor1_t))
-#define ADS_RING_SIZE   (MAX_FRAME_WINDOW * sizeof(sample_sensor2_t))
-#define SDP_RING_SIZE   (MAX_FRAME_WINDOW * sizeof(sample_sensor3_t))
-#define BHI_RING_SIZE   (MAX_FRAME_WINDOW * sizeof(sample_sensor4_t))
-
-RING_BUF_DECLARE(vl_ring, VL_RING_SIZE);
-RING_BUF_DECLARE(ads_ring, ADS_RING_SIZE);
-RING_BUF_DECLARE(sdp_ring, SDP_RING_SIZE);
-RING_BUF_DECLARE(bhi_ring, BHI_RING_SIZE);
-
-uint8_t vl_backing_array[VL_RING_SIZE];
-uint8_t ads_backing_array[ADS_RING_SIZE];
-uint8_t sdp_backing_array[SDP_RING_SIZE];
-uint8_t bhi_backing_array[BHI_RING_SIZE];
-
-struct ring_buf bhi_ring;
-struct ring_buf vl_ring;
-struct ring_buf sdp_ring;
-struct ring_buf ads_ring;
-
-int process_bhi_sample(sample_sensor4_t *sample) {
-    ring_buf_put(&bhi_ring, (uint8_t *)sample, sizeof(sample_sensor4_t));
-    return 0;
+
+struct retransmit_req
+{
+    uint8_t cmd;
+    uint32_t first;
+    uint8_t count;
+};
+
+/* Command addresses of the hubs, commands themselves go through hub_cmd */
+static const struct hub_cmd_addr sensorhub_addrs[] = {
+    [SENSORHUB_1] = {
+        .name = "sensorhub1",
+        .tx_addr = &tx_sensorhub1_cmd,
+        .rx_addr = &rx_sensorhub1_cmd,
+        .fc_opts = &fc_opts_sensorhub1_cmd,
+    },
+    [SENSORHUB_2] = {
+        .name = "sensorhub2",
+        .tx_addr = &tx_sensorhub2_cmd,
+        .rx_addr = &rx_sensorhub2_cmd,
+        .fc_opts = &fc_opts_sensorhub2_cmd,
+    },
+};
+
+/* Retransmit batching per hub */
+struct sensorhub_link
+{
+    uint8_t hub;
+
+    /* Retransmit requests waiting for the next batch, filled by ingest */
+    struct k_spinlock lock;
+    struct retransmit_req pending[RETRANSMIT_BATCH_MAX];
+    uint8_t num_pending;
+    struct k_work_delayable retransmit_work;
+
+    uint32_t retransmit_sent;
+    uint32_t retransmit_dropped;
+};
+
+static struct sensorhub_link sensorhub_links[] = {
+    [SENSORHUB_1] = {.hub = SENSORHUB_1},
+    [SENSORHUB_2] = {.hub = SENSORHUB_2},
+};
+
+/* One ingest thread services every bound sample channel, see can_ingest_thread() */
+#define CAN_INGEST_STACK_SIZE 2048
+#define CAN_INGEST_PRIORITY 1
+/* Drop a half-received PDU when no further fragment arrives within this time */
+#define CAN_INGEST_REASSEMBLY_TIMEOUT_MS 100
+
+K_THREAD_STACK_DEFINE(can_ingest_thread_stack, CAN_INGEST_STACK_SIZE);
+struct k_thread can_ingest_thread_data;
+
+
+/*
+ * Sample slab.
+ *
+ * ISO-TP fragments are reassembled straight into a slot claimed from this
+ * slab and the per-sensor rings only carry the slot pointer. The consumer
+ * hands the slot back with can_sample_release() once it is done with it.
+ * Every ring can hold a full window, every reorder stage can hold back up
+ * to its window waiting for a missing frame, and each channel can have one
+ * sample in reassembly on top of that. A gap on one stream then never takes
+ * the slots of the others.
+ */
+#define SAMPLE_SLOT_TIME_OFFSET ROUND_UP(SENSOR_SAMPLE_SIZE_MAX, 8)
+#define SAMPLE_SLOT_SYNC_OFFSET (SAMPLE_SLOT_TIME_OFFSET + sizeof(uint64_t))
+#define SAMPLE_SLOT_SIZE (SAMPLE_SLOT_SYNC_OFFSET + sizeof(uint64_t))
+#define SAMPLE_SLOT_COUNT (SENSOR_COUNT * (SENSOR_RING_SIZE + SAMPLE_REORDER_WINDOW + 1))
+
+/* A reorder stage holds at most SAMPLE_REORDER_WINDOW - 1 slots */
+BUILD_ASSERT(SAMPLE_SLOT_COUNT >=
+                 SENSOR_COUNT * (SENSOR_RING_SIZE + (SAMPLE_REORDER_WINDOW - 1) + 1),
+             "sample slab must cover every ring, reorder window and reassembly");
+
+K_MEM_SLAB_DEFINE_STATIC(sample_slab, SAMPLE_SLOT_SIZE, SAMPLE_SLOT_COUNT, 8);
+
+void can_sample_release(void *sample)
+{
+    if (sample != NULL)
+    {
+        k_mem_slab_free(&sample_slab, sample);
+    }
 }
 
-int process_sdp_sample(sample_sensor3_t *sample) {
-    ring_buf_put(&sdp_ring, (uint8_t *)sample, sizeof(sample_sensor3_t));
-    return 0;
+uint64_t can_sample_rx_time(const void *sample)
+{
+    return *(const uint64_t *)((const uint8_t *)sample + SAMPLE_SLOT_TIME_OFFSET);
 }
 
-int process_vl_sample(sample_sensor1_t *sample) {
-    ring_buf_put(&vl_ring, (uint8_t *)sample, sizeof(sample_sensor1_t));
-    return 0;
+static void can_sample_set_rx_time(void *sample, uint64_t rx_us)
+{
+    *(uint64_t *)((uint8_t *)sample + SAMPLE_SLOT_TIME_OFFSET) = rx_us;
 }
 
-int process_ads_sample(sample_sensor2_t *sample) {
-    ring_buf_put(&ads_ring, (uint8_t *)sample, sizeof(sample_sensor2_t));
-    return 0;
+uint64_t can_sample_time(const void *sample)
+{
+    return *(const uint64_t *)((const uint8_t *)sample + SAMPLE_SLOT_SYNC_OFFSET);
 }
 
+static void can_sample_set_time(void *sample, uint64_t time_us)
+{
+    *(uint64_t *)((uint8_t *)sample + SAMPLE_SLOT_SYNC_OFFSET) = time_us;
+}
+
+uint64_t can_rx_time_now(void)
+{
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+    return k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
+
+#ifdef CONFIG_CAN_RX_TIMESTAMP
+/*
+ * The controller stamps the start of every frame with a 16-bit count of
+ * bit times. It wraps every 131 ms at 500 kbit/s, so it only gives the
+ * spacing of frames; the cycle counter places them. An estimate more than
+ * this far behind the ISR, or ahead of it, starts over from the ISR time.
+ */
+#define CAN_RX_TIMESTAMP_SLACK_US 1000
+#endif
+
+/*
+ * Sample channels, one per entry of sensor_registry[].
+ *
+ * Every channel is one ISO-TP stream coming from a sensorhub. The ingest
+ * thread binds all of them at start-up, waits on their receive FIFOs together
+ * and puts every sample of a PDU on the ring of its sensor.
+ *
+ * A PDU carries one or more samples of its stream back to back, so its length
+ * is a multiple of sample_size. Classic CAN hubs send one sample per PDU, in
+ * CAN FD mode they pack as many as fit into a single 64-byte frame.
+ *
+ * Fragments are copied once, from the ISO-TP net_buf into a sample slab
+ * slot that is claimed on the first byte of each sample.
+ */
+struct can_rx_channel
+{
+    const struct sensor_desc *desc;
+    struct isotp_recv_ctx ctx;
+    struct isotp_msg_id hub_tx; /* ID the hub sends on, our rx address */
+    struct isotp_msg_id hub_rx; /* ID the hub listens on for flow control */
+    struct can_filter raw_filter;
+
+    /* Reassembly state, owned by the ingest thread or the raw frame ISR */
+    bool bound;
+    bool raw;
+    size_t received;     /* bytes of the sample in slot */
+    size_t pdu_received; /* bytes of the PDU in flight */
+    int64_t last_frag_time;
+    uint8_t *slot;
+    uint32_t slab_drops;
+    struct sample_seq seq;
+    atomic_t seq_reset;
+#ifdef CONFIG_CAN_RX_TIMESTAMP
+    /* Controller timestamp of the last raw frame and its time in us */
+    uint16_t frame_stamp;
+    uint64_t frame_time_us;
+    uint32_t stamp_resyncs;
+#endif
+
+    uint32_t pdus;
+    uint32_t samples;
+    uint32_t raw_malformed;
+};
+
+static struct can_rx_channel can_rx_channels[SENSOR_COUNT];
+
+static void can_rx_channel_init(struct can_rx_channel *ch, const struct sensor_desc *desc)
+{
+    ch->desc = desc;
+    ch->hub_tx = (struct isotp_msg_id){
+        .std_id = desc->hub_tx_id,
+        .dl = SAMPLE_ISOTP_DL,
+        .flags = SAMPLE_ISOTP_FLAGS,
+    };
+    ch->hub_rx = (struct isotp_msg_id){
+        .std_id = desc->hub_rx_id,
+        .flags = SAMPLE_ISOTP_FLAGS,
+    };
+}
+
+static struct k_poll_event can_rx_events[ARRAY_SIZE(can_rx_channels)];
 
 void can_transmit_start_msg() {
+    /* Hubs restart their frame counters, whoever feeds a channel resets it */
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
+    {
+        atomic_set(&can_rx_channels[i].seq_reset, 1);
+    }
+    hub_sync_reset();
     struct can_frame start_frame = {
         .id = 0x0,
         .dlc = 1,
@@ -98,220 +241,454 @@ void can_transmit_stop_msg() {
     };
     can_send(can_dev, &stop_frame, K_MSEC(2), NULL, NULL);
 }
-char bhi360_line[256];
-sample_sensor4_t bhi360_fusion_sample;
-void rx_sensorhub2_sensor1_thread(void *arg1, void *arg2, void *arg3)
+
+/*
+ * Queue a retransmit request for a frame_id gap. Frames further back than the
+ * reorder window could not be slotted in anymore, so they are not asked for.
+ */
+static void request_retransmit(struct can_rx_channel *ch, uint32_t first, uint32_t count)
 {
-    ARG_UNUSED(arg1);
-    ARG_UNUSED(arg2);
-    ARG_UNUSED(arg3);
-    int ret, received_len;
-    static uint8_t rx_buffer[256];
+    struct sensorhub_link *link = &sensorhub_links[ch->desc->hub];
+
+    if (count > SAMPLE_REORDER_WINDOW)
+    {
+        first += count - SAMPLE_REORDER_WINDOW;
+        count = SAMPLE_REORDER_WINDOW;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&link->lock);
+    struct retransmit_req *last = link->num_pending ? &link->pending[link->num_pending - 1] : NULL;
+
+    if (last != NULL && last->cmd == ch->desc->retransmit_cmd &&
+        last->first + last->count == first && last->count + count <= UINT8_MAX)
+    {
+        last->count += count;
+    }
+    else if (link->num_pending < RETRANSMIT_BATCH_MAX)
+    {
+        link->pending[link->num_pending++] = (struct retransmit_req){
+            .cmd = ch->desc->retransmit_cmd,
+            .first = first,
+            .count = count,
+        };
+    }
+    else
+    {
+        link->retransmit_dropped++;
+    }
+    k_spin_unlock(&link->lock, key);
+
+    k_work_schedule(&link->retransmit_work, K_MSEC(RETRANSMIT_BATCH_DELAY_MS));
+}
+
+/* Forget the PDU in flight and give the slot of its partial sample back */
+static void can_rx_channel_reset(struct can_rx_channel *ch)
+{
+    if (ch->slot != NULL)
+    {
+        can_sample_release(ch->slot);
+        ch->slot = NULL;
+    }
+    ch->received = 0;
+    ch->pdu_received = 0;
+}
+
+/* Frame-id check of a finished sample, false if it was a duplicate and got released */
+static bool can_rx_seq_accept(struct can_rx_channel *ch, void *sample)
+{
+    uint32_t gap_first, gap_count;
+    uint64_t hub_us;
+
+    if (atomic_cas(&ch->seq_reset, 1, 0))
+    {
+        memset(&ch->seq, 0, sizeof(ch->seq));
+    }
+
+    switch (sample_seq_check(&ch->seq, sample_frame_id(sample), &gap_first, &gap_count))
+    {
+    case SAMPLE_SEQ_DUPLICATE:
+        can_sample_release(sample);
+        return false;
+    case SAMPLE_SEQ_GAP:
+        request_retransmit(ch, gap_first, gap_count);
+        break;
+    default:
+        break;
+    }
+
+    /* Hub time of the sample on the mainhub clock */
+    hub_us = (uint64_t)sample_frame_id(sample) * ch->desc->period_us;
+    can_sample_set_time(sample, hub_sync_map(ch->desc->hub, hub_us, can_sample_rx_time(sample)));
+
+    ch->samples++;
+    return true;
+}
+
+/*
+ * Hand the sample in the channel slot to its stream. Without a slot the bytes
+ * were only counted to stay aligned on the next sample of the PDU.
+ */
+static void can_rx_channel_complete(struct can_rx_channel *ch, uint64_t rx_us)
+{
+    uint8_t *slot = ch->slot;
+
+    ch->slot = NULL;
+    ch->received = 0;
 
-    ret = isotp_bind(&recv_ctx_sensorhub2_sensor1, can_dev,
-                     &tx_sensorhub2_sensor1, &rx_sensorhub2_sensor1,
-                     &fc_opts_sensorhub2_sensor1, K_FOREVER);
-    if (ret != ISOTP_N_OK)
+    if (slot != NULL)
     {
-        printk("Failed to bind to rx ID %d [%d]\n",
-               rx_sensorhub2_sensor1.std_id, ret);
+        can_sample_set_rx_time(slot, rx_us);
+    }
+    if (slot != NULL && can_rx_seq_accept(ch, slot))
+    {
+        if (IS_ENABLED(CONFIG_APP_CAN_PRINT_SAMPLES))
+        {
+            sensor_print_sample(ch->desc, slot);
+        }
+        can_sample_release(sample_ring_put(ch->desc->ring, slot));
+        sample_pipeline_notify(ch->desc->ring);
+    }
+}
+
+#ifdef CONFIG_SAMPLE_CAN_RAW_FRAMES
+/* Receive time of a raw frame, from its controller timestamp if there is one */
+static uint64_t can_rx_frame_time(struct can_rx_channel *ch, const struct can_frame *frame)
+{
+    uint64_t now = can_rx_time_now();
+
+#ifdef CONFIG_CAN_RX_TIMESTAMP
+    uint16_t bits = frame->timestamp - ch->frame_stamp;
+    uint64_t t = ch->frame_time_us + (uint64_t)bits * USEC_PER_SEC / CONFIG_CAN_DEFAULT_BITRATE;
+
+    ch->frame_stamp = frame->timestamp;
+    if (t > now || now - t > CAN_RX_TIMESTAMP_SLACK_US)
+    {
+        t = now;
+        ch->stamp_resyncs++;
+    }
+    ch->frame_time_us = t;
+    return t;
+#else
+    ARG_UNUSED(ch);
+    ARG_UNUSED(frame);
+    return now;
+#endif
+}
+
+/*
+ * Raw sample frame: [count][count samples back to back].
+ *
+ * Runs in the CAN driver ISR and is the only producer of the channel ring
+ * while the filter is installed. Samples go from the frame into a slab slot
+ * and onto the ring, the debug prints of the PDU handlers are skipped.
+ * Retransmit requests are only queued here, the work queue sends them.
+ */
+static void can_rx_raw_frame_cb(const struct device *dev, struct can_frame *frame,
+                                void *user_data)
+{
+    struct can_rx_channel *ch = user_data;
+    uint64_t rx_us = can_rx_frame_time(ch, frame);
+    uint8_t len = can_dlc_to_bytes(frame->dlc);
+    uint8_t count = frame->data[0];
+
+    ARG_UNUSED(dev);
+
+    if (count == 0 || 1 + count * ch->desc->sample_size > len)
+    {
+        ch->raw_malformed++;
         return;
     }
 
-    while (1)
+    for (uint8_t i = 0; i < count; i++)
     {
-        received_len = isotp_recv(&recv_ctx_sensorhub2_sensor1, rx_buffer,
-                                  sizeof(rx_buffer) - 1U, K_MSEC(2000));
-        if (received_len < 0)
+        void *slot;
+
+        if (k_mem_slab_alloc(&sample_slab, &slot, K_NO_WAIT) != 0)
         {
-            // printk("Receiving error [%d]\n", received_len);
+            ch->slab_drops++;
             continue;
         }
-        if (received_len >= sizeof(sample_sensor4_t))
-        {
 
-            memcpy(&bhi360_fusion_sample, rx_buffer, sizeof(sample_sensor4_t));
-            process_bhi_sample(&bhi360_fusion_sample);
-            printk("Sensor: %.*s\n", 8, bhi360_fusion_sample.sensor_name);
-            printk("Frame ID: %u\n", bhi360_fusion_sample.frame_id);
-            printk("Pitch: %f deg\n", bhi360_fusion_sample.data.pitch_deg);
-            printk("Roll: %f deg\n", bhi360_fusion_sample.data.roll_deg);
-            printk("Yaw: %f deg\n", bhi360_fusion_sample.data.yaw_deg);
-            size_t len = snprintf(bhi360_line, sizeof(bhi360_line), "BHI360FUS, %d, %f, %f, %f\n", bhi360_fusion_sample.frame_id, bhi360_fusion_sample.data.pitch_deg, bhi360_fusion_sample.data.roll_deg, bhi360_fusion_sample.data.yaw_deg);
-            uart_fifo_fill(uart_dev, bhi360_line, len);
-        }
-        else
+        memcpy(slot, &frame->data[1 + i * ch->desc->sample_size], ch->desc->sample_size);
+        can_sample_set_rx_time(slot, rx_us);
+        if (can_rx_seq_accept(ch, slot))
         {
-            // printk("Received incomplete data (%d bytes)\n", received_len);
+            can_sample_release(sample_ring_put(ch->desc->ring, slot));
+            sample_pipeline_notify(ch->desc->ring);
         }
     }
+    ch->pdus++;
 }
 
-sample_sensor1_t sample;
-void rx_sensorhub_sensor1_thread(void *arg1, void *arg2, void *arg3)
+/* Move a channel to raw frames, it stays on ISO-TP if no filter is free */
+static bool can_rx_channel_add_raw(struct can_rx_channel *ch)
 {
-    ARG_UNUSED(arg1);
-    ARG_UNUSED(arg2);
-    ARG_UNUSED(arg3);
+    int ret;
 
-    int ret, rem_len, received_len;
-    struct net_buf *buf;
+    if (ch->desc->raw_id == 0 || 1 + ch->desc->sample_size > CAN_MAX_DLEN)
+    {
+        /* No raw ID, or not even one sample fits in a frame */
+        return false;
+    }
 
-    ret = isotp_bind(&recv_ctx_sensorhub1_sensor1, can_dev,
-                     &tx_sensorhub1_sensor1, &rx_sensorhub1_sensor1,
-                     &fc_opts_sensorhub1_sensor1, K_FOREVER);
-    if (ret != ISOTP_N_OK)
+    ch->raw_filter = (struct can_filter){
+        .id = ch->desc->raw_id,
+        .mask = CAN_STD_ID_MASK,
+    };
+    ret = can_add_rx_filter(can_dev, can_rx_raw_frame_cb, ch, &ch->raw_filter);
+    if (ret < 0)
     {
-        printk("Failed to bind to rx ID %d [%d]\n",
-               rx_sensorhub1_sensor1.std_id, ret);
-        return;
+        printk("Failed to add raw filter for ID %d [%d]\n", ch->raw_filter.id, ret);
+        return false;
     }
 
-    uint8_t rx_data[SAMPLE_BUFFER_SIZE];
-    uint8_t *write_ptr = rx_data;
+    ch->raw = true;
+    return true;
+}
+#endif /* CONFIG_SAMPLE_CAN_RAW_FRAMES */
+
+/* Pull every fragment that is already queued on the channel, never blocks */
+static void can_rx_channel_drain(struct can_rx_channel *ch)
+{
+    struct net_buf *buf;
+    uint64_t rx_us;
+    int rem_len;
 
     while (1)
     {
-        received_len = 0;
-        write_ptr = rx_data;
+        rem_len = isotp_recv_net(&ch->ctx, &buf, K_NO_WAIT);
+        /* ISO-TP keeps the frame timestamps to itself, this is when we got them */
+        rx_us = can_rx_time_now();
+        if (rem_len == ISOTP_RECV_TIMEOUT)
+        {
+            /* FIFO empty, rest of the PDU has not arrived yet */
+            return;
+        }
+        if (rem_len < 0)
+        {
+            // printk("Receiving error [%d]\n", rem_len);
+            can_rx_channel_reset(ch);
+            return;
+        }
 
-        do
+        while (buf != NULL)
         {
-            rem_len = isotp_recv_net(&recv_ctx_sensorhub1_sensor1, &buf, K_MSEC(2000));
-            if (rem_len < 0)
-            {
-                // printk("Receiving error [%d]\n", rem_len);
-                break;
-            }
+            const uint8_t *data = buf->data;
+            size_t len = buf->len;
 
-            while (buf != NULL)
+            while (len > 0)
             {
-                size_t copy_len = MIN(buf->len, SAMPLE_BUFFER_SIZE - received_len);
-                memcpy(write_ptr, buf->data, copy_len);
-                write_ptr += copy_len;
-                received_len += copy_len;
-
-                buf = net_buf_frag_del(NULL, buf);
+                if (ch->received == 0 &&
+                    k_mem_slab_alloc(&sample_slab, (void **)&ch->slot, K_NO_WAIT) != 0)
+                {
+                    /* Consumers are behind, this sample is dropped */
+                    ch->slot = NULL;
+                    ch->slab_drops++;
+                }
+
+                size_t copy_len = MIN(len, ch->desc->sample_size - ch->received);
+                if (ch->slot != NULL)
+                {
+                    memcpy(&ch->slot[ch->received], data, copy_len);
+                }
+                ch->received += copy_len;
+                ch->pdu_received += copy_len;
+                data += copy_len;
+                len -= copy_len;
+
+                if (ch->received == ch->desc->sample_size)
+                {
+                    can_rx_channel_complete(ch, rx_us);
+                }
             }
-        } while (rem_len);
 
-        // printk("Got %d bytes in total\n", received_len);
-
-        if (received_len >= sizeof(sample_sensor1_t))
-        {
-            memcpy(&sample, rx_data, sizeof(sample_sensor1_t));
-            process_vl_sample(&sample);
-            printk("Sensor: %.*s\n", 8, sample.sensor_name);
-            printk("Frame ID: %u\n", sample.frame_id);
-            printk("Distance: %d mm\n", sample.data.distance_mm);
+            buf = net_buf_frag_del(NULL, buf);
         }
-        else
+        ch->last_frag_time = k_uptime_get();
+
+        if (rem_len == 0)
         {
-            // printk("Received incomplete data (%d bytes)\n", received_len);
+            if (ch->received != 0 || ch->pdu_received == 0)
+            {
+                /* PDU length was not a whole number of samples */
+                // printk("Received incomplete data (%d bytes)\n", ch->pdu_received);
+                can_rx_channel_reset(ch);
+            }
+            else
+            {
+                ch->pdus++;
+                ch->pdu_received = 0;
+            }
         }
     }
 }
-sample_sensor2_t ads7138_sample;
-void rx_sensorhub_sensor2_thread(void *arg1, void *arg2, void *arg3)
+
+void can_ingest_thread(void *arg1, void *arg2, void *arg3)
 {
     ARG_UNUSED(arg1);
     ARG_UNUSED(arg2);
     ARG_UNUSED(arg3);
-    int ret, received_len;
-    static uint8_t rx_buffer[32];
+    int ret;
 
-    ret = isotp_bind(&recv_ctx_sensorhub1_sensor2, can_dev,
-                     &tx_sensorhub1_sensor2, &rx_sensorhub1_sensor2,
-                     &fc_opts_sensorhub1_sensor2, K_FOREVER);
-    if (ret != ISOTP_N_OK)
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
     {
-        printk("Failed to bind to rx ID %d [%d]\n",
-               rx_sensorhub1_sensor2.std_id, ret);
-        return;
-    }
+        struct can_rx_channel *ch = &can_rx_channels[i];
 
-    while (1)
-    {
-        received_len = isotp_recv(&recv_ctx_sensorhub1_sensor2, rx_buffer,
-                                  sizeof(rx_buffer) - 1U, K_MSEC(2000));
-        if (received_len < 0)
+#ifdef CONFIG_SAMPLE_CAN_RAW_FRAMES
+        if (can_rx_channel_add_raw(ch))
         {
-            // printk("Receiving error [%d]\n", received_len);
+            k_poll_event_init(&can_rx_events[i], K_POLL_TYPE_IGNORE,
+                              K_POLL_MODE_NOTIFY_ONLY, NULL);
             continue;
         }
-        if (received_len >= sizeof(sample_sensor2_t))
+#endif
+
+        ret = isotp_bind(&ch->ctx, can_dev, &ch->hub_tx, &ch->hub_rx,
+                         &fc_opts_sample, K_FOREVER);
+        if (ret != ISOTP_N_OK)
         {
-            memcpy(&ads7138_sample, rx_buffer, sizeof(sample_sensor2_t));
-            process_ads_sample(&ads7138_sample);
-            printk("Sensor: %.*s\n", 8, ads7138_sample.sensor_name);
-            printk("Frame ID: %u\n", ads7138_sample.frame_id);
-            printk("CH1: %d mv\n", ads7138_sample.data.ch1_mv);
-            printk("CH2: %d mv\n", ads7138_sample.data.ch2_mv);
-            printk("CH3: %d mv\n", ads7138_sample.data.ch3_mv);
-            printk("CH4: %d mv\n", ads7138_sample.data.ch4_mv);
-            printk("CH5: %d mv\n", ads7138_sample.data.ch5_mv);
-            printk("CH6: %d mv\n", ads7138_sample.data.ch6_mv);
-            printk("CH7: %d mv\n", ads7138_sample.data.ch7_mv);
-            printk("CH8: %d mv\n", ads7138_sample.data.ch8_mv);
+            printk("Failed to bind to rx ID %d [%d]\n",
+                   ch->hub_tx.std_id, ret);
+            /* Leave the event ignored so the other channels keep running */
+            k_poll_event_init(&can_rx_events[i], K_POLL_TYPE_IGNORE,
+                              K_POLL_MODE_NOTIFY_ONLY, NULL);
+            continue;
         }
-        else
+
+        ch->bound = true;
+        k_poll_event_init(&can_rx_events[i], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+                          K_POLL_MODE_NOTIFY_ONLY, &ch->ctx.fifo);
+    }
+
+    while (1)
+    {
+        ret = k_poll(can_rx_events, ARRAY_SIZE(can_rx_events),
+                     K_MSEC(CAN_INGEST_REASSEMBLY_TIMEOUT_MS));
+        int64_t now = k_uptime_get();
+
+        for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
         {
-            // printk("Received incomplete data (%d bytes)\n", received_len);
+            struct can_rx_channel *ch = &can_rx_channels[i];
+
+            if (!ch->bound)
+            {
+                continue;
+            }
+
+            if (can_rx_events[i].state == K_POLL_STATE_FIFO_DATA_AVAILABLE)
+            {
+                can_rx_events[i].state = K_POLL_STATE_NOT_READY;
+                can_rx_channel_drain(ch);
+            }
+            else if (ch->pdu_received != 0 &&
+                     now - ch->last_frag_time > CAN_INGEST_REASSEMBLY_TIMEOUT_MS)
+            {
+                // printk("Dropping stale partial PDU on %s\n", ch->desc->key);
+                can_rx_channel_reset(ch);
+            }
         }
     }
 }
 
-sample_sensor3_t sdp810_sample;
-void rx_sensorhub_sensor3_thread(void *arg1, void *arg2, void *arg3)
+static int cmd_hub_rings(const struct shell *sh, size_t argc, char **argv)
 {
-    ARG_UNUSED(arg1);
-    ARG_UNUSED(arg2);
-    ARG_UNUSED(arg3);
-    int ret, received_len;
-    static uint8_t rx_buffer[32];
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
 
-    ret = isotp_bind(&recv_ctx_sensorhub1_sensor3, can_dev,
-                     &tx_sensorhub1_sensor3, &rx_sensorhub1_sensor3,
-                     &fc_opts_sensorhub1_sensor3, K_FOREVER);
-    if (ret != ISOTP_N_OK)
+    shell_print(sh, "%-10s %5s %5s %5s %8s %10s", "ring", "used", "size", "peak", "drops", "slab_drops");
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
     {
-        printk("Failed to bind to rx ID %d [%d]\n",
-               rx_sensorhub1_sensor3.std_id, ret);
-        return;
-    }
+        struct can_rx_channel *ch = &can_rx_channels[i];
+        struct sample_ring *ring = ch->desc->ring;
 
-    while (1)
+        shell_print(sh, "%-10s %5u %5u %5u %8u %10u", ring->name,
+                    sample_ring_used(ring), sample_ring_capacity(ring),
+                    (uint32_t)atomic_get(&ring->high_water),
+                    (uint32_t)atomic_get(&ring->drops), ch->slab_drops);
+    }
+    shell_print(sh, "sample slab: %u/%u slots in use",
+                k_mem_slab_num_used_get(&sample_slab), SAMPLE_SLOT_COUNT);
+#ifdef CONFIG_CAN_RX_TIMESTAMP
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
     {
-        received_len = isotp_recv(&recv_ctx_sensorhub1_sensor3, rx_buffer,
-                                  sizeof(rx_buffer) - 1U, K_MSEC(2000));
-        if (received_len < 0)
-        {
-            // printk("Receiving error [%d]\n", received_len);
-            continue;
-        }
-        if (received_len >= sizeof(sample_sensor3_t))
-        {
+        struct can_rx_channel *ch = &can_rx_channels[i];
 
-            memcpy(&sdp810_sample, rx_buffer, sizeof(sample_sensor3_t));
-            printk("Sensor: %.*s\n", 8, sdp810_sample.sensor_name);
-            printk("Frame ID: %u\n", sdp810_sample.frame_id);
-            printk("Pressure: %.16f mbar\n", (double)sdp810_sample.data.pressure);
-            printk("Temp: %.16f fahrenheit\n", (double)sdp810_sample.data.temp);
-            process_sdp_sample(&sdp810_sample);
-        }
-        else
+        if (ch->raw)
         {
-            // printk("Received incomplete data (%d bytes)\n", received_len);
+            shell_print(sh, "%s: rx time from controller timestamps, %u resyncs", ch->desc->key,
+                        ch->stamp_resyncs);
         }
     }
+#endif
+
+    return 0;
+}
+
+static int cmd_hub_seq(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-10s %8s %8s %8s %8s", "stream", "missed", "late", "dup", "resync");
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
+    {
+        struct can_rx_channel *ch = &can_rx_channels[i];
+
+        shell_print(sh, "%-10s %8u %8u %8u %8u", ch->desc->key, ch->seq.missed,
+                    ch->seq.late, ch->seq.duplicates, ch->seq.resyncs);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(sensorhub_links); i++)
+    {
+        shell_print(sh, "%s: %u retransmit requests sent, %u dropped",
+                    sensorhub_addrs[i].name, sensorhub_links[i].retransmit_sent,
+                    sensorhub_links[i].retransmit_dropped);
+    }
+
+    return 0;
 }
 
-void send_complete_cb(int error_nr, void *arg)
+SHELL_SUBCMD_ADD((hub), seq, NULL, "Frame-id gap, duplicate and retransmit counters",
+                 cmd_hub_seq, 1, 0);
+
+static int cmd_hub_rate(const struct shell *sh, size_t argc, char **argv)
 {
-    ARG_UNUSED(arg);
-    printk("TX complete cb [%d]\n", error_nr);
+    static int64_t last_time;
+    static uint32_t last_pdus[ARRAY_SIZE(can_rx_channels)];
+    static uint32_t last_samples[ARRAY_SIZE(can_rx_channels)];
+    int64_t now = k_uptime_get();
+    int64_t elapsed = now - last_time;
+
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-10s %6s %8s %10s %10s %10s", "stream", "path", "pdu/s", "sample/s",
+                "per pdu", "malformed");
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
+    {
+        struct can_rx_channel *ch = &can_rx_channels[i];
+        uint32_t pdus = ch->pdus - last_pdus[i];
+        uint32_t samples = ch->samples - last_samples[i];
+
+        shell_print(sh, "%-10s %6s %8u %10u %10u %10u", ch->desc->key,
+                    ch->raw ? "raw" : "isotp",
+                    (uint32_t)(pdus * 1000LL / MAX(elapsed, 1)),
+                    (uint32_t)(samples * 1000LL / MAX(elapsed, 1)),
+                    pdus ? samples / pdus : 0, ch->raw_malformed);
+        last_pdus[i] = ch->pdus;
+        last_samples[i] = ch->samples;
+    }
+    shell_print(sh, "over %lld ms", elapsed);
+    last_time = now;
+
+    return 0;
 }
 
+SHELL_SUBCMD_ADD((hub), rate, NULL, "Received PDUs and samples per second since the last call",
+                 cmd_hub_rate, 1, 0);
+
+SHELL_SUBCMD_ADD((hub), rings, NULL, "Sample ring fill, peak and drop counters",
+                 cmd_hub_rings, 1, 0);
+
 int send_raw_can_cmd(uint8_t cmd)
 {
     struct can_frame frame = {
@@ -329,38 +706,48 @@ int send_raw_can_cmd(uint8_t cmd)
     }
     return ret;
 }
-int send_command(uint8_t cmd)
-{
-    static struct isotp_send_ctx send_ctx;
-    return isotp_send(&send_ctx, can_dev,
-                      &cmd, sizeof(cmd),
-                      &tx_sensorhub1_cmd, &rx_sensorhub1_cmd,
-                      send_complete_cb, NULL);
-}
 
-int send_command_sensorhub2(uint8_t cmd)
+static void retransmit_work_handler(struct k_work *work)
 {
-    static struct isotp_send_ctx send_ctx;
-    return isotp_send(&send_ctx, can_dev,
-                      &cmd, sizeof(cmd),
-                      &tx_sensorhub2_cmd, &rx_sensorhub2_cmd,
-                      send_complete_cb, NULL);
-}
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct sensorhub_link *link = CONTAINER_OF(dwork, struct sensorhub_link, retransmit_work);
+    uint8_t buf[RETRANSMIT_BATCH_MAX * RETRANSMIT_REQ_LEN];
+    size_t len = 0;
+    uint8_t num;
 
+    BUILD_ASSERT(sizeof(buf) <= HUB_CMD_MAX_LEN);
 
-int receive_response(uint8_t *rx_buffer, size_t buffer_len, int timeout_ms)
-{
-    return isotp_recv(&recv_ctx_sensorhub1_cmd, rx_buffer, buffer_len, K_MSEC(timeout_ms));
-}
+    k_spinlock_key_t key = k_spin_lock(&link->lock);
+    num = link->num_pending;
+    for (uint8_t i = 0; i < num; i++)
+    {
+        buf[len++] = link->pending[i].cmd;
+        sys_put_le32(link->pending[i].first, &buf[len]);
+        len += sizeof(uint32_t);
+        buf[len++] = link->pending[i].count;
+    }
+    link->num_pending = 0;
+    k_spin_unlock(&link->lock, key);
 
-int receive_response_sensorhub2(uint8_t *rx_buffer, size_t buffer_len, int timeout_ms)
-{
-    return isotp_recv(&recv_ctx_sensorhub2_cmd, rx_buffer, buffer_len, K_MSEC(timeout_ms));
+    if (num == 0)
+    {
+        return;
+    }
+
+    /* Queued behind whatever else goes to the hub, never waits for it */
+    int ret = hub_cmd_submit(link->hub, buf, len, 0, NULL, NULL);
+    if (ret < 0)
+    {
+        printk("Retransmit request to %s failed [%d]\n", sensorhub_addrs[link->hub].name, ret);
+        link->retransmit_dropped += num;
+        return;
+    }
+    link->retransmit_sent += num;
 }
 
-void print_status(uint8_t *data)
+void print_status(const uint8_t *data)
 {
-    system_status_t *status = (system_status_t *)data;
+    const system_status_t *status = (const system_status_t *)data;
     printk("System ID: %d\n", status->id);
     printk("State: %d\n", status->state);
     printk("Sensor 1 SR: %d Hz, Health: %d, FaultCnt: %d\n",
@@ -371,115 +758,180 @@ void print_status(uint8_t *data)
            status->sensor1_name, status->sensor2_name);
 }
 
+/* Status round over all hubs, ends the hubs boot stage the first time */
+struct hub_status_req
+{
+    uint8_t hub;
+    uint8_t attempts;
+};
+
+static struct hub_status_req hub_status_reqs[ARRAY_SIZE(sensorhub_addrs)];
+static atomic_t hub_status_pending;
+static int hub_status_err;
+
+static void hub_status_cb(int err, int req_id, const uint8_t *resp, size_t len, void *user_data);
+
+static int hub_status_submit(struct hub_status_req *req)
+{
+    const uint8_t cmd = SYSTEM_CMD_GET_STATUS;
+
+    req->attempts++;
+    return hub_cmd_submit(req->hub, &cmd, sizeof(cmd), HUB_STATUS_TIMEOUT_MS, hub_status_cb,
+                          req);
+}
+
+static void hub_status_finish(int err)
+{
+    if (err != 0)
+    {
+        hub_status_err = err;
+    }
+    if (atomic_dec(&hub_status_pending) == 1)
+    {
+        boot_stage_end(BOOT_STAGE_HUBS, hub_status_err);
+    }
+}
+
+static void hub_status_cb(int err, int req_id, const uint8_t *resp, size_t len, void *user_data)
+{
+    ARG_UNUSED(req_id);
+    struct hub_status_req *req = user_data;
+    const char *name = sensorhub_addrs[req->hub].name;
+
+    if (err == 0 && len < sizeof(system_status_t))
+    {
+        err = -EMSGSIZE;
+    }
+    if (err != 0)
+    {
+        if (req->attempts < HUB_STATUS_ATTEMPTS && hub_status_submit(req) > 0)
+        {
+            return;
+        }
+        printk("Failed to get status of %s [%d]\n", name, err);
+        hub_status_finish(err);
+        return;
+    }
+    print_status(resp);
+    stream_registry_add_status((const system_status_t *)resp);
+    hub_status_finish(0);
+}
+
+int can_request_hub_status(void)
+{
+    if (!atomic_cas(&hub_status_pending, 0, ARRAY_SIZE(hub_status_reqs)))
+    {
+        return -EBUSY;
+    }
+    hub_status_err = 0;
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(hub_status_reqs); i++)
+    {
+        hub_status_reqs[i].hub = i;
+        hub_status_reqs[i].attempts = 0;
+
+        int ret = hub_status_submit(&hub_status_reqs[i]);
+        if (ret < 0)
+        {
+            printk("Failed to request status of %s [%d]\n", sensorhub_addrs[i].name, ret);
+            hub_status_finish(ret);
+        }
+    }
+    return 0;
+}
+
+static int cmd_hub_status(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    if (can_request_hub_status() != 0)
+    {
+        shell_error(sh, "status request still running");
+        return -EBUSY;
+    }
+    shell_print(sh, "status requested, answers follow on the console");
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), status, NULL, "Ask every hub for its status", cmd_hub_status, 1, 0);
+
+/* CAN is down for good, nothing left to wait for */
+static void can_boot_failed(int err)
+{
+    boot_stage_end(BOOT_STAGE_CAN, err);
+    boot_stage_end(BOOT_STAGE_HUBS, err);
+}
+
 int can_transport_init()
 {
     k_tid_t tid;
-    uint8_t rx_buf[50];
     int ret = 0;
+
+    boot_stage_begin(BOOT_STAGE_CAN);
     can_dev = DEVICE_DT_GET(DT_CHOSEN(zephyr_canbus));
     if (!device_is_ready(can_dev))
     {
         printk("CAN: Device driver not ready.\n");
+        can_boot_failed(-ENODEV);
         return 0;
     }
 
-    ret = can_start(can_dev);
+#ifdef CONFIG_SAMPLE_CAN_FD_MODE
+    /* Data phase runs at CONFIG_CAN_DEFAULT_BITRATE_DATA */
+    ret = can_set_mode(can_dev, CAN_MODE_FD);
     if (ret != 0)
     {
-        printk("CAN: Failed to start device [%d]\n", ret);
+        printk("CAN: Failed to enable CAN FD [%d]\n", ret);
+        can_boot_failed(ret);
         return 0;
     }
+#endif
 
-    ring_buf_init(&vl_ring, ARRAY_SIZE(vl_backing_array), vl_backing_array);
-    ring_buf_init(&ads_ring, ARRAY_SIZE(ads_backing_array), ads_backing_array);
-    ring_buf_init(&sdp_ring, ARRAY_SIZE(sdp_backing_array), sdp_backing_array);
-    ring_buf_init(&bhi_ring, ARRAY_SIZE(bhi_backing_array), bhi_backing_array);
-
-    tid = k_thread_create(&rx_sensorhub_sensor1_thread_data, rx_sensorhub_sensor1_thread_stack,
-                          K_THREAD_STACK_SIZEOF(rx_sensorhub_sensor1_thread_stack),
-                          rx_sensorhub_sensor1_thread, NULL, NULL, NULL,
-                          2, 0, K_NO_WAIT);
-    if (!tid)
+    ret = can_start(can_dev);
+    if (ret != 0)
     {
-        printk("ERROR spawning rx thread\n");
+        printk("CAN: Failed to start device [%d]\n", ret);
+        can_boot_failed(ret);
         return 0;
     }
-    k_thread_name_set(tid, "rx_sensorhub_sensor1");
 
-    tid = k_thread_create(&rx_sensorhub_sensor2_thread_data, rx_sensorhub_sensor2_thread_stack,
-                          K_THREAD_STACK_SIZEOF(rx_sensorhub_sensor2_thread_stack),
-                          rx_sensorhub_sensor2_thread, NULL, NULL, NULL,
-                          1, 0, K_NO_WAIT);
-    if (!tid)
+    for (size_t i = 0; i < ARRAY_SIZE(sensorhub_links); i++)
     {
-        printk("ERROR spawning rx thread\n");
-        return 0;
+        k_work_init_delayable(&sensorhub_links[i].retransmit_work, retransmit_work_handler);
     }
-    k_thread_name_set(tid, "rx_sensorhub_sensor2");
 
-    tid = k_thread_create(&rx_sensorhub_sensor3_thread_data, rx_sensorhub_sensor3_thread_stack,
-                          K_THREAD_STACK_SIZEOF(rx_sensorhub_sensor3_thread_stack),
-                          rx_sensorhub_sensor3_thread, NULL, NULL, NULL,
-                          2, 0, K_NO_WAIT);
-    if (!tid)
+    for (size_t i = 0; i < ARRAY_SIZE(can_rx_channels); i++)
     {
-        printk("ERROR spawning rx thread\n");
-        return 0;
+        can_rx_channel_init(&can_rx_channels[i], &sensor_registry[i]);
+        stream_registry_set_name(sensor_registry[i].stream_id, sensor_registry[i].name,
+                                 STREAM_NAME_LEN);
     }
-    k_thread_name_set(tid, "rx_sensorhub_sensor3");
 
-    tid = k_thread_create(&rx_sensorhub2_sensor1_thread_data, rx_sensorhub2_sensor1_thread_stack,
-                          K_THREAD_STACK_SIZEOF(rx_sensorhub2_sensor1_thread_stack),
-                          rx_sensorhub2_sensor1_thread, NULL, NULL, NULL,
-                          2, 0, K_NO_WAIT);
+    tid = k_thread_create(&can_ingest_thread_data, can_ingest_thread_stack,
+                          K_THREAD_STACK_SIZEOF(can_ingest_thread_stack),
+                          can_ingest_thread, NULL, NULL, NULL,
+                          CAN_INGEST_PRIORITY, 0, K_NO_WAIT);
     if (!tid)
     {
         printk("ERROR spawning rx thread\n");
+        can_boot_failed(-EIO);
         return 0;
     }
-    k_thread_name_set(tid, "rx_sensorhub2_sensor1");
-    printk("Start sending data\n");
-    ret = isotp_bind(&recv_ctx_sensorhub1_cmd, can_dev,
-                     &rx_sensorhub1_cmd, // remote sender (0x10)
-                     &tx_sensorhub1_cmd, // our receiver (0x201)
-                     &fc_opts_sensorhub1_cmd, K_NO_WAIT);
-    if (ret != ISOTP_N_OK)
-    {
-        printk("ISO-TP bind failed [%d]\n", ret);
-        return -1;
-    }
-    ret = isotp_bind(&recv_ctx_sensorhub2_cmd, can_dev,
-                     &rx_sensorhub2_cmd, // remote sender (0x10)
-                     &tx_sensorhub2_cmd, // our receiver (0x201)
-                     &fc_opts_sensorhub2_cmd, K_NO_WAIT);
-    if (ret != ISOTP_N_OK)
+    k_thread_name_set(tid, "can_ingest");
+
+    ret = hub_cmd_init(can_dev, sensorhub_addrs, ARRAY_SIZE(sensorhub_addrs));
+    if (ret != 0)
     {
-        printk("ISO-TP bind failed [%d]\n", ret);
+        can_boot_failed(ret);
         return -1;
     }
-    send_command(SYSTEM_CMD_GET_STATUS);
-    k_sleep(K_MSEC(200));
-    ret = receive_response(rx_buf, sizeof(rx_buf), 1000);
-    if (ret > 0)
-    {
-        print_status(rx_buf);
-    }
-    else
-    {
-        printk("Failed to get status [%d]\n", ret);
-    }
-    k_sleep(K_MSEC(200));
-    send_command_sensorhub2(SYSTEM_CMD_GET_STATUS);
-    k_sleep(K_MSEC(200));
-    ret = receive_response_sensorhub2(rx_buf, sizeof(rx_buf), 1000);
-    if (ret > 0)
-    {
-        print_status(rx_buf);
-    }
-    else
-    {
-        printk("Failed to get status [%d]\n", ret);
-    }
+    hub_sync_init(can_dev, BROADCAST_CAN_ID, sensorhub_addrs, ARRAY_SIZE(sensorhub_addrs));
+    boot_stage_end(BOOT_STAGE_CAN, 0);
+
+    /* Both hubs are asked at once, the names arrive in the background */
+    boot_stage_begin(BOOT_STAGE_HUBS);
+    can_request_hub_status();
 
     return 0;
 }
\ No newline at end of file
@@ -1,16 +1,57 @@
 #ifndef CAN_TRANSPORT_H
 #define CAN_TRANSPORT_H
 #include "can_rx_types.h"
-#include <zephyr/sys/ring_buffer.h>
+#include "sample_ring.h"
 
-extern struct ring_buf bhi_ring;
-extern struct ring_buf vl_ring;
-extern struct ring_buf sdp_ring;
-extern struct ring_buf ads_ring;
+/* Hub commands, first byte of a command PDU */
+#define SYSTEM_CMD_STOP 0
+#define SYSTEM_CMD_START 1
+#define SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_1 2
+#define SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_2 3
+#define SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_3 4
+#define SYSTEM_CMD_GET_STATUS 5
+#define SYSTEM_CMD_GET_NUM_SAMPLES_SENSOR_1 6
+#define SYSTEM_CMD_GET_NUM_SAMPLES_SENSOR_2 7
+#define SYSTEM_CMD_GET_NUM_SAMPLES_SENSOR_3 8
+#define SYSTEM_CMD_SYNC 9      /* broadcast, see hub_sync.h */
+#define SYSTEM_CMD_GET_SYNC 10
+
+/* Hub indices for hub_cmd_submit(), see sensorhub_addrs[] */
+#define SENSORHUB_1 0
+#define SENSORHUB_2 1
 
 int can_transport_init();
 
+/*
+ * Samples are taken off the ring of their sensor (sensor_registry.h) as
+ * pointers to sample slots. The consumer owns a slot from then on; release
+ * it with can_sample_release() after use.
+ */
+void can_sample_release(void *sample);
+
+/*
+ * When the last frame of the PDU of a sample came in, in us of uptime. Raw
+ * frames are placed by the controller timestamp with CONFIG_CAN_RX_TIMESTAMP,
+ * everything else by the cycle counter when the frame was taken.
+ */
+uint64_t can_sample_rx_time(const void *sample);
+
+/*
+ * Hub time of a sample (frame_id times the sensor period) on the clock of
+ * can_sample_rx_time(), see hub_sync.h
+ */
+uint64_t can_sample_time(const void *sample);
+
+/* Now on the clock of can_sample_rx_time() */
+uint64_t can_rx_time_now(void);
+
 void can_transmit_start_msg();
 void can_transmit_stop_msg();
 
-#endif /* CAN_TRANSPORT_H */
\ No newline at end of file
+/*
+ * Ask every hub for its status. Returns right away, the answers are printed
+ * and name the streams once they come in. -EBUSY while a round is running.
+ */
+int can_request_hub_status(void);
+
+#endif /* CAN_TRANSPORT_H */
@@ -0,0 +1,419 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/slist.h>
+#include <zephyr/shell/shell.h>
+#include "hub_cmd.h"
+
+#define HUB_CMD_STACK_SIZE 1536
+/* Below CAN ingest, commands must never hold up sample reception */
+#define HUB_CMD_PRIORITY 5
+/* Timed out requests per hub whose answer may still come */
+#define HUB_CMD_TOMBSTONES 4
+/* How long after its timeout an answer is still taken as late */
+#define HUB_CMD_LATE_MS 1000
+
+struct hub_cmd_req
+{
+    sys_snode_t node;
+    int id;
+    uint32_t seq; /* send order on the link */
+    uint8_t hub;
+    uint8_t len;
+    uint8_t data[HUB_CMD_MAX_LEN];
+    int32_t resp_timeout_ms;
+    int64_t deadline;
+    hub_cmd_cb_t cb;
+    void *user_data;
+};
+
+/* A timed out request, its answer is dropped if it still comes */
+struct hub_cmd_tombstone
+{
+    uint32_t seq;
+    int64_t until;
+};
+
+struct hub_cmd_link
+{
+    const struct hub_cmd_addr *addr;
+    struct isotp_send_ctx send_ctx;
+    struct isotp_recv_ctx recv_ctx;
+
+    /* Filled by submitters, taken by the thread */
+    sys_slist_t tx_queue;
+
+    /* Owned by the thread */
+    struct hub_cmd_req *in_flight;
+    sys_slist_t awaiting; /* sent, response pending, in send order */
+    uint32_t send_seq;
+    struct hub_cmd_tombstone tombs[HUB_CMD_TOMBSTONES]; /* in send order */
+    uint8_t num_tombs;
+    uint8_t resp[HUB_CMD_RESP_MAX_LEN];
+    size_t resp_len;
+
+    /* Set by the ISO-TP send completion */
+    atomic_t tx_done;
+    int tx_err;
+
+    uint32_t sent;
+    uint32_t answered;
+    uint32_t timeouts;
+    uint32_t errors;
+    uint32_t unsolicited;
+    uint32_t late;
+};
+
+K_MEM_SLAB_DEFINE_STATIC(hub_cmd_slab, sizeof(struct hub_cmd_req), HUB_CMD_REQ_COUNT, 4);
+K_THREAD_STACK_DEFINE(hub_cmd_thread_stack, HUB_CMD_STACK_SIZE);
+static struct k_thread hub_cmd_thread_data;
+
+static const struct device *hub_cmd_can_dev;
+static struct hub_cmd_link hub_cmd_links[HUB_CMD_MAX_HUBS];
+static size_t hub_cmd_num_links;
+static struct k_spinlock hub_cmd_lock;
+static atomic_t hub_cmd_next_id;
+static uint32_t hub_cmd_pool_drops;
+
+/* Wakes the thread for new requests and finished sends */
+static struct k_poll_signal hub_cmd_signal = K_POLL_SIGNAL_INITIALIZER(hub_cmd_signal);
+static struct k_poll_event hub_cmd_events[1 + HUB_CMD_MAX_HUBS];
+
+static void hub_cmd_finish(struct hub_cmd_req *req, int err, const uint8_t *resp, size_t len)
+{
+    if (req->cb != NULL)
+    {
+        req->cb(err, req->id, resp, len, req->user_data);
+    }
+    k_mem_slab_free(&hub_cmd_slab, req);
+}
+
+static void hub_cmd_send_done(int error_nr, void *arg)
+{
+    struct hub_cmd_link *link = arg;
+
+    link->tx_err = error_nr;
+    atomic_set(&link->tx_done, 1);
+    k_poll_signal_raise(&hub_cmd_signal, 0);
+}
+
+int hub_cmd_submit(uint8_t hub, const uint8_t *data, size_t len, int32_t resp_timeout_ms,
+                   hub_cmd_cb_t cb, void *user_data)
+{
+    struct hub_cmd_req *req;
+
+    if (hub >= hub_cmd_num_links || len == 0 || len > HUB_CMD_MAX_LEN)
+    {
+        return -EINVAL;
+    }
+
+    if (k_mem_slab_alloc(&hub_cmd_slab, (void **)&req, K_NO_WAIT) != 0)
+    {
+        hub_cmd_pool_drops++;
+        return -ENOMEM;
+    }
+
+    req->id = (atomic_inc(&hub_cmd_next_id) & 0x7FFFFFFF) + 1;
+    req->hub = hub;
+    req->len = len;
+    memcpy(req->data, data, len);
+    req->resp_timeout_ms = resp_timeout_ms;
+    req->cb = cb;
+    req->user_data = user_data;
+
+    k_spinlock_key_t key = k_spin_lock(&hub_cmd_lock);
+    sys_slist_append(&hub_cmd_links[hub].tx_queue, &req->node);
+    k_spin_unlock(&hub_cmd_lock, key);
+
+    k_poll_signal_raise(&hub_cmd_signal, 0);
+    return req->id;
+}
+
+/* Start the next queued command if the send context is free */
+static void hub_cmd_link_send(struct hub_cmd_link *link)
+{
+    while (link->in_flight == NULL)
+    {
+        k_spinlock_key_t key = k_spin_lock(&hub_cmd_lock);
+        sys_snode_t *node = sys_slist_get(&link->tx_queue);
+        k_spin_unlock(&hub_cmd_lock, key);
+
+        if (node == NULL)
+        {
+            return;
+        }
+
+        struct hub_cmd_req *req = CONTAINER_OF(node, struct hub_cmd_req, node);
+        int ret = isotp_send(&link->send_ctx, hub_cmd_can_dev, req->data, req->len,
+                             link->addr->tx_addr, link->addr->rx_addr,
+                             hub_cmd_send_done, link);
+        if (ret != ISOTP_N_OK)
+        {
+            link->errors++;
+            hub_cmd_finish(req, ret, NULL, 0);
+            continue;
+        }
+        link->in_flight = req;
+    }
+}
+
+static void hub_cmd_link_sent(struct hub_cmd_link *link)
+{
+    struct hub_cmd_req *req = link->in_flight;
+
+    if (req == NULL || !atomic_cas(&link->tx_done, 1, 0))
+    {
+        return;
+    }
+    link->in_flight = NULL;
+
+    if (link->tx_err != ISOTP_N_OK)
+    {
+        link->errors++;
+        hub_cmd_finish(req, link->tx_err, NULL, 0);
+        return;
+    }
+
+    link->sent++;
+    if (req->resp_timeout_ms == 0)
+    {
+        hub_cmd_finish(req, 0, NULL, 0);
+        return;
+    }
+
+    req->seq = link->send_seq++;
+    req->deadline = k_uptime_get() + req->resp_timeout_ms;
+    sys_slist_append(&link->awaiting, &req->node);
+}
+
+static bool hub_cmd_seq_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/* Keep the place of a timed out request in the answer order */
+static void hub_cmd_tomb_add(struct hub_cmd_link *link, uint32_t seq, int64_t until)
+{
+    uint8_t i;
+
+    if (link->num_tombs == HUB_CMD_TOMBSTONES)
+    {
+        /* The oldest answer is least likely to still come */
+        memmove(&link->tombs[0], &link->tombs[1], sizeof(link->tombs[0]) * --link->num_tombs);
+    }
+    /* Shorter timeouts can expire before requests sent earlier */
+    for (i = link->num_tombs; i > 0 && hub_cmd_seq_before(seq, link->tombs[i - 1].seq); i--)
+    {
+        link->tombs[i] = link->tombs[i - 1];
+    }
+    link->tombs[i] = (struct hub_cmd_tombstone){.seq = seq, .until = until};
+    link->num_tombs++;
+}
+
+/* Forget requests whose answer is not coming anymore */
+static void hub_cmd_tomb_prune(struct hub_cmd_link *link, int64_t now)
+{
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < link->num_tombs; i++)
+    {
+        if (now < link->tombs[i].until)
+        {
+            link->tombs[kept++] = link->tombs[i];
+        }
+    }
+    link->num_tombs = kept;
+}
+
+/*
+ * A full PDU answers the oldest request sent, which may be one that timed
+ * out: then it is dropped rather than handed to the next request.
+ */
+static void hub_cmd_link_answer(struct hub_cmd_link *link)
+{
+    sys_snode_t *node = sys_slist_peek_head(&link->awaiting);
+
+    hub_cmd_tomb_prune(link, k_uptime_get());
+    if (link->num_tombs > 0 &&
+        (node == NULL ||
+         hub_cmd_seq_before(link->tombs[0].seq, CONTAINER_OF(node, struct hub_cmd_req, node)->seq)))
+    {
+        link->num_tombs--;
+        memmove(&link->tombs[0], &link->tombs[1], sizeof(link->tombs[0]) * link->num_tombs);
+        link->late++;
+        return;
+    }
+    if (node == NULL)
+    {
+        link->unsolicited++;
+        return;
+    }
+
+    sys_slist_get(&link->awaiting);
+    link->answered++;
+    hub_cmd_finish(CONTAINER_OF(node, struct hub_cmd_req, node), 0, link->resp, link->resp_len);
+}
+
+/* Collect response fragments until a PDU is complete */
+static void hub_cmd_link_recv(struct hub_cmd_link *link)
+{
+    struct net_buf *buf;
+    int rem_len;
+
+    while (1)
+    {
+        rem_len = isotp_recv_net(&link->recv_ctx, &buf, K_NO_WAIT);
+        if (rem_len == ISOTP_RECV_TIMEOUT)
+        {
+            return;
+        }
+        if (rem_len < 0)
+        {
+            link->resp_len = 0;
+            return;
+        }
+
+        while (buf != NULL)
+        {
+            size_t copy_len = MIN(buf->len, sizeof(link->resp) - link->resp_len);
+
+            memcpy(&link->resp[link->resp_len], buf->data, copy_len);
+            link->resp_len += copy_len;
+            buf = net_buf_frag_del(NULL, buf);
+        }
+
+        if (rem_len == 0)
+        {
+            hub_cmd_link_answer(link);
+            link->resp_len = 0;
+        }
+    }
+}
+
+/* Fail requests whose response is overdue, returns the next deadline */
+static int64_t hub_cmd_link_expire(struct hub_cmd_link *link, int64_t now, int64_t next)
+{
+    struct hub_cmd_req *req, *tmp, *prev = NULL;
+
+    SYS_SLIST_FOR_EACH_CONTAINER_SAFE(&link->awaiting, req, tmp, node)
+    {
+        if (now >= req->deadline)
+        {
+            sys_slist_remove(&link->awaiting, prev != NULL ? &prev->node : NULL, &req->node);
+            link->timeouts++;
+            hub_cmd_tomb_add(link, req->seq, now + HUB_CMD_LATE_MS);
+            hub_cmd_finish(req, -ETIMEDOUT, NULL, 0);
+            continue;
+        }
+        next = MIN(next, req->deadline);
+        prev = req;
+    }
+    return next;
+}
+
+static void hub_cmd_thread(void *arg1, void *arg2, void *arg3)
+{
+    ARG_UNUSED(arg1);
+    ARG_UNUSED(arg2);
+    ARG_UNUSED(arg3);
+    k_timeout_t timeout = K_FOREVER;
+
+    while (1)
+    {
+        k_poll(hub_cmd_events, 1 + hub_cmd_num_links, timeout);
+
+        k_poll_signal_reset(&hub_cmd_signal);
+        hub_cmd_events[0].state = K_POLL_STATE_NOT_READY;
+
+        int64_t now = k_uptime_get();
+        int64_t next = INT64_MAX;
+
+        for (size_t i = 0; i < hub_cmd_num_links; i++)
+        {
+            struct hub_cmd_link *link = &hub_cmd_links[i];
+
+            /* A fast answer can come in before the send completion is seen */
+            hub_cmd_link_sent(link);
+            if (hub_cmd_events[1 + i].state == K_POLL_STATE_FIFO_DATA_AVAILABLE)
+            {
+                hub_cmd_events[1 + i].state = K_POLL_STATE_NOT_READY;
+                hub_cmd_link_recv(link);
+            }
+            hub_cmd_link_send(link);
+            next = hub_cmd_link_expire(link, now, next);
+        }
+
+        timeout = next == INT64_MAX ? K_FOREVER : K_MSEC(next - now);
+    }
+}
+
+int hub_cmd_init(const struct device *can_dev, const struct hub_cmd_addr *hubs, size_t num_hubs)
+{
+    k_tid_t tid;
+    int ret;
+
+    if (num_hubs > HUB_CMD_MAX_HUBS)
+    {
+        return -EINVAL;
+    }
+
+    hub_cmd_can_dev = can_dev;
+    k_poll_event_init(&hub_cmd_events[0], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+                      &hub_cmd_signal);
+
+    for (size_t i = 0; i < num_hubs; i++)
+    {
+        struct hub_cmd_link *link = &hub_cmd_links[i];
+
+        link->addr = &hubs[i];
+        sys_slist_init(&link->tx_queue);
+        sys_slist_init(&link->awaiting);
+
+        ret = isotp_bind(&link->recv_ctx, can_dev, hubs[i].rx_addr, hubs[i].tx_addr,
+                         hubs[i].fc_opts, K_NO_WAIT);
+        if (ret != ISOTP_N_OK)
+        {
+            printk("ISO-TP bind failed for %s [%d]\n", hubs[i].name, ret);
+            return -EIO;
+        }
+        k_poll_event_init(&hub_cmd_events[1 + i], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+                          K_POLL_MODE_NOTIFY_ONLY, &link->recv_ctx.fifo);
+    }
+    hub_cmd_num_links = num_hubs;
+
+    tid = k_thread_create(&hub_cmd_thread_data, hub_cmd_thread_stack,
+                          K_THREAD_STACK_SIZEOF(hub_cmd_thread_stack),
+                          hub_cmd_thread, NULL, NULL, NULL,
+                          HUB_CMD_PRIORITY, 0, K_NO_WAIT);
+    if (!tid)
+    {
+        printk("ERROR spawning hub_cmd thread\n");
+        return -EIO;
+    }
+    k_thread_name_set(tid, "hub_cmd");
+
+    return 0;
+}
+
+static int cmd_hub_cmd(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-12s %6s %8s %8s %6s %8s %6s %11s", "hub", "sent", "answered",
+                "timeouts", "late", "errors", "queued", "unsolicited");
+    for (size_t i = 0; i < hub_cmd_num_links; i++)
+    {
+        struct hub_cmd_link *link = &hub_cmd_links[i];
+
+        shell_print(sh, "%-12s %6u %8u %8u %6u %8u %6u %11u", link->addr->name, link->sent,
+                    link->answered, link->timeouts, link->late, link->errors,
+                    (uint32_t)sys_slist_len(&link->tx_queue), link->unsolicited);
+    }
+    shell_print(sh, "requests: %u/%u in use, %u refused",
+                k_mem_slab_num_used_get(&hub_cmd_slab), HUB_CMD_REQ_COUNT, hub_cmd_pool_drops);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), cmd, NULL, "Hub command channel counters", cmd_hub_cmd, 1, 0);
@@ -0,0 +1,74 @@
+#ifndef HUB_CMD_H
+#define HUB_CMD_H
+#include <stdint.h>
+#include <stddef.h>
+#include <zephyr/device.h>
+#include <zephyr/canbus/isotp.h>
+
+/*
+ * Asynchronous command channel to the sensorhubs.
+ *
+ * Commands are queued per hub and sent back to back by the hub_cmd thread,
+ * one ISO-TP transfer at a time per hub, without waiting for the response of
+ * the previous command. All hubs are served in parallel. Every request gets
+ * an id and ends in exactly one callback: on the response, on a send error,
+ * on timeout, or right after sending for commands without response.
+ *
+ * The hub protocol carries no request id, so the ids are local and responses
+ * are matched to requests in the order they were sent. Hubs answer in order.
+ * A request that timed out keeps its place for a while, so its late answer
+ * is dropped and counted instead of completing the request after it.
+ *
+ * hub_cmd_submit() never blocks and may be called from any context,
+ * including ISRs. Callbacks run on the hub_cmd thread.
+ */
+
+#define HUB_CMD_MAX_HUBS 4
+#define HUB_CMD_MAX_LEN 48
+#define HUB_CMD_RESP_MAX_LEN 64
+/* Requests queued or outstanding over all hubs */
+#define HUB_CMD_REQ_COUNT 16
+
+/**
+ * @brief Request completion
+ *
+ * @param err 0 on success, -ETIMEDOUT if no response came in time, or the
+ *            ISO-TP error of the send
+ * @param req_id Id returned by hub_cmd_submit()
+ * @param resp Response PDU, NULL if there is none
+ * @param len Length of @p resp
+ */
+typedef void (*hub_cmd_cb_t)(int err, int req_id, const uint8_t *resp, size_t len,
+                             void *user_data);
+
+struct hub_cmd_addr
+{
+    const char *name;
+    const struct isotp_msg_id *tx_addr; /* we send commands on it */
+    const struct isotp_msg_id *rx_addr; /* the hub answers on it */
+    const struct isotp_fc_opts *fc_opts;
+};
+
+/**
+ * @brief Bind the response channels and start the hub_cmd thread
+ *
+ * @param hubs Addresses per hub, indexed by SENSORHUB_n. Must stay valid.
+ */
+int hub_cmd_init(const struct device *can_dev, const struct hub_cmd_addr *hubs, size_t num_hubs);
+
+/**
+ * @brief Queue a command for a hub
+ *
+ * @param hub SENSORHUB_n
+ * @param data Command PDU, copied
+ * @param len Length of @p data, at most HUB_CMD_MAX_LEN
+ * @param resp_timeout_ms Time the hub has to answer once the command is
+ *                        sent, 0 for commands without response
+ * @param cb Completion callback, may be NULL
+ * @return Request id (> 0), -ENOMEM if all requests are in use, -EINVAL on
+ *         bad arguments
+ */
+int hub_cmd_submit(uint8_t hub, const uint8_t *data, size_t len, int32_t resp_timeout_ms,
+                   hub_cmd_cb_t cb, void *user_data);
+
+#endif /* HUB_CMD_H */
@@ -0,0 +1,396 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/can.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include "hub_sync.h"
+#include "can_transport.h"
+#include "sensors/text_format.h"
+
+/* Time a hub has to report the hub time of a sync frame */
+#define HUB_SYNC_TIMEOUT_MS 100
+/* [seq][hub time, LE64] */
+#define HUB_SYNC_RESP_LEN 9
+
+struct hub_sync_point
+{
+    uint64_t hub_us;
+    uint64_t main_us;
+};
+
+/* Hub time ref_hub_us is mainhub time ref_main_us */
+struct hub_sync_model
+{
+    uint64_t ref_hub_us;
+    uint64_t ref_main_us;
+    int32_t drift_ppb;
+};
+
+struct hub_sync_state
+{
+    bool fitted;
+    struct hub_sync_model model;
+    uint32_t fit_rms_us;
+    /* Lowest receive time less hub time, until there is a fit */
+    bool has_floor;
+    int64_t floor_us;
+
+    struct hub_sync_point points[HUB_SYNC_POINTS];
+    uint8_t num_points;
+    uint8_t next_point;
+    uint8_t outliers;
+
+    uint32_t answers;
+    uint32_t missed;
+    uint32_t rejected;
+    /* Off the fit before each pair, the residual sync error */
+    uint32_t max_err_us;
+    uint64_t sum_sq_err;
+    uint32_t num_err;
+};
+
+/* Fits and floors, taken by the ingest paths as well */
+static struct k_spinlock sync_lock;
+static struct hub_sync_state sync_state[HUB_CMD_MAX_HUBS];
+/* Bumped by every reset, older answers are dropped */
+static atomic_t sync_gen;
+
+static const struct hub_cmd_addr *sync_hubs;
+static size_t sync_num_hubs;
+
+static uint64_t model_map(const struct hub_sync_model *m, uint64_t hub_us)
+{
+    int64_t d = (int64_t)(hub_us - m->ref_hub_us);
+
+    return m->ref_main_us + d + d * m->drift_ppb / 1000000000LL;
+}
+
+uint64_t hub_sync_map(uint8_t hub, uint64_t hub_us, uint64_t rx_us)
+{
+    struct hub_sync_state *st;
+    k_spinlock_key_t key;
+    uint64_t t;
+
+    if (hub >= HUB_CMD_MAX_HUBS)
+    {
+        return rx_us;
+    }
+    st = &sync_state[hub];
+
+    key = k_spin_lock(&sync_lock);
+    if (st->fitted)
+    {
+        t = model_map(&st->model, hub_us);
+    }
+    else
+    {
+        int64_t latency = (int64_t)(rx_us - hub_us);
+
+        if (!st->has_floor || latency < st->floor_us)
+        {
+            st->floor_us = latency;
+            st->has_floor = true;
+        }
+        t = hub_us + st->floor_us;
+    }
+    k_spin_unlock(&sync_lock, key);
+
+    return t;
+}
+
+void hub_sync_reset(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&sync_lock);
+
+    atomic_inc(&sync_gen);
+    for (size_t i = 0; i < HUB_CMD_MAX_HUBS; i++)
+    {
+        struct hub_sync_state *st = &sync_state[i];
+
+        st->fitted = false;
+        st->has_floor = false;
+        st->num_points = 0;
+        st->outliers = 0;
+    }
+    k_spin_unlock(&sync_lock, key);
+}
+
+#if defined(CONFIG_APP_HUB_SYNC)
+
+struct hub_sync_req
+{
+    uint8_t hub;
+    uint8_t seq;
+    uint32_t gen;
+    uint64_t main_us;
+};
+
+static const struct device *sync_can_dev;
+static uint32_t sync_can_id;
+static uint8_t sync_seq;
+static uint32_t sync_rounds;
+static uint32_t sync_send_errors;
+static struct hub_sync_req sync_reqs[HUB_CMD_MAX_HUBS];
+static struct k_work_delayable sync_work;
+
+/* Least squares line through the pairs, relative to the first so doubles stay exact */
+static int hub_sync_fit(const struct hub_sync_point *pts, uint8_t n, struct hub_sync_model *m,
+                        uint32_t *rms_us)
+{
+    double xm = 0.0, ym = 0.0, sxx = 0.0, sxy = 0.0, sse = 0.0;
+    double slope = 1.0;
+    double drift;
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        xm += (double)(int64_t)(pts[i].hub_us - pts[0].hub_us);
+        ym += (double)(int64_t)(pts[i].main_us - pts[0].main_us);
+    }
+    xm /= n;
+    ym /= n;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        double dx = (double)(int64_t)(pts[i].hub_us - pts[0].hub_us) - xm;
+        double dy = (double)(int64_t)(pts[i].main_us - pts[0].main_us) - ym;
+
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    /* A single pair only gives the offset */
+    if (sxx > 0.0)
+    {
+        slope = sxy / sxx;
+    }
+    drift = (slope - 1.0) * 1e9;
+    if (fabs(drift) > HUB_SYNC_DRIFT_MAX_PPB)
+    {
+        return -ERANGE;
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        double dx = (double)(int64_t)(pts[i].hub_us - pts[0].hub_us) - xm;
+        double dy = (double)(int64_t)(pts[i].main_us - pts[0].main_us) - ym;
+        double e = dy - slope * dx;
+
+        sse += e * e;
+    }
+
+    m->ref_hub_us = pts[0].hub_us + (int64_t)llround(xm);
+    m->ref_main_us = pts[0].main_us + (int64_t)llround(ym);
+    m->drift_ppb = (int32_t)lround(drift);
+    *rms_us = (uint32_t)lround(sqrt(sse / n));
+    return 0;
+}
+
+/* One more pair for a hub, on the hub_cmd thread */
+static void hub_sync_add(struct hub_sync_state *st, uint32_t gen, uint64_t hub_us,
+                         uint64_t main_us)
+{
+    struct hub_sync_point pts[HUB_SYNC_POINTS];
+    struct hub_sync_model model;
+    uint32_t rms_us;
+    uint8_t n;
+    int ret;
+    k_spinlock_key_t key = k_spin_lock(&sync_lock);
+
+    /* Answered for the frame counters before a reset */
+    if (gen != (uint32_t)atomic_get(&sync_gen))
+    {
+        k_spin_unlock(&sync_lock, key);
+        return;
+    }
+
+    st->answers++;
+    if (st->fitted)
+    {
+        int64_t err = (int64_t)(main_us - model_map(&st->model, hub_us));
+        uint32_t abs_err = (uint32_t)MIN(llabs(err), UINT32_MAX);
+
+        if (abs_err > HUB_SYNC_OUTLIER_US && ++st->outliers <= HUB_SYNC_OUTLIERS_MAX)
+        {
+            st->rejected++;
+            k_spin_unlock(&sync_lock, key);
+            return;
+        }
+        if (abs_err > HUB_SYNC_OUTLIER_US)
+        {
+            /* Not a stray pair, the hub clock jumped: start over from this one */
+            st->num_points = 0;
+        }
+        else
+        {
+            st->max_err_us = MAX(st->max_err_us, abs_err);
+            st->sum_sq_err += (uint64_t)abs_err * abs_err;
+            st->num_err++;
+        }
+        st->outliers = 0;
+    }
+
+    st->points[st->next_point] = (struct hub_sync_point){.hub_us = hub_us, .main_us = main_us};
+    st->next_point = (st->next_point + 1) % HUB_SYNC_POINTS;
+    st->num_points = MIN(st->num_points + 1, HUB_SYNC_POINTS);
+    n = st->num_points;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        pts[i] = st->points[(st->next_point + HUB_SYNC_POINTS - n + i) % HUB_SYNC_POINTS];
+    }
+    k_spin_unlock(&sync_lock, key);
+
+    ret = hub_sync_fit(pts, n, &model, &rms_us);
+
+    key = k_spin_lock(&sync_lock);
+    if (ret != 0)
+    {
+        st->rejected++;
+    }
+    else if (gen == (uint32_t)atomic_get(&sync_gen))
+    {
+        st->model = model;
+        st->fit_rms_us = rms_us;
+        st->fitted = true;
+    }
+    k_spin_unlock(&sync_lock, key);
+}
+
+static void hub_sync_cb(int err, int req_id, const uint8_t *resp, size_t len, void *user_data)
+{
+    const struct hub_sync_req *req = user_data;
+    struct hub_sync_state *st = &sync_state[req->hub];
+
+    ARG_UNUSED(req_id);
+
+    if (err != 0 || len < HUB_SYNC_RESP_LEN || resp[0] != req->seq)
+    {
+        k_spinlock_key_t key = k_spin_lock(&sync_lock);
+
+        st->missed++;
+        k_spin_unlock(&sync_lock, key);
+        return;
+    }
+    hub_sync_add(st, req->gen, sys_get_le64(&resp[1]), req->main_us);
+}
+
+/*
+ * The sync frame is on the bus, every hub latched its hub time on it just
+ * now. Runs in the CAN driver ISR, the questions are only queued.
+ */
+static void hub_sync_tx_done(const struct device *dev, int error, void *user_data)
+{
+    uint64_t now = can_rx_time_now();
+    uint8_t seq = (uint8_t)(uintptr_t)user_data;
+
+    ARG_UNUSED(dev);
+
+    if (error != 0)
+    {
+        sync_send_errors++;
+        return;
+    }
+
+    for (size_t i = 0; i < sync_num_hubs; i++)
+    {
+        struct hub_sync_req *req = &sync_reqs[i];
+        const uint8_t cmd[] = {SYSTEM_CMD_GET_SYNC, seq};
+
+        req->hub = i;
+        req->seq = seq;
+        req->gen = (uint32_t)atomic_get(&sync_gen);
+        req->main_us = now;
+        if (hub_cmd_submit(i, cmd, sizeof(cmd), HUB_SYNC_TIMEOUT_MS, hub_sync_cb, req) < 0)
+        {
+            k_spinlock_key_t key = k_spin_lock(&sync_lock);
+
+            sync_state[i].missed++;
+            k_spin_unlock(&sync_lock, key);
+        }
+    }
+}
+
+static void hub_sync_work_handler(struct k_work *work)
+{
+    struct can_frame frame = {
+        .id = sync_can_id,
+        .dlc = 2,
+        .data = {SYSTEM_CMD_SYNC, ++sync_seq},
+    };
+
+    ARG_UNUSED(work);
+
+    if (can_send(sync_can_dev, &frame, K_NO_WAIT, hub_sync_tx_done,
+                 (void *)(uintptr_t)sync_seq) != 0)
+    {
+        sync_send_errors++;
+    }
+    sync_rounds++;
+    k_work_schedule(&sync_work, K_MSEC(CONFIG_APP_HUB_SYNC_PERIOD_MS));
+}
+
+#endif /* CONFIG_APP_HUB_SYNC */
+
+int hub_sync_init(const struct device *can_dev, uint32_t sync_id,
+                  const struct hub_cmd_addr *hubs, size_t num_hubs)
+{
+    sync_hubs = hubs;
+    sync_num_hubs = MIN(num_hubs, HUB_CMD_MAX_HUBS);
+
+#if defined(CONFIG_APP_HUB_SYNC)
+    sync_can_dev = can_dev;
+    sync_can_id = sync_id;
+    k_work_init_delayable(&sync_work, hub_sync_work_handler);
+    k_work_schedule(&sync_work, K_MSEC(CONFIG_APP_HUB_SYNC_PERIOD_MS));
+#else
+    ARG_UNUSED(can_dev);
+    ARG_UNUSED(sync_id);
+#endif
+
+    return 0;
+}
+
+static int cmd_hub_sync(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+#if defined(CONFIG_APP_HUB_SYNC)
+    shell_print(sh, "sync frame every %u ms, %u sent, %u send errors",
+                CONFIG_APP_HUB_SYNC_PERIOD_MS, sync_rounds, sync_send_errors);
+#else
+    shell_print(sh, "sync frames off, samples placed by their lowest latency");
+#endif
+    shell_print(sh, "%-12s %6s %6s %6s %12s %10s %6s %6s %6s", "hub", "pairs", "missed",
+                "reject", "offset us", "drift ppm", "fit", "err", "max");
+    for (size_t i = 0; i < sync_num_hubs; i++)
+    {
+        struct hub_sync_state st;
+        char drift[TEXT_NUM_MAX + 1];
+        k_spinlock_key_t key = k_spin_lock(&sync_lock);
+
+        st = sync_state[i];
+        k_spin_unlock(&sync_lock, key);
+
+        if (!st.fitted)
+        {
+            shell_print(sh, "%-12s %6u %6u %6u %12lld %10s", sync_hubs[i].name, st.answers,
+                        st.missed, st.rejected, (long long)(st.has_floor ? st.floor_us : 0), "-");
+            continue;
+        }
+        drift[text_put_fixed(drift, st.model.drift_ppb / 1000.0f, 3)] = '\0';
+        shell_print(sh, "%-12s %6u %6u %6u %12lld %10s %6u %6u %6u", sync_hubs[i].name,
+                    st.answers, st.missed, st.rejected,
+                    (long long)(st.model.ref_main_us - st.model.ref_hub_us), drift, st.fit_rms_us,
+                    st.num_err > 0 ? (uint32_t)sqrt((double)st.sum_sq_err / st.num_err) : 0,
+                    st.max_err_us);
+    }
+    shell_print(sh, "offset: mainhub less hub time (lowest latency until fitted); fit: rms "
+                    "off the line, err: rms of each pair off the line before it, us");
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), sync, NULL, "Hub clock offset, drift and residual sync error",
+                 cmd_hub_sync, 1, 0);
@@ -0,0 +1,61 @@
+#ifndef HUB_SYNC_H
+#define HUB_SYNC_H
+#include <stdint.h>
+#include <stddef.h>
+#include <zephyr/device.h>
+#include "hub_cmd.h"
+
+/*
+ * Hub clock sync, every hub's sample clock on the mainhub timebase.
+ *
+ * A hub numbers its frames on its own clock: frame_id times the sample
+ * period is its hub time, in us since its frame counter restarted. Every
+ * CONFIG_APP_HUB_SYNC_PERIOD_MS the mainhub broadcasts a sync frame
+ * [SYSTEM_CMD_SYNC][seq] on BROADCAST_CAN_ID and notes when it left, on
+ * the clock of can_rx_time_now(). All hubs see the frame at that same
+ * moment and latch their hub time. SYSTEM_CMD_GET_SYNC [cmd][seq] then asks
+ * each hub for it, the answer is [seq][hub time, LE64].
+ *
+ * The last HUB_SYNC_POINTS pairs of a hub are fitted with a line, an offset
+ * and a drift, that maps hub time to mainhub time. How far each new pair is
+ * off the line fitted before it is the residual sync error, "hub sync"
+ * shows it with the fit per hub. Until a hub has answered, its samples are
+ * placed by the lowest latency seen so far: hub time plus the smallest
+ * difference between receive time and hub time.
+ */
+
+/* Pairs in the fit of a hub */
+#define HUB_SYNC_POINTS 16
+/* A pair this far off the fit is dropped, that many in a row restart it */
+#define HUB_SYNC_OUTLIER_US 2000
+#define HUB_SYNC_OUTLIERS_MAX 3
+/* Crystals are well within this, a steeper fit is wrong */
+#define HUB_SYNC_DRIFT_MAX_PPB 500000
+
+/**
+ * @brief Start the sync rounds, without CONFIG_APP_HUB_SYNC only the
+ * fallback placement runs
+ *
+ * @param sync_id CAN ID all hubs listen on
+ * @param hubs Addresses per hub for the names, must stay valid
+ */
+int hub_sync_init(const struct device *can_dev, uint32_t sync_id,
+                  const struct hub_cmd_addr *hubs, size_t num_hubs);
+
+/**
+ * @brief Forget all fits, the hubs restart their frame counters
+ */
+void hub_sync_reset(void);
+
+/**
+ * @brief Mainhub time of a hub time, from any context
+ *
+ * @param hub SENSORHUB_n
+ * @param hub_us time of the sample on the hub
+ * @param rx_us when the sample was received, see can_sample_rx_time()
+ *
+ * @return us on the clock of can_rx_time_now()
+ */
+uint64_t hub_sync_map(uint8_t hub, uint64_t hub_us, uint64_t rx_us);
+
+#endif /* HUB_SYNC_H */
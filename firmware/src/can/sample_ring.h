@@ -0,0 +1,177 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring of sample pointers.
+ *
+ * The CAN ingest path is the only producer and the sample drain is the only
+ * consumer. Entries are whole samples, so a full ring can never hold a
+ * partial record. What happens on overflow is chosen per ring:
+ *
+ * - SAMPLE_RING_DROP_NEWEST keeps the queued samples and refuses the new one
+ * - SAMPLE_RING_DROP_OLDEST evicts the oldest queued sample to make room
+ *
+ * Both counters (drops and high-water mark) are kept from the producer side
+ * and can be read at any time to size the rings from measured data.
+ */
+
+enum sample_ring_policy
+{
+    SAMPLE_RING_DROP_NEWEST,
+    SAMPLE_RING_DROP_OLDEST,
+};
+
+struct sample_ring
+{
+    const char *name;
+    void **slots;
+    uint32_t mask;
+    enum sample_ring_policy policy;
+
+    atomic_t head; /* next index the producer fills, producer owned */
+    atomic_t tail; /* next index the consumer takes, also advanced on evict */
+
+    atomic_t drops;
+    atomic_t high_water;
+};
+
+/**
+ * @brief Queue a sample on the ring
+ *
+ * Producer side only.
+ *
+ * @param ring Ring to put the sample on
+ * @param entry Sample to queue
+ * @return The sample the caller has to release because it did not fit,
+ *         either @p entry itself or an evicted older one. NULL if nothing
+ *         was dropped.
+ */
+static inline void *sample_ring_put(struct sample_ring *ring, void *entry)
+{
+    atomic_val_t head = atomic_get(&ring->head);
+    void *evicted = NULL;
+
+    while (1)
+    {
+        atomic_val_t tail = atomic_get(&ring->tail);
+
+        if ((uint32_t)(head - tail) <= ring->mask)
+        {
+            break;
+        }
+
+        if (ring->policy == SAMPLE_RING_DROP_NEWEST)
+        {
+            atomic_inc(&ring->drops);
+            return entry;
+        }
+
+        /* Only the winner of the race for the tail owns the evicted entry */
+        evicted = ring->slots[tail & ring->mask];
+        if (atomic_cas(&ring->tail, tail, tail + 1))
+        {
+            atomic_inc(&ring->drops);
+            break;
+        }
+        evicted = NULL;
+    }
+
+    ring->slots[head & ring->mask] = entry;
+    atomic_set(&ring->head, head + 1);
+
+    uint32_t used = (uint32_t)(head + 1 - atomic_get(&ring->tail));
+    if (used > (uint32_t)atomic_get(&ring->high_water))
+    {
+        atomic_set(&ring->high_water, used);
+    }
+
+    return evicted;
+}
+
+/**
+ * @brief Take the oldest sample off the ring
+ *
+ * Consumer side only. The returned sample is owned by the caller.
+ *
+ * @param ring Ring to take the sample from
+ * @return Sample, or NULL when the ring is empty
+ */
+static inline void *sample_ring_get(struct sample_ring *ring)
+{
+    while (1)
+    {
+        atomic_val_t tail = atomic_get(&ring->tail);
+
+        if (tail == atomic_get(&ring->head))
+        {
+            return NULL;
+        }
+
+        /* The producer may evict this entry concurrently, the CAS tells */
+        void *entry = ring->slots[tail & ring->mask];
+        if (atomic_cas(&ring->tail, tail, tail + 1))
+        {
+            return entry;
+        }
+    }
+}
+
+/**
+ * @brief Take up to @p max samples off the ring
+ *
+ * @return Number of samples stored in @p out
+ */
+static inline size_t sample_ring_get_batch(struct sample_ring *ring, void **out, size_t max)
+{
+    size_t num = 0;
+
+    while (num < max)
+    {
+        out[num] = sample_ring_get(ring);
+        if (out[num] == NULL)
+        {
+            break;
+        }
+        num++;
+    }
+    return num;
+}
+
+static inline uint32_t sample_ring_capacity(const struct sample_ring *ring)
+{
+    return ring->mask + 1;
+}
+
+static inline uint32_t sample_ring_used(struct sample_ring *ring)
+{
+    return (uint32_t)(atomic_get(&ring->head) - atomic_get(&ring->tail));
+}
+
+/*
+ * One ring per sample struct. CAN ingest and the drain walk the sensor
+ * registry and move slab slots whose type only the descriptor knows, so
+ * sample_ring_put() and sample_ring_get() take void pointers: typed
+ * wrappers would need a switch over the sensors on the hot path. The type
+ * is pinned where the registry binds a ring to its struct instead,
+ * SAMPLE_RING_OF() only compiles for the struct the ring was defined with.
+ */
+#define SAMPLE_RING_OF(_name, _type)                                              \
+    (&_name + ZERO_OR_COMPILE_ERROR(                                              \
+                  __builtin_types_compatible_p(__typeof__(_name##_slots[0]), _type *)))
+
+/* Capacity has to be a power of two, head and tail are free running */
+#define SAMPLE_RING_DEFINE(_name, _type, _count, _policy)                         \
+    BUILD_ASSERT(IS_POWER_OF_TWO(_count), #_name " size must be a power of two"); \
+    static _type *_name##_slots[_count];                                          \
+    struct sample_ring _name = {                                                  \
+        .name = #_name,                                                           \
+        .slots = (void **)_name##_slots,                                          \
+        .mask = (_count) - 1,                                                     \
+        .policy = (_policy),                                                      \
+    }
+
+#endif /* SAMPLE_RING_H */
@@ -0,0 +1,217 @@
+#include "sample_seq.h"
+#include "can_rx_types.h"
+
+#define REORDER_MASK (SAMPLE_REORDER_WINDOW - 1)
+
+_Static_assert((SAMPLE_REORDER_WINDOW & REORDER_MASK) == 0,
+               "SAMPLE_REORDER_WINDOW must be a power of two");
+
+static void sample_seq_resync(struct sample_seq *seq, uint32_t frame_id)
+{
+    seq->synced = true;
+    seq->next = frame_id + 1;
+    seq->history = 1;
+}
+
+enum sample_seq_result sample_seq_check(struct sample_seq *seq, uint32_t frame_id,
+                                        uint32_t *gap_first, uint32_t *gap_count)
+{
+    if (!seq->synced)
+    {
+        sample_seq_resync(seq, frame_id);
+        return SAMPLE_SEQ_IN_ORDER;
+    }
+
+    int32_t ahead = (int32_t)(frame_id - seq->next);
+
+    if (ahead == 0)
+    {
+        seq->next++;
+        seq->history = (seq->history << 1) | 1;
+        return SAMPLE_SEQ_IN_ORDER;
+    }
+
+    if (ahead > 0)
+    {
+        if (ahead > SAMPLE_SEQ_RESYNC_LIMIT)
+        {
+            seq->resyncs++;
+            sample_seq_resync(seq, frame_id);
+            return SAMPLE_SEQ_RESYNC;
+        }
+
+        *gap_first = seq->next;
+        *gap_count = ahead;
+        seq->missed += ahead;
+        seq->history = (ahead + 1 < SAMPLE_SEQ_HISTORY) ? (seq->history << (ahead + 1)) | 1 : 1;
+        seq->next = frame_id + 1;
+        return SAMPLE_SEQ_GAP;
+    }
+
+    uint32_t behind = seq->next - 1 - frame_id;
+
+    if (behind > SAMPLE_SEQ_RESYNC_LIMIT)
+    {
+        /* Hub restarted its frame counter */
+        seq->resyncs++;
+        sample_seq_resync(seq, frame_id);
+        return SAMPLE_SEQ_RESYNC;
+    }
+
+    if (behind < SAMPLE_SEQ_HISTORY)
+    {
+        if (seq->history & (1UL << behind))
+        {
+            seq->duplicates++;
+            return SAMPLE_SEQ_DUPLICATE;
+        }
+        seq->history |= 1UL << behind;
+    }
+
+    /* Older than the history can tell apart, let the reorder stage decide */
+    seq->late++;
+    return SAMPLE_SEQ_LATE;
+}
+
+/* Move the head slot to the output, or count it lost when it is a hole */
+static size_t reorder_advance(struct sample_reorder *ro, void **out)
+{
+    void **slot = &ro->slots[ro->next_out & REORDER_MASK];
+    size_t num = 0;
+
+    if (*slot != NULL)
+    {
+        out[num++] = *slot;
+        *slot = NULL;
+        ro->pending--;
+    }
+    else
+    {
+        ro->lost++;
+    }
+    ro->next_out++;
+    return num;
+}
+
+/* Emit everything held back in frame order and restart at frame_id */
+static size_t reorder_flush(struct sample_reorder *ro, void **out, uint32_t frame_id)
+{
+    size_t num = 0;
+
+    while (ro->pending > 0)
+    {
+        void **slot = &ro->slots[ro->next_out & REORDER_MASK];
+
+        if (*slot != NULL)
+        {
+            out[num++] = *slot;
+            *slot = NULL;
+            ro->pending--;
+        }
+        ro->next_out++;
+    }
+    ro->next_out = frame_id;
+    ro->hole_since = 0;
+    return num;
+}
+
+size_t sample_reorder_process(struct sample_reorder *ro, void *const *in, size_t num,
+                              void **out, int64_t now)
+{
+    size_t num_out = 0;
+
+    for (size_t i = 0; i < num; i++)
+    {
+        uint32_t frame_id = sample_frame_id(in[i]);
+
+        if (!ro->synced)
+        {
+            ro->synced = true;
+            ro->next_out = frame_id;
+        }
+
+        int32_t offset = (int32_t)(frame_id - ro->next_out);
+
+        if (offset < -SAMPLE_SEQ_RESYNC_LIMIT || offset >= 2 * SAMPLE_REORDER_WINDOW)
+        {
+            /* Restarted or far ahead, nothing held back can be completed */
+            num_out += reorder_flush(ro, &out[num_out], frame_id);
+            offset = 0;
+        }
+        else if (offset < 0)
+        {
+            /* Its place was already given up on */
+            ro->stale++;
+            ro->release(in[i]);
+            continue;
+        }
+
+        while (offset >= SAMPLE_REORDER_WINDOW)
+        {
+            /* Make room by giving up the oldest hole */
+            num_out += reorder_advance(ro, &out[num_out]);
+            ro->hole_since = 0;
+            offset--;
+        }
+
+        void **slot = &ro->slots[frame_id & REORDER_MASK];
+        if (*slot != NULL)
+        {
+            ro->release(in[i]);
+            continue;
+        }
+
+        if (ro->pending > 0 && offset < SAMPLE_REORDER_WINDOW - 1 &&
+            ro->slots[(frame_id + 1) & REORDER_MASK] != NULL)
+        {
+            /* A newer frame is already waiting, so this one filled a hole */
+            ro->reordered++;
+        }
+
+        *slot = in[i];
+        ro->pending++;
+    }
+
+    while (ro->pending > 0)
+    {
+        if (ro->slots[ro->next_out & REORDER_MASK] != NULL)
+        {
+            num_out += reorder_advance(ro, &out[num_out]);
+            ro->hole_since = 0;
+            continue;
+        }
+
+        /* Hole in front of samples that are waiting */
+        if (ro->hole_since == 0)
+        {
+            ro->hole_since = now;
+        }
+        if (now - ro->hole_since < SAMPLE_REORDER_HOLD_MS)
+        {
+            break;
+        }
+
+        while (ro->slots[ro->next_out & REORDER_MASK] == NULL)
+        {
+            reorder_advance(ro, &out[num_out]);
+        }
+        ro->hole_since = 0;
+    }
+
+    return num_out;
+}
+
+void sample_reorder_reset(struct sample_reorder *ro)
+{
+    for (size_t i = 0; i < SAMPLE_REORDER_WINDOW; i++)
+    {
+        if (ro->slots[i] != NULL)
+        {
+            ro->release(ro->slots[i]);
+            ro->slots[i] = NULL;
+        }
+    }
+    ro->pending = 0;
+    ro->synced = false;
+    ro->hole_since = 0;
+}
@@ -0,0 +1,98 @@
+#ifndef SAMPLE_SEQ_H
+#define SAMPLE_SEQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Frame-id bookkeeping for the sample streams.
+ *
+ * struct sample_seq runs at ingest. It finds gaps and duplicates in the
+ * frame_id sequence of one stream so missing frames can be requested again
+ * from the hub.
+ *
+ * struct sample_reorder runs on the drain side. It holds samples back for a
+ * short while so retransmitted frames can be slotted in before they reach
+ * the session file. Holes that do not fill within SAMPLE_REORDER_HOLD_MS are
+ * given up on and counted as lost.
+ */
+
+/* Frames tracked behind the newest one for duplicate/late detection */
+#define SAMPLE_SEQ_HISTORY 32
+/* A jump larger than this is taken as a hub restart, not as a gap */
+#define SAMPLE_SEQ_RESYNC_LIMIT 1024
+
+/* Reorder window in frames, power of two */
+#define SAMPLE_REORDER_WINDOW 32
+/* How long a hole holds back newer samples of the same stream */
+#define SAMPLE_REORDER_HOLD_MS 200
+
+enum sample_seq_result
+{
+    SAMPLE_SEQ_IN_ORDER,
+    SAMPLE_SEQ_GAP,       /* frames before this one are missing */
+    SAMPLE_SEQ_LATE,      /* fills an earlier gap, e.g. a retransmission */
+    SAMPLE_SEQ_DUPLICATE, /* already received, drop it */
+    SAMPLE_SEQ_RESYNC,    /* sequence restarted */
+};
+
+struct sample_seq
+{
+    bool synced;
+    uint32_t next;    /* newest frame_id seen + 1 */
+    uint32_t history; /* bit n set: frame (next - 1 - n) was received */
+
+    uint32_t missed;
+    uint32_t late;
+    uint32_t duplicates;
+    uint32_t resyncs;
+};
+
+/**
+ * @brief Account one received frame_id
+ *
+ * @param seq Stream state
+ * @param frame_id Frame id of the received sample
+ * @param gap_first Set to the first missing frame_id on SAMPLE_SEQ_GAP
+ * @param gap_count Set to the number of missing frames on SAMPLE_SEQ_GAP
+ * @return Classification of the frame
+ */
+enum sample_seq_result sample_seq_check(struct sample_seq *seq, uint32_t frame_id,
+                                        uint32_t *gap_first, uint32_t *gap_count);
+
+struct sample_reorder
+{
+    void (*release)(void *sample);
+
+    bool synced;
+    uint32_t next_out; /* frame_id the consumer expects next */
+    uint32_t pending;
+    int64_t hole_since;
+    void *slots[SAMPLE_REORDER_WINDOW];
+
+    uint32_t reordered;
+    uint32_t lost;
+    uint32_t stale;
+};
+
+/**
+ * @brief Feed samples into the reorder window and take out what is ready
+ *
+ * @param ro Reorder state of the stream
+ * @param in Samples taken from the ring, in arrival order
+ * @param num Number of samples in @p in
+ * @param out Receives the samples that can be written, in frame order. Must
+ *            hold at least SAMPLE_REORDER_WINDOW + @p num entries.
+ * @param now Current uptime in ms
+ * @return Number of samples stored in @p out
+ */
+size_t sample_reorder_process(struct sample_reorder *ro, void *const *in, size_t num,
+                              void **out, int64_t now);
+
+/**
+ * @brief Drop everything held back and relearn the sequence from the next sample
+ */
+void sample_reorder_reset(struct sample_reorder *ro);
+
+#endif /* SAMPLE_SEQ_H */
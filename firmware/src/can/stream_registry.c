@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include "stream_registry.h"
+
+struct stream_entry
+{
+    uint8_t stream_id;
+    char name[STREAM_NAME_LEN + 1];
+};
+
+/* Written by hub status discovery, read by the sample drain */
+static struct stream_entry streams[STREAM_REGISTRY_SIZE];
+static size_t num_streams;
+
+static struct stream_entry *stream_find(uint8_t stream_id)
+{
+    for (size_t i = 0; i < num_streams; i++)
+    {
+        if (streams[i].stream_id == stream_id)
+        {
+            return &streams[i];
+        }
+    }
+    return NULL;
+}
+
+int stream_registry_set_name(uint8_t stream_id, const char *name, size_t len)
+{
+    struct stream_entry *entry = stream_find(stream_id);
+
+    if (entry == NULL)
+    {
+        if (num_streams == STREAM_REGISTRY_SIZE)
+        {
+            return -ENOMEM;
+        }
+        entry = &streams[num_streams++];
+        entry->stream_id = stream_id;
+    }
+
+    len = strnlen(name, MIN(len, STREAM_NAME_LEN));
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    return 0;
+}
+
+void stream_registry_add_status(const system_status_t *status)
+{
+    /* A hub that has no name for a sensor keeps the default */
+    if (status->sensor1_name[0] != '\0')
+    {
+        stream_registry_set_name(SAMPLE_STREAM_ID(status->id, 1), status->sensor1_name,
+                                 sizeof(status->sensor1_name));
+    }
+    if (status->sensor2_name[0] != '\0')
+    {
+        stream_registry_set_name(SAMPLE_STREAM_ID(status->id, 2), status->sensor2_name,
+                                 sizeof(status->sensor2_name));
+    }
+}
+
+const char *stream_registry_name(uint8_t stream_id)
+{
+    struct stream_entry *entry = stream_find(stream_id);
+
+    return entry != NULL ? entry->name : "?";
+}
+
+bool stream_registry_get(size_t index, uint8_t *stream_id, const char **name)
+{
+    if (index >= num_streams)
+    {
+        return false;
+    }
+
+    *stream_id = streams[index].stream_id;
+    *name = streams[index].name;
+    return true;
+}
+
+static int cmd_hub_streams(const struct shell *sh, size_t argc, char **argv)
+{
+    uint8_t stream_id;
+    const char *name;
+
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-4s %-4s %-7s %s", "id", "hub", "sensor", "name");
+    for (size_t i = 0; stream_registry_get(i, &stream_id, &name); i++)
+    {
+        shell_print(sh, "0x%02x %-4u %-7u %s", stream_id, SAMPLE_STREAM_HUB(stream_id),
+                    SAMPLE_STREAM_SENSOR(stream_id), name);
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), streams, NULL, "Known sample streams and their names",
+                 cmd_hub_streams, 1, 0);
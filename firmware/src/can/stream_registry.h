@@ -0,0 +1,47 @@
+#ifndef STREAM_REGISTRY_H
+#define STREAM_REGISTRY_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "can_rx_types.h"
+
+/*
+ * Names of the sample streams.
+ *
+ * Samples only carry a one-byte stream id, see SAMPLE_STREAM_ID(). The
+ * readable names are learned once, from the defaults of the channel table and
+ * the system_status_t each hub returns at discovery, and looked up from here
+ * whenever a name has to be shown or written.
+ */
+
+#define STREAM_REGISTRY_SIZE 16
+#define STREAM_NAME_LEN 8
+
+/**
+ * @brief Set the name of a stream, replacing an earlier one
+ *
+ * @param name Name, not necessarily NUL terminated within @p len
+ * @param len Maximum length of @p name, at most STREAM_NAME_LEN bytes are kept
+ * @return 0 on success, -ENOMEM if the registry is full
+ */
+int stream_registry_set_name(uint8_t stream_id, const char *name, size_t len);
+
+/**
+ * @brief Take over the sensor names reported in a hub status
+ */
+void stream_registry_add_status(const system_status_t *status);
+
+/**
+ * @brief Name of a stream, "?" if it was never registered
+ */
+const char *stream_registry_name(uint8_t stream_id);
+
+/**
+ * @brief Walk the registered streams
+ *
+ * @param index Position in the registry, starting at 0
+ * @return false once @p index is past the last stream
+ */
+bool stream_registry_get(size_t index, uint8_t *stream_id, const char **name);
+
+#endif /* STREAM_REGISTRY_H */
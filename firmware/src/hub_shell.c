@@ -0,0 +1,8 @@
+/*
+ * Root of the "hub" shell command. Modules add their own diagnostics with
+ * SHELL_SUBCMD_ADD((hub), ...).
+ */
+#include <zephyr/shell/shell.h>
+
+SHELL_SUBCMD_SET_CREATE(hub_cmds, (hub));
+SHELL_CMD_REGISTER(hub, &hub_cmds, "MainHub diagnostics", NULL);
@@ -2,6 +2,7 @@
 #include <zephyr/kernel.h>
 #include <session/session.h>
 #include <can/can_transport.h>
+#include "boot.h"
 
 #include <zephyr/drivers/can.h>
 #include <zephyr/logging/log.h>
@@ -9,10 +10,10 @@
 /**
  * @brief Main application entry point.
  *
+ * Only starts the subsystems, they come up in parallel; see boot.h.
  */
 int main(void)
 {
-    k_sleep(K_MSEC(1000));
     can_transport_init();
     session_init();
 
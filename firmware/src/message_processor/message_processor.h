@@ -28,6 +28,7 @@
 #define CMD_COMMAND_STOP             0x03    /* Stop CPR command */
 #define CMD_COMMAND_DATA             0x04    /* Send ID data command */
 #define CMD_COMMAND_TIMEDATA         0x05    /* Send date/time command */
+#define CMD_COMMAND_SUBSCRIBE        0x06    /* Set a sample subscription */
 
 /* Protocol command constants for compatibility with ble_notifications.h */
 #define CPR_CONTROL_START            CMD_CONTROL_START   /* Start CPR command */
@@ -4,6 +4,7 @@
  */
 
 #include "message_processor.h"
+#include "session/sample_sub.h"
 #include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
@@ -176,6 +177,44 @@ static void process_id_string(const uint8_t *data, size_t len, bool is_instructo
     request_led_state(true);
 }
 
+/**
+ * Process a sample subscription
+ *
+ * Payload: sink, stream id (0xFF for all), decimation (LE16), rate in Hz
+ * (LE16), aggregation, flags. See sample_sub.h.
+ */
+static void process_subscribe(const uint8_t *data_payload, size_t data_len)
+{
+    struct sample_sub sub;
+    int sensor = -1;
+
+    /* data_len still counts the trailing SEMICOLON and END_BYTE */
+    if (data_len < 8 + 2) {
+        LOG_WRN("Subscription too short: %d bytes", data_len);
+        return;
+    }
+
+    if (data_payload[1] != 0xFF) {
+        sensor = sample_sub_sensor_by_stream(data_payload[1]);
+        if (sensor < 0) {
+            LOG_WRN("Subscription for unknown stream 0x%02x", data_payload[1]);
+            return;
+        }
+    }
+
+    sub.decimate = data_payload[2] | (data_payload[3] << 8);
+    sub.rate_hz = data_payload[4] | (data_payload[5] << 8);
+    sub.agg = data_payload[6];
+    sub.flags = data_payload[7];
+
+    if (sample_sub_set(data_payload[0], sensor, &sub) != 0) {
+        LOG_WRN("Invalid subscription for sink %d", data_payload[0]);
+        return;
+    }
+    LOG_INF("Subscription: sink %d stream 0x%02x decimate %u rate %u Hz", data_payload[0],
+            data_payload[1], sub.decimate, sub.rate_hz);
+}
+
 /**
  * Private helper for processing time data
  */
@@ -415,6 +454,10 @@ static int process_command(uint8_t *cmd_data, uint16_t len)
             LOG_WRN("Time data command with no payload");
         }
     }
+    else if (command == CMD_COMMAND_SUBSCRIBE) {
+        LOG_INF("Command: Sample subscription");
+        process_subscribe(&cmd_data[4], len - 4);
+    }
     else {
         LOG_WRN("Unknown command: 0x%02x", command);
         return -EINVAL;
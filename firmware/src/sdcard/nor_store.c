@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/fs/littlefs.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include "nor_store.h"
+#include "sdcard_module.h"
+#include "session_catalog.h"
+#include "session_journal.h"
+
+/* Copied per step, a few ms of flash read and card write */
+#define NOR_MIGRATE_CHUNK 4096
+/* Wait after a failed step, the card may be full or gone */
+#define NOR_MIGRATE_RETRY_MS 10000
+/* Last card entries checked for a session moved before a power loss */
+#define NOR_MIGRATE_DUP_CHECK 4
+
+FS_LITTLEFS_DECLARE_DEFAULT_CONFIG(nor_lfs);
+
+static struct fs_mount_t nor_mnt = {
+    .type = FS_LITTLEFS,
+    .fs_data = &nor_lfs,
+    .storage_dev = (void *)FIXED_PARTITION_ID(storage_partition),
+    .mnt_point = SESSION_ROOT_NOR,
+};
+
+/* Session being moved to the card */
+struct nor_migration
+{
+    uint32_t index; /* next entry of the flash catalog */
+    uint32_t count; /* entries in the flash catalog */
+    bool loaded;
+    struct session_catalog_entry entry;
+    uint32_t dst_id; /* id on the card, no files of it there before */
+    uint8_t part;
+    bool copying;
+    struct fs_file_t src;
+    struct fs_file_t dst;
+};
+
+static uint8_t nor_copy_buf[NOR_MIGRATE_CHUNK] __aligned(32);
+static struct nor_migration mig;
+static bool nor_mounted;
+static int64_t nor_retry_at;
+
+static uint32_t stat_sessions;
+static uint64_t stat_bytes;
+static uint32_t stat_errors;
+
+int nor_store_mount(void)
+{
+    int ret = fs_mount(&nor_mnt);
+
+    if (ret != 0)
+    {
+        printk("Failed to mount the QSPI flash [%d]\n", ret);
+        return ret;
+    }
+
+    /* A recovered session is in the catalog before it is counted */
+    session_journal_recover(SESSION_ROOT_NOR);
+    ret = session_catalog_load(SESSION_ROOT_NOR);
+    mig.count = MAX(ret, 0);
+    nor_mounted = true;
+    return 0;
+}
+
+bool nor_store_mounted(void)
+{
+    return nor_mounted;
+}
+
+void nor_store_session_added(void)
+{
+    mig.count++;
+}
+
+bool nor_store_migrate_due(void)
+{
+    return nor_mounted && mig.index < mig.count && k_uptime_get() >= nor_retry_at;
+}
+
+static void nor_part_path(const char *root, uint32_t id, uint8_t part, char *path)
+{
+    snprintf(path, SESSION_PATH_MAX, "%s/S%04u_%02u.bin", root, id % 10000, part);
+}
+
+static void nor_part_paths(uint8_t part, char *src, char *dst)
+{
+    nor_part_path(SESSION_ROOT_NOR, sys_le32_to_cpu(mig.entry.session_id), part, src);
+    nor_part_path(SESSION_ROOT_SD, mig.dst_id, part, dst);
+}
+
+/* Same session apart from the id and flags it got on the card */
+static bool nor_same_session(const struct session_catalog_entry *a,
+                             const struct session_catalog_entry *b)
+{
+    size_t first = offsetof(struct session_catalog_entry, instructor_id);
+
+    return memcmp((const uint8_t *)a + first, (const uint8_t *)b + first,
+                  offsetof(struct session_catalog_entry, crc) - first) == 0;
+}
+
+/*
+ * The card has its own ids, the flash ones may be taken there by sessions
+ * of another hub. Takes the next free id off the catalogs, skipping ids
+ * with files on the card but no entry, e.g. a copy cut off by a power loss.
+ */
+static int nor_migrate_pick_id(void)
+{
+    char path[SESSION_PATH_MAX];
+    struct fs_dirent st;
+
+    for (uint32_t tries = 0; tries < 10000; tries++)
+    {
+        uint32_t id = session_catalog_reserve_id();
+        bool taken = false;
+
+        for (uint8_t part = 0; part < mig.entry.parts && !taken; part++)
+        {
+            nor_part_path(SESSION_ROOT_SD, id, part, path);
+            taken = fs_stat(path, &st) == 0;
+        }
+        if (!taken)
+        {
+            mig.dst_id = id;
+            return 0;
+        }
+    }
+    return -EEXIST;
+}
+
+/* Listed on the card already, the power went before the flash was freed */
+static bool nor_migrate_listed(void)
+{
+    struct session_catalog_entry last[NOR_MIGRATE_DUP_CHECK];
+    uint32_t count = session_catalog_count();
+    uint32_t first = count - MIN(count, NOR_MIGRATE_DUP_CHECK);
+    int num = session_catalog_read(first, last, count - first);
+
+    for (int i = 0; i < num; i++)
+    {
+        if ((last[i].flags & SESSION_CATALOG_MIGRATED) && nor_same_session(&last[i], &mig.entry))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void nor_migrate_abort(int err)
+{
+    if (mig.copying)
+    {
+        fs_close(&mig.src);
+        fs_close(&mig.dst);
+        mig.copying = false;
+    }
+    stat_errors++;
+    nor_retry_at = k_uptime_get() + NOR_MIGRATE_RETRY_MS;
+    printk("Moving session %u to the card failed [%d]\n",
+           sys_le32_to_cpu(mig.entry.session_id), err);
+}
+
+/*
+ * Start the next part. The destination id was free when it was picked, so
+ * a file there is this copy cut short by an abort and starts over.
+ */
+static int nor_migrate_open(void)
+{
+    char src[SESSION_PATH_MAX];
+    char dst[SESSION_PATH_MAX];
+    int ret;
+
+    nor_part_paths(mig.part, src, dst);
+    fs_file_t_init(&mig.src);
+    ret = fs_open(&mig.src, src, FS_O_READ);
+    if (ret == -ENOENT)
+    {
+        /* Lost to a power loss before it had data */
+        mig.part++;
+        return 0;
+    }
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    fs_file_t_init(&mig.dst);
+    ret = fs_open(&mig.dst, dst, FS_O_CREATE | FS_O_WRITE);
+    if (ret == 0)
+    {
+        ret = fs_truncate(&mig.dst, 0);
+        if (ret != 0)
+        {
+            fs_close(&mig.dst);
+        }
+    }
+    if (ret != 0)
+    {
+        fs_close(&mig.src);
+        return ret;
+    }
+    mig.copying = true;
+    return 0;
+}
+
+static int nor_migrate_copy(void)
+{
+    ssize_t len = fs_read(&mig.src, nor_copy_buf, sizeof(nor_copy_buf));
+    ssize_t written;
+    int ret;
+
+    if (len < 0)
+    {
+        return len;
+    }
+    if (len == 0)
+    {
+        fs_close(&mig.src);
+        ret = fs_close(&mig.dst);
+        mig.copying = false;
+        if (ret == 0)
+        {
+            mig.part++;
+        }
+        return ret;
+    }
+
+    written = fs_write(&mig.dst, nor_copy_buf, len);
+    if (written != len)
+    {
+        return written < 0 ? written : -ENOSPC;
+    }
+    stat_bytes += len;
+    return 0;
+}
+
+/* Every part is on the card, list it there under its new id and free the flash */
+static int nor_migrate_commit(void)
+{
+    struct session_catalog_entry entry = mig.entry;
+    char src[SESSION_PATH_MAX];
+    int ret;
+
+    if (mig.dst_id != 0)
+    {
+        entry.session_id = sys_cpu_to_le32(mig.dst_id);
+        entry.flags |= SESSION_CATALOG_MIGRATED;
+        ret = session_catalog_append(SESSION_ROOT_SD, &entry);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    for (uint8_t part = 0; part < mig.entry.parts; part++)
+    {
+        nor_part_path(SESSION_ROOT_NOR, sys_le32_to_cpu(mig.entry.session_id), part, src);
+        fs_unlink(src);
+    }
+    stat_sessions++;
+    mig.loaded = false;
+    mig.index++;
+    return 0;
+}
+
+/* Nothing left on the flash, start the next catalog from entry 0 */
+static void nor_migrate_done(void)
+{
+    char path[SESSION_PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", SESSION_ROOT_NOR, SESSION_CATALOG_FILE);
+    fs_unlink(path);
+    mig.index = 0;
+    mig.count = 0;
+}
+
+int nor_store_migrate_step(void)
+{
+    int ret = 0;
+
+    if (!nor_store_migrate_due())
+    {
+        return 0;
+    }
+
+    if (!mig.loaded)
+    {
+        ret = session_catalog_read_from(SESSION_ROOT_NOR, mig.index, &mig.entry, 1);
+        if (ret == 0)
+        {
+            /* Torn by a power loss, nothing to move */
+            mig.index++;
+        }
+        else if (ret > 0)
+        {
+            mig.loaded = true;
+            mig.part = 0;
+            mig.dst_id = 0;
+            ret = 0;
+            if (nor_migrate_listed())
+            {
+                /* Only the flash is left to free */
+                mig.part = mig.entry.parts;
+            }
+            else
+            {
+                ret = nor_migrate_pick_id();
+                if (ret != 0)
+                {
+                    mig.loaded = false;
+                }
+            }
+        }
+    }
+    else if (mig.copying)
+    {
+        ret = nor_migrate_copy();
+    }
+    else if (mig.part < mig.entry.parts)
+    {
+        ret = nor_migrate_open();
+    }
+    else
+    {
+        ret = nor_migrate_commit();
+    }
+
+    if (ret != 0)
+    {
+        nor_migrate_abort(ret);
+        return ret;
+    }
+    if (mig.index >= mig.count)
+    {
+        nor_migrate_done();
+    }
+    return 0;
+}
+
+static int cmd_hub_nor(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    struct fs_statvfs st;
+
+    if (!nor_mounted)
+    {
+        shell_print(sh, "not mounted");
+        return 0;
+    }
+    if (fs_statvfs(SESSION_ROOT_NOR, &st) == 0)
+    {
+        shell_print(sh, "%lu of %lu KiB free", st.f_bfree * st.f_frsize / 1024,
+                    st.f_blocks * st.f_frsize / 1024);
+    }
+    shell_print(sh, "sessions waiting for the card %u", mig.count - mig.index);
+    shell_print(sh, "moved %u sessions, %llu bytes, errors %u", stat_sessions, stat_bytes,
+                stat_errors);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), nor, NULL, "QSPI flash session store", cmd_hub_nor, 1, 0);
@@ -0,0 +1,79 @@
+#ifndef NOR_STORE_H
+#define NOR_STORE_H
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Session store on the QSPI NOR flash (storage_partition, LittleFS at
+ * SESSION_ROOT_NOR).
+ *
+ * A session starts on the flash when there is no card, with the same part
+ * files, catalog and journal as on the card. Once a card is mounted the SD
+ * writer moves those sessions over while no session runs: each gets the
+ * next id free on the card, its parts are copied under that id a chunk at a
+ * time, the entry is added to the card catalog flagged
+ * SESSION_CATALOG_MIGRATED and only then are the parts removed from the
+ * flash. On native_sim the partition lives on the flash simulator.
+ *
+ * All of it runs on the SD writer thread.
+ */
+
+#if defined(CONFIG_APP_NOR_STORE)
+
+/**
+ * @brief Mount the flash file system, formatting it on first use, then
+ *        recover its journal and load its catalog
+ */
+int nor_store_mount(void);
+
+/* True once mounted */
+bool nor_store_mounted(void);
+
+/**
+ * @brief A session was added to the flash catalog
+ */
+void nor_store_session_added(void);
+
+/**
+ * @brief True while sessions wait to go to the card and no retry delay runs
+ */
+bool nor_store_migrate_due(void);
+
+/**
+ * @brief Move the next chunk of a session to the card, the card must be
+ *        mounted and no session open
+ *
+ * @return 0 when a step was done, negative on error (retried later)
+ */
+int nor_store_migrate_step(void);
+
+#else
+
+static inline int nor_store_mount(void)
+{
+    return -ENOTSUP;
+}
+
+static inline bool nor_store_mounted(void)
+{
+    return false;
+}
+
+static inline void nor_store_session_added(void)
+{
+}
+
+static inline bool nor_store_migrate_due(void)
+{
+    return false;
+}
+
+static inline int nor_store_migrate_step(void)
+{
+    return -ENOTSUP;
+}
+
+#endif /* CONFIG_APP_NOR_STORE */
+
+#endif /* NOR_STORE_H */
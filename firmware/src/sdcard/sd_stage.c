@@ -0,0 +1,72 @@
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/linker/devicetree_regions.h>
+#include "sd_stage.h"
+
+#define SD_STAGE_SIZE ((size_t)CONFIG_APP_SD_STAGE_SIZE_KB * 1024)
+
+#if defined(CONFIG_APP_SD_STAGE_SDRAM)
+/* NOLOAD section of the memory region, not cleared at boot */
+#define SD_STAGE_SECTION __attribute__((section(LINKER_DT_NODE_REGION_NAME(DT_NODELABEL(sdram1)))))
+#else
+#define SD_STAGE_SECTION
+#endif
+
+static uint8_t sd_stage_buf[SD_STAGE_SIZE] SD_STAGE_SECTION __aligned(32);
+
+static size_t sd_stage_head; /* next byte written */
+static size_t sd_stage_tail; /* next byte read */
+static size_t sd_stage_fill;
+static size_t sd_stage_max;
+
+bool sd_stage_put(const void *data, size_t len)
+{
+    size_t first = MIN(len, SD_STAGE_SIZE - sd_stage_head);
+
+    if (len > SD_STAGE_SIZE - sd_stage_fill)
+    {
+        return false;
+    }
+
+    memcpy(&sd_stage_buf[sd_stage_head], data, first);
+    memcpy(sd_stage_buf, (const uint8_t *)data + first, len - first);
+    sd_stage_head = (sd_stage_head + len) % SD_STAGE_SIZE;
+    sd_stage_fill += len;
+    sd_stage_max = MAX(sd_stage_max, sd_stage_fill);
+    return true;
+}
+
+size_t sd_stage_peek(const uint8_t **data)
+{
+    *data = &sd_stage_buf[sd_stage_tail];
+    return MIN(sd_stage_fill, SD_STAGE_SIZE - sd_stage_tail);
+}
+
+void sd_stage_consume(size_t len)
+{
+    sd_stage_tail = (sd_stage_tail + len) % SD_STAGE_SIZE;
+    sd_stage_fill -= len;
+}
+
+size_t sd_stage_used(void)
+{
+    return sd_stage_fill;
+}
+
+void sd_stage_reset(void)
+{
+    sd_stage_head = 0;
+    sd_stage_tail = 0;
+    sd_stage_fill = 0;
+}
+
+size_t sd_stage_size(void)
+{
+    return SD_STAGE_SIZE;
+}
+
+size_t sd_stage_high_water(void)
+{
+    return sd_stage_max;
+}
@@ -0,0 +1,47 @@
+#ifndef SD_STAGE_H
+#define SD_STAGE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Staging FIFO in front of the session file write buffers.
+ *
+ * When the SD writer falls behind, the session data waits here instead of
+ * being dropped. The FIFO is CONFIG_APP_SD_STAGE_SIZE_KB large and lives in
+ * the external SDRAM (sdram1) with CONFIG_APP_SD_STAGE_SDRAM, a plain RAM
+ * array otherwise (native_sim, boards without SDRAM). The card DMA never
+ * sees it, data is copied on into the write buffers as they come free.
+ *
+ * Producer and consumer are the same thread (the session file filler), so
+ * there is no locking. The counters may be read from anywhere.
+ */
+
+/**
+ * @brief Append @p len bytes, all or nothing
+ *
+ * @return false if they do not fit
+ */
+bool sd_stage_put(const void *data, size_t len);
+
+/**
+ * @brief Oldest bytes in the FIFO as one contiguous run
+ *
+ * @return Length of the run, 0 if the FIFO is empty
+ */
+size_t sd_stage_peek(const uint8_t **data);
+
+/**
+ * @brief Drop @p len bytes from the front after they were copied out
+ */
+void sd_stage_consume(size_t len);
+
+/* Bytes waiting */
+size_t sd_stage_used(void);
+/* Drop everything, the high watermark stays */
+void sd_stage_reset(void);
+/* Capacity and most bytes ever waiting */
+size_t sd_stage_size(void);
+size_t sd_stage_high_water(void);
+
+#endif /* SD_STAGE_H */
@@ -1,6 +1,14 @@
 #include "sdcard_module.h"
+#include "boot.h"
+#include "session_catalog.h"
+#include "session_journal.h"
+#include "sd_stage.h"
+#include "nor_store.h"
+#include "session/sample_log.h"
+#include "session/sample_sub.h"
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
 #include <zephyr/storage/disk_access.h>
 #include <ff.h>
 #include <string.h>
@@ -11,21 +19,135 @@ LOG_MODULE_REGISTER(sdcard_module, LOG_LEVEL_INF);
 #define DISK_DRIVE_NAME "SD"
 #define DISK_MOUNT_PT "/" DISK_DRIVE_NAME ":"
 #define FILE_PATH DISK_MOUNT_PT "/hello.txt"
-#define CSV_QUEUE_SIZE 16
 
-#define CSV_LINE_MAX_LEN 256
-#define CSV_QUEUE_SIZE 25 // Number of queued lines
-K_MSGQ_DEFINE(csv_msgq, CSV_LINE_MAX_LEN, CSV_QUEUE_SIZE, 4);
+/*
+ * Session file output. The filler (session start, then the sample pipeline)
+ * copies into write buffers of CONFIG_APP_SD_WRITE_BUFFER_SIZE and hands
+ * them to the sd_writer thread in order. The writer only ever gets whole
+ * sectors, except for the end of the file, so FatFs writes straight from
+ * the buffer with no read-modify-write of a partial sector and the SDMMC
+ * IDMA gets one long transfer. The filler goes on in the next buffer while
+ * the writer flushes. When no buffer is free the filler never waits, the
+ * data goes to the staging FIFO (sd_stage.h) and moves on into the write
+ * buffers in order as the writer catches up.
+ *
+ * A session goes into parts <base>_00.bin, <base>_01.bin, ... of at most
+ * SESSION_PART_SIZE bytes or SESSION_PART_MS. Each part gets its whole size
+ * as one contiguous run of clusters when it is opened, so writing it never
+ * touches the FAT. The writer opens the next part while the current one
+ * fills and closes the old one after a rotation, the filler only switches
+ * slots.
+ *
+ * Without a card the session goes to the QSPI flash instead (nor_store.h).
+ * The writer retries the card every SD_MOUNT_RETRY_MS and, once it is in,
+ * moves the flash sessions over while no session runs.
+ */
+#define SD_SECTOR_SIZE 512
+#define SD_WRITE_BUF_SIZE CONFIG_APP_SD_WRITE_BUFFER_SIZE
+#define SD_WRITE_BUF_COUNT CONFIG_APP_SD_WRITE_BUFFERS
+/* Whole sectors go out once the oldest byte in a buffer is this old */
+#define SD_WRITE_MAX_AGE_MS 1000
 
-extern struct k_msgq csv_usb_msgq;
+#define SESSION_PART_SIZE ((uint32_t)CONFIG_APP_SESSION_FILE_SIZE_KB * 1024)
+#define SESSION_PART_MS ((int64_t)CONFIG_APP_SESSION_FILE_SECONDS * 1000)
+/* Two digits in the name */
+#define SESSION_PART_MAX 99
+/* Card mount retries while the flash stands in for it */
+#define SD_MOUNT_RETRY_MS 10000
+/* Pause between migration steps, lower priority threads get the CPU */
+#define NOR_MIGRATE_PAUSE_MS 1
 
-K_THREAD_STACK_DEFINE(sd_writer_stack, 1024);
+BUILD_ASSERT(SD_WRITE_BUF_SIZE % SD_SECTOR_SIZE == 0,
+             "SD write buffer must be a multiple of the sector size");
+
+enum sd_write_op
+{
+    SD_OP_WRITE,
+    SD_OP_CLOSE,   /* cut the part to what was written and close it */
+    SD_OP_OPEN,    /* open and preallocate the first part */
+    SD_OP_PREPARE, /* open and preallocate the next part */
+    SD_OP_DISCARD, /* remove a prepared part that was never used */
+    SD_OP_CATALOG, /* all parts closed, add the session to the catalog */
+};
+
+struct sd_write_req
+{
+    uint8_t op;
+    int8_t buf;   /* SD_OP_WRITE */
+    uint8_t slot;
+    uint8_t part; /* SD_OP_OPEN, SD_OP_PREPARE */
+    bool last;    /* the session is done with this request */
+    uint16_t len;
+};
+
+/* One part being written, one prepared or closing */
+#define SESSION_SLOTS 2
+
+struct session_part
+{
+    struct fs_file_t file;
+    char path[SESSION_PATH_MAX];
+    uint8_t part;
+    bool open;
+    uint32_t written;
+};
+
+/* Cache line aligned for the SDMMC IDMA */
+static uint8_t sd_write_bufs[SD_WRITE_BUF_COUNT][SD_WRITE_BUF_SIZE] __aligned(32);
+static K_SEM_DEFINE(sd_write_free, SD_WRITE_BUF_COUNT, SD_WRITE_BUF_COUNT);
+/* Every buffer plus the file operations of the start, a rotation and the finish */
+K_MSGQ_DEFINE(sd_write_msgq, sizeof(struct sd_write_req), SD_WRITE_BUF_COUNT + 8, 4);
+
+/* Filler side */
+static int8_t sd_fill_buf = -1;
+static uint8_t sd_next_buf;
+static uint16_t sd_fill_len;
+static int64_t sd_fill_since;
+static uint8_t sd_cur_slot;
+static uint8_t sd_cur_part;
+static uint32_t sd_part_bytes;
+static int64_t sd_part_since;
+
+struct sd_write_stats
+{
+    uint32_t writes;
+    uint64_t bytes;
+    uint32_t min_bytes;
+    uint64_t cycles;
+    uint32_t max_cycles;
+    uint32_t stalls;
+    uint32_t dropped;
+    uint32_t errors;
+    uint32_t rotations;
+    uint32_t not_prealloc;
+    uint32_t max_close_us;
+};
+
+static struct sd_write_stats sd_stats = {.min_bytes = UINT32_MAX};
+
+/* The session file reads the sample log on the pipeline thread */
+static struct sample_log_cursor sd_cursor;
+static struct sample_sub_filter sd_filter;
+
+/* Also mounts the card, FatFs needs the room */
+K_THREAD_STACK_DEFINE(sd_writer_stack, 2048);
 struct k_thread sd_writer_thread;
 
-struct fs_file_t session_file;
+/* Owned by the writer once the session is open */
+static struct session_part session_parts[SESSION_SLOTS];
+static char session_base[SESSION_PATH_MAX];
+static const char *session_root;
+static bool session_on_nor;
+/* Set from open until the writer closed the last part */
+static atomic_t session_file_open;
+/* The writer has the next part open and preallocated */
+static atomic_t session_next_ready;
+/* Writer side, for the catalog */
+static uint8_t session_parts_closed;
+static uint32_t session_bytes;
 static FATFS fat_fs;
 static bool fs_mounted = false;
-char csv_buffer[256];
+static int64_t sd_mount_at;
 extern bool cpr_session_active;
 
 static struct fs_mount_t fat_fs_mnt = {
@@ -33,7 +155,8 @@ static struct fs_mount_t fat_fs_mnt = {
     .fs_data = &fat_fs,
     .mnt_point = "/SD:"};
 
-int init_sdcard(void)
+/* Mounting takes a few hundred ms with card init, done on the writer thread */
+static int sdcard_mount(void)
 {
     struct fs_file_t file;
     int ret;
@@ -92,11 +215,6 @@ int init_sdcard(void)
             }
         }
         fs_close(&file);
-        k_thread_create(&sd_writer_thread, sd_writer_stack,
-                        K_THREAD_STACK_SIZEOF(sd_writer_stack),
-                        sd_writer_thread_func, NULL, NULL, NULL,
-                        5, 0, K_NO_WAIT);
-        k_thread_name_set(&sd_writer_thread, "sd_writer");
     }
     else
     {
@@ -107,123 +225,588 @@ int init_sdcard(void)
     return 0;
 }
 
-void write_to_session_file(char *csv_formatted_text, size_t length)
+const char *session_storage_root(void)
 {
-    if (!cpr_session_active)
+    if (fs_mounted)
+    {
+        return SESSION_ROOT_SD;
+    }
+    if (nor_store_mounted())
+    {
+        return SESSION_ROOT_NOR;
+    }
+    return NULL;
+}
+
+int init_sdcard(void)
+{
+    sample_log_attach(&sd_cursor, "sd");
+    sample_sub_filter_init(&sd_filter, SAMPLE_SINK_SD);
+    k_thread_create(&sd_writer_thread, sd_writer_stack,
+                    K_THREAD_STACK_SIZEOF(sd_writer_stack),
+                    sd_writer_thread_func, NULL, NULL, NULL,
+                    5, 0, K_NO_WAIT);
+    k_thread_name_set(&sd_writer_thread, "sd_writer");
+
+    return 0;
+}
+
+/* Open a part and reserve its whole size, empty if it existed */
+static int session_part_open(uint8_t slot, uint8_t part)
+{
+    struct session_part *p = &session_parts[slot];
+    int ret;
+
+    snprintf(p->path, sizeof(p->path), SESSION_PART_PATH_FMT, session_base, part);
+    fs_file_t_init(&p->file);
+    ret = fs_open(&p->file, p->path, FS_O_CREATE | FS_O_WRITE);
+    if (ret != 0)
+    {
+        printk("Failed to open %s [%d]\n", p->path, ret);
+        return ret;
+    }
+
+    /* Old data past the end would look like more blocks */
+    ret = fs_truncate(&p->file, 0);
+    if (ret != 0)
+    {
+        fs_close(&p->file);
+        return ret;
+    }
+
+    /* LittleFS on the flash allocates as it goes, only the card gets an extent */
+    bool reserved = session_on_nor;
+
+#if FF_USE_EXPAND
+    if (!reserved && f_expand((FIL *)p->file.filep, SESSION_PART_SIZE, 1) == FR_OK)
+    {
+        /* The directory entry covers the extent from now on */
+        fs_sync(&p->file);
+        reserved = true;
+    }
+#endif
+    if (!reserved)
+    {
+        /* Still usable, clusters get allocated as the part grows */
+        sd_stats.not_prealloc++;
+        printk("No contiguous space for %s\n", p->path);
+    }
+
+    p->part = part;
+    p->open = true;
+    p->written = 0;
+    return 0;
+}
+
+/* Give back the unused rest of the extent and close */
+static void session_part_close(uint8_t slot)
+{
+    struct session_part *p = &session_parts[slot];
+    uint32_t start = k_cycle_get_32();
+
+    if (!p->open)
     {
-        printk("Session not active, skipping queue.\n");
         return;
     }
+    fs_truncate(&p->file, p->written);
+    fs_close(&p->file);
+    p->open = false;
+    session_parts_closed++;
+    session_bytes += p->written;
+    sd_stats.max_close_us = MAX(sd_stats.max_close_us,
+                                k_cyc_to_us_floor32(k_cycle_get_32() - start));
+}
+
+/* Make what was written durable and record it in the journal */
+static void session_journal_update(bool active)
+{
+    struct session_journal_state st = {
+        .active = active,
+        .root = session_root,
+        .base = session_base,
+        .parts_closed = session_parts_closed,
+        .bytes_closed = session_bytes,
+    };
+
+    for (uint8_t i = 0; i < SESSION_SLOTS; i++)
+    {
+        struct session_part *p = &session_parts[i];
+
+        if (p->open && fs_sync(&p->file) == 0)
+        {
+            st.parts[i].part = p->part;
+            st.parts[i].open = 1;
+            st.parts[i].durable = p->written;
+        }
+    }
+    session_journal_commit(&st);
+}
+
+static void sd_queue_op(uint8_t op, uint8_t slot, uint8_t part, bool last)
+{
+    struct sd_write_req req = {.op = op, .buf = -1, .slot = slot, .part = part, .last = last};
 
-    if (length >= CSV_LINE_MAX_LEN)
+    k_msgq_put(&sd_write_msgq, &req, K_NO_WAIT);
+}
+
+int open_session_file(const char *base)
+{
+    if (!atomic_cas(&session_file_open, 0, 1))
+    {
+        return -EBUSY;
+    }
+
+    /* The writer is idle, nothing else touches these until the next finish */
+    strncpy(session_base, base, sizeof(session_base) - 1);
+    session_on_nor = strncmp(base, SESSION_ROOT_NOR, strlen(SESSION_ROOT_NOR)) == 0;
+    session_root = session_on_nor ? SESSION_ROOT_NOR : SESSION_ROOT_SD;
+    session_parts_closed = 0;
+    session_bytes = 0;
+    sd_stage_reset();
+    sd_cur_slot = 0;
+    sd_cur_part = 0;
+    sd_part_bytes = 0;
+    sd_part_since = k_uptime_get();
+    atomic_clear(&session_next_ready);
+    /*
+     * Finding a contiguous extent can take seconds on a fragmented card,
+     * the writer does it and the start command returns at once. Data for
+     * the part queues up behind the open.
+     */
+    sd_queue_op(SD_OP_OPEN, 0, 0, false);
+    sd_queue_op(SD_OP_PREPARE, 1, 1, false);
+    return 0;
+}
+
+/*
+ * Give the fill buffer back unused. It is next in line again: the one after
+ * it may still be on its way to the card.
+ */
+static void sd_fill_release(void)
+{
+    if (sd_fill_buf < 0)
     {
-        printk("Line too long to queue\n");
         return;
     }
+    sd_next_buf = sd_fill_buf;
+    sd_fill_buf = -1;
+    k_sem_give(&sd_write_free);
+}
 
-    if (k_msgq_put(&csv_msgq, csv_formatted_text, K_NO_WAIT) != 0)
-        printk("CSV queue full, dropping sample\n");
+void close_session_file(void)
+{
+    /* Start failed half way, nothing of it goes to the card */
+    sd_fill_release();
+    sd_queue_op(SD_OP_DISCARD, sd_cur_slot, 0, false);
+    sd_queue_op(SD_OP_DISCARD, (sd_cur_slot + 1) % SESSION_SLOTS, 0, true);
 }
 
-void write_vl_to_session_file(sample_sensor1_t *vl_samples, uint8_t num)
+/* Get the next buffer in line if the writer gave one back */
+static int sd_fill_acquire(void)
 {
-    if (!cpr_session_active)
+    if (k_sem_take(&sd_write_free, K_NO_WAIT) != 0)
+    {
+        return -EAGAIN;
+    }
+    sd_fill_buf = sd_next_buf;
+    sd_next_buf = (sd_next_buf + 1) % SD_WRITE_BUF_COUNT;
+    sd_fill_len = 0;
+    sd_fill_since = k_uptime_get();
+    return 0;
+}
+
+static void sd_fill_submit(uint16_t len)
+{
+    struct sd_write_req req = {.op = SD_OP_WRITE, .buf = sd_fill_buf, .slot = sd_cur_slot,
+                               .len = len};
+
+    /* Room for every buffer plus the file operations, cannot fail */
+    k_msgq_put(&sd_write_msgq, &req, K_NO_WAIT);
+    sd_fill_buf = -1;
+}
+
+/* Hand over what the current part still has in the fill buffer */
+static void sd_fill_flush(void)
+{
+    if (sd_fill_buf < 0)
     {
         return;
     }
-    for (uint8_t i = 0; i < num; i++)
+    if (sd_fill_len > 0)
+    {
+        sd_fill_submit(sd_fill_len);
+        return;
+    }
+    sd_fill_release();
+}
+
+/* Copy into the write buffers as far as they are free, returns the bytes taken */
+static size_t sd_fill_copy(const uint8_t *src, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        if (sd_fill_buf < 0 && sd_fill_acquire() != 0)
+        {
+            break;
+        }
+
+        size_t chunk = MIN(len - done, SD_WRITE_BUF_SIZE - sd_fill_len);
+
+        memcpy(&sd_write_bufs[sd_fill_buf][sd_fill_len], &src[done], chunk);
+        sd_fill_len += chunk;
+        done += chunk;
+
+        if (sd_fill_len == SD_WRITE_BUF_SIZE)
+        {
+            sd_fill_submit(SD_WRITE_BUF_SIZE);
+        }
+    }
+    return done;
+}
+
+/* Move staged data on into the write buffers, oldest first */
+static void sd_stage_drain(void)
+{
+    const uint8_t *data;
+    size_t len;
+
+    while ((len = sd_stage_peek(&data)) > 0)
     {
-        memset(csv_buffer, 0x00, sizeof(csv_buffer));
-        size_t len = snprintf(csv_buffer, sizeof(csv_buffer),
-                              "%s,%u,%d\n",
-                              vl_samples[i].sensor_name,
-                              vl_samples[i].frame_id,
-                              vl_samples[i].data.distance_mm);
-        write_to_session_file(csv_buffer, len);
+        size_t done = sd_fill_copy(data, len);
 
-        if (k_msgq_put(&csv_usb_msgq, csv_buffer, K_NO_WAIT) != 0)
-            printk("CSV USB queue full, dropping sample\n");
+        sd_stage_consume(done);
+        if (done < len)
+        {
+            return;
+        }
     }
 }
 
-void write_ads_to_session_file(sample_sensor2_t *ads_samples, uint8_t num)
+int session_file_write(const void *data, size_t len)
 {
-    if (!cpr_session_active)
+    const uint8_t *src = data;
+    size_t done = 0;
+
+    /* Staged data is older and goes first */
+    sd_stage_drain();
+    if (sd_stage_used() == 0)
     {
-        return;
+        done = sd_fill_copy(src, len);
     }
-    for (uint8_t i = 0; i < num; i++)
+    if (done < len)
     {
-        memset(csv_buffer, 0x00, sizeof(csv_buffer));
-        size_t len = snprintf(csv_buffer, sizeof(csv_buffer),
-                              "%s,%u,%d,%d,%d,%d,%d,%d,%d,%d\n",
-                              ads_samples[i].sensor_name,
-                              ads_samples[i].frame_id,
-                              ads_samples[i].data.ch1_mv,
-                              ads_samples[i].data.ch2_mv,
-                              ads_samples[i].data.ch3_mv,
-                              ads_samples[i].data.ch4_mv,
-                              ads_samples[i].data.ch5_mv,
-                              ads_samples[i].data.ch6_mv,
-                              ads_samples[i].data.ch7_mv,
-                              ads_samples[i].data.ch8_mv);
-        write_to_session_file(csv_buffer, len);
-        if (k_msgq_put(&csv_usb_msgq, csv_buffer, K_NO_WAIT) != 0)
-            printk("CSV USB queue full, dropping sample\n");
+        sd_stats.stalls++;
+        if (!sd_stage_put(&src[done], len - done))
+        {
+            /* Only the part that made it into a buffer counts */
+            sd_part_bytes += done;
+            sd_stats.dropped += len - done;
+            return -ENOMEM;
+        }
     }
+    sd_part_bytes += len;
+    return 0;
 }
 
-void write_sdp_to_session_file(sample_sensor3_t *sdp_samples, uint8_t num)
+void session_file_poll(void)
 {
-    if (!cpr_session_active)
+    sd_stage_drain();
+
+    uint16_t whole = ROUND_DOWN(sd_fill_len, SD_SECTOR_SIZE);
+
+    if (sd_fill_buf < 0 || whole == 0 ||
+        k_uptime_get() - sd_fill_since < SD_WRITE_MAX_AGE_MS)
+    {
+        return;
+    }
+
+    /* The partial sector moves to the next buffer, the file stays aligned */
+    int8_t old = sd_fill_buf;
+    uint16_t tail = sd_fill_len - whole;
+
+    if (tail == 0)
     {
+        sd_fill_submit(whole);
         return;
     }
-    for (uint8_t i = 0; i < num; i++)
+    if (sd_fill_acquire() != 0)
+    {
+        /* Writer still busy with the previous buffer, try next time */
+        return;
+    }
+    memcpy(sd_write_bufs[sd_fill_buf], &sd_write_bufs[old][whole], tail);
+    sd_fill_len = tail;
+
+    struct sd_write_req req = {.op = SD_OP_WRITE, .buf = old, .slot = sd_cur_slot, .len = whole};
+    k_msgq_put(&sd_write_msgq, &req, K_NO_WAIT);
+}
+
+bool session_file_rotate_due(size_t len)
+{
+    /* Staged data belongs to the current part */
+    if (!atomic_get(&session_next_ready) || sd_stage_used() > 0)
+    {
+        /* Keep writing the current part, it grows past its extent if need be */
+        return false;
+    }
+    return sd_part_bytes + len > SESSION_PART_SIZE ||
+           k_uptime_get() - sd_part_since >= SESSION_PART_MS;
+}
+
+int session_file_rotate(void)
+{
+    if (!atomic_cas(&session_next_ready, 1, 0))
+    {
+        return -EAGAIN;
+    }
+
+    /* The end of the old part need not be sector aligned, the new one starts aligned */
+    sd_fill_flush();
+    sd_queue_op(SD_OP_CLOSE, sd_cur_slot, 0, false);
+
+    sd_cur_slot = (sd_cur_slot + 1) % SESSION_SLOTS;
+    sd_cur_part++;
+    sd_part_bytes = 0;
+    sd_part_since = k_uptime_get();
+    if (sd_cur_part < SESSION_PART_MAX)
+    {
+        sd_queue_op(SD_OP_PREPARE, (sd_cur_slot + 1) % SESSION_SLOTS, sd_cur_part + 1, false);
+    }
+    sd_stats.rotations++;
+    return sd_cur_part;
+}
+
+int session_file_finish(void)
+{
+    sd_stage_drain();
+    if (sd_stage_used() > 0)
+    {
+        return -EAGAIN;
+    }
+    sd_fill_flush();
+    sd_queue_op(SD_OP_CLOSE, sd_cur_slot, 0, false);
+    /* Queued after its prepare, so this sees the part if it was opened */
+    sd_queue_op(SD_OP_DISCARD, (sd_cur_slot + 1) % SESSION_SLOTS, 0, false);
+    sd_queue_op(SD_OP_CATALOG, 0, 0, true);
+    return 0;
+}
+
+void session_file_sink_poll(void)
+{
+    struct sample_log_entry entry;
+
+    /* Read even without a session so the cursor stays at the head */
+    while (sample_log_read(&sd_cursor, &entry) == 0)
+    {
+        /* The file only ever holds session data */
+        if (cpr_session_active && sample_sub_filter(&sd_filter, &entry, &entry, true))
+        {
+            session_log_append(&sensor_registry[entry.sensor], entry.data, entry.rx_us,
+                               entry.time_us);
+        }
+    }
+}
+
+/* Mount the card and take over what it holds */
+static int sd_writer_mount(void)
+{
+    int ret;
+
+    sd_mount_at = k_uptime_get();
+    ret = sdcard_mount();
+    if (ret == 0)
+    {
+        session_catalog_load(SESSION_ROOT_SD);
+        session_journal_recover(SESSION_ROOT_SD);
+    }
+    return ret;
+}
+
+/* Work done while no session is open: find the card, then empty the flash */
+static k_timeout_t sd_writer_idle_timeout(void)
+{
+    if (atomic_get(&session_file_open))
+    {
+        return K_FOREVER;
+    }
+    if (!fs_mounted && nor_store_mounted())
+    {
+        return K_MSEC(MAX(sd_mount_at + SD_MOUNT_RETRY_MS - k_uptime_get(), 0));
+    }
+    if (fs_mounted && nor_store_migrate_due())
     {
-        memset(csv_buffer, 0x00, sizeof(csv_buffer));
-        size_t len = snprintf(csv_buffer, sizeof(csv_buffer),
-                              "%s,%u,%.4f,%.4f\n",
-                              sdp_samples[i].sensor_name,
-                              sdp_samples[i].frame_id,
-                              (double)sdp_samples[i].data.pressure,
-                              (double)sdp_samples[i].data.temp);
-        write_to_session_file(csv_buffer, len);
-        if (k_msgq_put(&csv_usb_msgq, csv_buffer, K_NO_WAIT) != 0)
-            printk("CSV USB queue full, dropping sample\n");
+        return K_MSEC(NOR_MIGRATE_PAUSE_MS);
     }
+    return K_FOREVER;
 }
 
-void write_bhi_to_session_file(sample_sensor4_t *bhi_samples, uint8_t num)
+static void sd_writer_idle(void)
 {
-    if (!cpr_session_active)
+    if (atomic_get(&session_file_open))
     {
         return;
     }
-    for (uint8_t i = 0; i < num; i++)
+    if (!fs_mounted)
     {
-        memset(csv_buffer, 0x00, sizeof(csv_buffer));
-        size_t len = snprintf(csv_buffer, sizeof(csv_buffer),
-                              "%s,%u,%.4f,%.4f,%.4f\n",
-                              bhi_samples[i].sensor_name,
-                              bhi_samples[i].frame_id,
-                              (double)bhi_samples[i].data.pitch_deg,
-                              (double)bhi_samples[i].data.roll_deg,
-                              (double)bhi_samples[i].data.yaw_deg);
-        write_to_session_file(csv_buffer, len);
+        if (sd_writer_mount() == 0)
+        {
+            printk("SD card mounted, flash sessions move over\n");
+        }
+        return;
     }
+    nor_store_migrate_step();
 }
 
 void sd_writer_thread_func(void *arg1, void *arg2, void *arg3)
 {
-    char line[CSV_LINE_MAX_LEN];
+    struct sd_write_req req;
+
+    boot_stage_begin(BOOT_STAGE_SD);
+    int ret = sd_writer_mount();
+    /* A session can only start once the next id is known over both stores */
+    nor_store_mount();
+    boot_stage_end(BOOT_STAGE_SD, ret != 0 ? -EIO : 0);
+    if (session_storage_root() == NULL)
+    {
+        return;
+    }
+
+    int64_t journal_at = 0;
+    bool journal_due = false;
+
     while (1)
     {
-        if (k_msgq_get(&csv_msgq, &line, K_FOREVER) == 0 && cpr_session_active)
+        k_timeout_t timeout = sd_writer_idle_timeout();
+
+        if (journal_due)
         {
-            ssize_t written = fs_write(&session_file, line, strlen(line));
+            timeout = K_MSEC(MAX(journal_at + SESSION_JOURNAL_MS - k_uptime_get(), 0));
+        }
+        if (k_msgq_get(&sd_write_msgq, &req, timeout) != 0)
+        {
+            if (!journal_due)
+            {
+                sd_writer_idle();
+                continue;
+            }
+            /* Nothing more came in, commit what is there */
+            session_journal_update(true);
+            journal_at = k_uptime_get();
+            journal_due = false;
+            continue;
+        }
+        struct session_part *p = &session_parts[req.slot];
+
+        switch (req.op)
+        {
+        case SD_OP_WRITE:
+        {
+            uint32_t start = k_cycle_get_32();
+            ssize_t written = p->open ? fs_write(&p->file, sd_write_bufs[req.buf], req.len)
+                                      : -EBADF;
+            uint32_t cycles = k_cycle_get_32() - start;
+
+            k_sem_give(&sd_write_free);
             if (written < 0)
+            {
+                sd_stats.errors++;
                 printk("SD Write failed: %d\n", written);
+            }
+            else
+            {
+                p->written += written;
+                sd_stats.writes++;
+                sd_stats.bytes += written;
+                sd_stats.min_bytes = MIN(sd_stats.min_bytes, (uint32_t)written);
+                sd_stats.cycles += cycles;
+                sd_stats.max_cycles = MAX(sd_stats.max_cycles, cycles);
+            }
+            break;
+        }
+        case SD_OP_CLOSE:
+            session_part_close(req.slot);
+            break;
+        case SD_OP_OPEN:
+            if (session_part_open(req.slot, req.part) != 0)
+            {
+                /* Its writes fail until the next part takes over */
+                sd_stats.errors++;
+            }
+            break;
+        case SD_OP_PREPARE:
+            if (session_part_open(req.slot, req.part) == 0)
+            {
+                atomic_set(&session_next_ready, 1);
+            }
+            break;
+        case SD_OP_DISCARD:
+            if (p->open)
+            {
+                fs_close(&p->file);
+                p->open = false;
+                fs_unlink(p->path);
+            }
+            break;
+        case SD_OP_CATALOG:
+            session_catalog_commit(session_root, session_parts_closed, session_bytes);
+            if (session_on_nor)
+            {
+                nor_store_session_added();
+            }
+            break;
+        }
+
+        /* Part changes are committed right away, data at least every SESSION_JOURNAL_MS */
+        if (req.op != SD_OP_WRITE || k_uptime_get() - journal_at >= SESSION_JOURNAL_MS)
+        {
+            session_journal_update(!req.last);
+            journal_at = k_uptime_get();
+            journal_due = false;
+        }
+        else
+        {
+            journal_due = true;
+        }
+
+        if (req.last)
+        {
+            atomic_clear(&session_next_ready);
+            atomic_clear(&session_file_open);
         }
     }
 }
+
+static int cmd_hub_sd(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    uint32_t writes = sd_stats.writes;
+
+    shell_print(sh, "%u buffers of %u bytes, %u free", SD_WRITE_BUF_COUNT, SD_WRITE_BUF_SIZE,
+                k_sem_count_get(&sd_write_free));
+    shell_print(sh, "writes %u, bytes %llu, errors %u", writes, sd_stats.bytes,
+                sd_stats.errors);
+    if (writes > 0)
+    {
+        shell_print(sh, "bytes per write: avg %llu, min %u", sd_stats.bytes / writes,
+                    sd_stats.min_bytes);
+        shell_print(sh, "flush latency: avg %llu us, max %u us",
+                    k_cyc_to_us_floor64(sd_stats.cycles) / writes,
+                    k_cyc_to_us_floor32(sd_stats.max_cycles));
+    }
+    shell_print(sh, "buffer stalls %u, dropped bytes %u", sd_stats.stalls, sd_stats.dropped);
+    shell_print(sh, "staging: %u of %u bytes waiting, high water %u (%u%%)",
+                (uint32_t)sd_stage_used(), (uint32_t)sd_stage_size(),
+                (uint32_t)sd_stage_high_water(),
+                (uint32_t)(sd_stage_high_water() * 100 / sd_stage_size()));
+    shell_print(sh, "parts of %u KiB / %u s: current %u, rotations %u, not preallocated %u",
+                CONFIG_APP_SESSION_FILE_SIZE_KB, CONFIG_APP_SESSION_FILE_SECONDS, sd_cur_part,
+                sd_stats.rotations, sd_stats.not_prealloc);
+    shell_print(sh, "longest part close %u us", sd_stats.max_close_us);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), sd, NULL, "SD write buffer counters", cmd_hub_sd, 1, 0);
@@ -3,14 +3,49 @@
 
 #include <zephyr/fs/fs.h>
 #include "can/can_rx_types.h"
+#include "sensors/sensor_registry.h"
+#include "session_log.h"
+/* Session files are <base>_NN.bin, NN counting the parts from 00 */
+#define SESSION_PATH_MAX 40
+#define SESSION_PART_PATH_FMT "%s_%02u.bin"
+/* Mount points sessions are written under */
+#define SESSION_ROOT_SD "/SD:"
+#define SESSION_ROOT_NOR "/nor"
+
 int init_sdcard(void);
-void write_to_session_file(char *csv_formatted_text, size_t length);
-void write_vl_to_session_file(sample_sensor1_t *vl_samples, uint8_t num);
-void write_ads_to_session_file(sample_sensor2_t *ads_samples, uint8_t num);
-void write_sdp_to_session_file(sample_sensor3_t *sdp_samples, uint8_t num);
-void write_bhi_to_session_file(sample_sensor4_t *bhi_samples, uint8_t num);
-void sd_writer_thread_func(void *arg1, void *arg2, void *arg3);
+/*
+ * Where the next session goes: the card if it is mounted, else the QSPI
+ * flash (nor_store.h). NULL if neither is there.
+ */
+const char *session_storage_root(void);
+/*
+ * Start a session file, the SD writer opens and preallocates the first part
+ * <base>_00.bin. -EBUSY while the last session is still closing.
+ */
+int open_session_file(const char *base);
+/* Drop the session file, only before anything was written */
+void close_session_file(void);
 
-extern struct fs_file_t session_file;
+/*
+ * Buffered output to the open session file. One thread at a time: session
+ * start, then the sample pipeline.
+ */
+/* Append to the write buffers, -ENOMEM if even the staging FIFO is full and the data was dropped */
+int session_file_write(const void *data, size_t len);
+/* Hand over whole sectors that have waited too long, call regularly */
+void session_file_poll(void);
+/* True once the current part is full or old enough and the next one is ready */
+bool session_file_rotate_due(size_t len);
+/* Go on in the next part, the writer closes the old one. Returns the new part number */
+int session_file_rotate(void);
+/*
+ * Write out the rest, close the file once it is on the card and add it to
+ * the catalog. -EAGAIN while staged data still waits for the writer, call
+ * again later.
+ */
+int session_file_finish(void);
+/* Append the samples published since the last call, pipeline thread only */
+void session_file_sink_poll(void);
+void sd_writer_thread_func(void *arg1, void *arg2, void *arg3);
 
 #endif // SDCARD_MODULE_H
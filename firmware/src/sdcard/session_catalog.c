@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include "session_catalog.h"
+#include "sdcard_module.h"
+#include "ble/crc/crc16_koopman.h"
+
+#define SESSION_CATALOG_PATH_MAX 32
+/* Entries looked at from the end for the last session id */
+#define SESSION_CATALOG_TAIL 4
+/* Entries per read in the shell listing */
+#define SESSION_CATALOG_CHUNK 4
+
+BUILD_ASSERT(sizeof(struct session_catalog_entry) == 128, "catalog entry size is on-disk layout");
+
+/* Entry of the running session */
+static struct session_catalog_entry catalog_pending;
+/* Set from begin until the entry is written or dropped */
+static atomic_t catalog_busy;
+
+/* Entries in the catalog on the card */
+static uint32_t catalog_count;
+/* Ids are taken by a session start and by the SD writer moving sessions */
+static struct k_spinlock catalog_id_lock;
+static uint32_t catalog_next_id = 1;
+static uint32_t catalog_errors;
+
+static bool session_catalog_valid(const struct session_catalog_entry *entry)
+{
+    return sys_le16_to_cpu(entry->magic) == SESSION_CATALOG_MAGIC &&
+           entry->version == SESSION_CATALOG_VERSION &&
+           crc16_koopman((const uint8_t *)entry, offsetof(struct session_catalog_entry, crc)) ==
+               sys_le16_to_cpu(entry->crc);
+}
+
+/* No id below @p id is handed out any more */
+static void session_catalog_raise_id(uint32_t id)
+{
+    k_spinlock_key_t key = k_spin_lock(&catalog_id_lock);
+
+    catalog_next_id = MAX(catalog_next_id, id);
+    k_spin_unlock(&catalog_id_lock, key);
+}
+
+static void session_catalog_path(const char *root, char *path)
+{
+    snprintf(path, SESSION_CATALOG_PATH_MAX, "%s/%s", root, SESSION_CATALOG_FILE);
+}
+
+/* Whole entries in the catalog under root, 0 if there is none */
+static uint32_t session_catalog_entries(const char *root)
+{
+    char path[SESSION_CATALOG_PATH_MAX];
+    struct fs_dirent entry;
+
+    session_catalog_path(root, path);
+    if (fs_stat(path, &entry) != 0)
+    {
+        return 0;
+    }
+    /* A partial entry at the end is overwritten by the next append */
+    return entry.size / sizeof(struct session_catalog_entry);
+}
+
+int session_catalog_read_from(const char *root, uint32_t first,
+                              struct session_catalog_entry *entries, size_t max)
+{
+    char path[SESSION_CATALOG_PATH_MAX];
+    struct fs_file_t file;
+    ssize_t len;
+    int num = 0;
+    int ret;
+
+    session_catalog_path(root, path);
+    fs_file_t_init(&file);
+    ret = fs_open(&file, path, FS_O_READ);
+    if (ret != 0)
+    {
+        /* No catalog yet is an empty one */
+        return ret == -ENOENT ? 0 : ret;
+    }
+
+    ret = fs_seek(&file, (off_t)first * sizeof(*entries), FS_SEEK_SET);
+    len = ret == 0 ? fs_read(&file, entries, max * sizeof(*entries)) : ret;
+    fs_close(&file);
+    if (len < 0)
+    {
+        return len;
+    }
+
+    /* Torn entries of a power loss are left out */
+    for (size_t i = 0; i < len / sizeof(*entries); i++)
+    {
+        if (session_catalog_valid(&entries[i]))
+        {
+            entries[num++] = entries[i];
+        }
+    }
+    return num;
+}
+
+int session_catalog_read(uint32_t first, struct session_catalog_entry *entries, size_t max)
+{
+    return session_catalog_read_from(SESSION_ROOT_SD, first, entries, max);
+}
+
+int session_catalog_load(const char *root)
+{
+    static struct session_catalog_entry tail[SESSION_CATALOG_TAIL];
+    uint32_t count = session_catalog_entries(root);
+    uint32_t first;
+    int num;
+
+    if (strcmp(root, SESSION_ROOT_SD) == 0)
+    {
+        catalog_count = count;
+    }
+    session_catalog_raise_id(count + 1);
+    first = count > SESSION_CATALOG_TAIL ? count - SESSION_CATALOG_TAIL : 0;
+
+    num = session_catalog_read_from(root, first, tail, ARRAY_SIZE(tail));
+    if (num < 0)
+    {
+        printk("Session catalog read failed [%d]\n", num);
+        return num;
+    }
+    for (int i = 0; i < num; i++)
+    {
+        session_catalog_raise_id(sys_le32_to_cpu(tail[i].session_id) + 1);
+    }
+    printk("Session catalog %s: %u sessions, next id %u\n", root, count, catalog_next_id);
+    return count;
+}
+
+int session_catalog_begin(const char *instructor_id, const char *trainee_id,
+                          const char *start_time)
+{
+    struct session_catalog_entry *e = &catalog_pending;
+    uint32_t id;
+
+    if (!atomic_cas(&catalog_busy, 0, 1))
+    {
+        return -EBUSY;
+    }
+    id = session_catalog_reserve_id();
+
+    memset(e, 0, sizeof(*e));
+    e->magic = sys_cpu_to_le16(SESSION_CATALOG_MAGIC);
+    e->version = SESSION_CATALOG_VERSION;
+    e->session_id = sys_cpu_to_le32(id);
+    strncpy(e->instructor_id, instructor_id, sizeof(e->instructor_id));
+    strncpy(e->trainee_id, trainee_id, sizeof(e->trainee_id));
+    strncpy(e->start_time, start_time, sizeof(e->start_time));
+    e->start_uptime_ms = sys_cpu_to_le32(k_uptime_get_32());
+    return id;
+}
+
+void session_catalog_abort(void)
+{
+    uint32_t id = sys_le32_to_cpu(catalog_pending.session_id);
+    k_spinlock_key_t key = k_spin_lock(&catalog_id_lock);
+
+    /* The id goes back unless another one was taken since */
+    if (catalog_next_id == id + 1)
+    {
+        catalog_next_id = id;
+    }
+    k_spin_unlock(&catalog_id_lock, key);
+    atomic_clear(&catalog_busy);
+}
+
+void session_catalog_set_records(const struct session_catalog_stream *streams,
+                                 uint8_t num_streams, uint16_t dropped_blocks)
+{
+    struct session_catalog_entry *e = &catalog_pending;
+    uint32_t records = 0;
+
+    num_streams = MIN(num_streams, SESSION_CATALOG_STREAMS);
+    for (uint8_t i = 0; i < num_streams; i++)
+    {
+        e->streams[i].stream_id = streams[i].stream_id;
+        e->streams[i].lost = sys_cpu_to_le16(streams[i].lost);
+        e->streams[i].records = sys_cpu_to_le32(streams[i].records);
+        records += streams[i].records;
+    }
+    e->num_streams = num_streams;
+    e->records = sys_cpu_to_le32(records);
+    e->dropped_blocks = sys_cpu_to_le16(dropped_blocks);
+    e->duration_ms = sys_cpu_to_le32(k_uptime_get_32() - sys_le32_to_cpu(e->start_uptime_ms));
+    e->flags |= SESSION_CATALOG_COMPLETE;
+}
+
+const struct session_catalog_entry *session_catalog_pending(void)
+{
+    return &catalog_pending;
+}
+
+int session_catalog_append(const char *root, struct session_catalog_entry *e)
+{
+    char path[SESSION_CATALOG_PATH_MAX];
+    uint32_t index = session_catalog_entries(root);
+    struct fs_file_t file;
+    ssize_t written = -EIO;
+    int ret;
+
+    e->crc = sys_cpu_to_le16(
+        crc16_koopman((const uint8_t *)e, offsetof(struct session_catalog_entry, crc)));
+
+    /* Entries never cross a sector, the append is one sector write */
+    session_catalog_path(root, path);
+    fs_file_t_init(&file);
+    ret = fs_open(&file, path, FS_O_CREATE | FS_O_WRITE);
+    if (ret == 0)
+    {
+        ret = fs_seek(&file, (off_t)index * sizeof(*e), FS_SEEK_SET);
+        if (ret == 0)
+        {
+            written = fs_write(&file, e, sizeof(*e));
+        }
+        ret = fs_close(&file);
+    }
+
+    if (written != sizeof(*e) || ret != 0)
+    {
+        catalog_errors++;
+        printk("Session catalog write failed [%d]\n", written < 0 ? (int)written : ret);
+        return written < 0 ? (int)written : (ret != 0 ? ret : -EIO);
+    }
+
+    if (strcmp(root, SESSION_ROOT_SD) == 0)
+    {
+        catalog_count = index + 1;
+    }
+    session_catalog_raise_id(sys_le32_to_cpu(e->session_id) + 1);
+    return 0;
+}
+
+void session_catalog_commit(const char *root, uint8_t parts, uint32_t bytes)
+{
+    struct session_catalog_entry *e = &catalog_pending;
+
+    e->parts = parts;
+    e->bytes = sys_cpu_to_le32(bytes);
+    session_catalog_append(root, e);
+    atomic_clear(&catalog_busy);
+}
+
+int session_catalog_format(const struct session_catalog_entry *e, char *buf, size_t len)
+{
+    return snprintf(buf, len, "%u,%.*s,%u,%.*s,%.*s,%u,%u,%u,%u",
+                    sys_le32_to_cpu(e->session_id), (int)sizeof(e->start_time), e->start_time,
+                    sys_le32_to_cpu(e->duration_ms) / 1000, (int)sizeof(e->instructor_id),
+                    e->instructor_id, (int)sizeof(e->trainee_id), e->trainee_id, e->parts,
+                    sys_le32_to_cpu(e->bytes), sys_le32_to_cpu(e->records), e->flags);
+}
+
+uint32_t session_catalog_count(void)
+{
+    return catalog_count;
+}
+
+uint32_t session_catalog_reserve_id(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&catalog_id_lock);
+    uint32_t id = catalog_next_id++;
+
+    k_spin_unlock(&catalog_id_lock, key);
+    return id;
+}
+
+static int cmd_hub_sessions(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    static struct session_catalog_entry entries[SESSION_CATALOG_CHUNK];
+    char line[128];
+
+    shell_print(sh, "%u sessions, next id %u, write errors %u", catalog_count, catalog_next_id,
+                catalog_errors);
+    shell_print(sh, "id,start,duration_s,instructor,trainee,parts,bytes,records,flags");
+    for (uint32_t first = 0; first < catalog_count; first += ARRAY_SIZE(entries))
+    {
+        int num = session_catalog_read(first, entries, ARRAY_SIZE(entries));
+
+        if (num < 0)
+        {
+            shell_error(sh, "read failed [%d]", num);
+            return num;
+        }
+        for (int i = 0; i < num; i++)
+        {
+            session_catalog_format(&entries[i], line, sizeof(line));
+            shell_print(sh, "%s", line);
+        }
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), sessions, NULL, "List the sessions on the SD card", cmd_hub_sessions, 1, 0);
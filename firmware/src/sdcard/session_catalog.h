@@ -0,0 +1,97 @@
+#ifndef SESSION_CATALOG_H
+#define SESSION_CATALOG_H
+#include <stddef.h>
+#include <stdint.h>
+#include "session_log_format.h"
+
+/*
+ * Catalog of the sessions on the card, see struct session_catalog_entry.
+ *
+ * A session fills in its entry as it goes: the ids and start time at the
+ * start, the record counts once the log stopped, the file extent on the SD
+ * writer thread once the last part is closed. Only then is the entry
+ * appended in one write and synced, so the catalog only lists sessions
+ * whose files are complete.
+ *
+ * Every storage root (SESSION_ROOT_SD, SESSION_ROOT_NOR) has its own
+ * catalog next to its session files. Ids only count on within the catalogs
+ * mounted so far: a card that was never in this hub may hold the same ids
+ * as the flash, so a session moved to the card gets a new id there.
+ */
+
+/**
+ * @brief Take the catalog under @p root into account for the next session id
+ *
+ * SD writer thread after the mount of @p root.
+ *
+ * @return Entries in that catalog, negative on error
+ */
+int session_catalog_load(const char *root);
+
+/**
+ * @brief Start the entry of a new session, taking the next session id
+ *
+ * @return Session id, -EBUSY while the entry of the last session is not
+ *         written yet
+ */
+int session_catalog_begin(const char *instructor_id, const char *trainee_id,
+                          const char *start_time);
+
+/**
+ * @brief Forget the entry, the session did not start
+ */
+void session_catalog_abort(void);
+
+/**
+ * @brief Record counts of the session, pipeline thread once the log stopped
+ */
+void session_catalog_set_records(const struct session_catalog_stream *streams,
+                                 uint8_t num_streams, uint16_t dropped_blocks);
+
+/**
+ * @brief Append the entry to the catalog under @p root, SD writer thread
+ *        after the last part is closed
+ */
+void session_catalog_commit(const char *root, uint8_t parts, uint32_t bytes);
+
+/**
+ * @brief Entry of the running session as filled in so far
+ */
+const struct session_catalog_entry *session_catalog_pending(void);
+
+/**
+ * @brief Append a finished entry to the catalog under @p root
+ *
+ * For sessions restored after a power loss or moved between roots.
+ */
+int session_catalog_append(const char *root, struct session_catalog_entry *entry);
+
+/**
+ * @brief Read up to @p max entries of the catalog under @p root starting at
+ *        entry @p first
+ *
+ * @return Number of entries read, negative on error
+ */
+int session_catalog_read_from(const char *root, uint32_t first,
+                              struct session_catalog_entry *entries, size_t max);
+
+/* Same for the catalog on the card */
+int session_catalog_read(uint32_t first, struct session_catalog_entry *entries, size_t max);
+
+/**
+ * @brief Format an entry as a CSV line without line end
+ *
+ * id,start_time,duration_s,instructor,trainee,parts,bytes,records,flags
+ */
+int session_catalog_format(const struct session_catalog_entry *entry, char *buf, size_t len);
+
+/* Entries in the catalog on the card */
+uint32_t session_catalog_count(void);
+
+/**
+ * @brief Take the next session id for a session that is not begun here,
+ *        from any thread
+ */
+uint32_t session_catalog_reserve_id(void);
+
+#endif /* SESSION_CATALOG_H */
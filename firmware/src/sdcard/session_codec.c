@@ -0,0 +1,227 @@
+#include <string.h>
+#include "session_codec.h"
+
+/* stream_id and frame_id in front of the fields */
+#define RECORD_HEADER_LEN 5
+
+static uint8_t field_width(uint8_t type)
+{
+    switch (type)
+    {
+    case SESSION_LOG_FIELD_U8:
+        return 1;
+    case SESSION_LOG_FIELD_U16:
+        return 2;
+    case SESSION_LOG_FIELD_FLOAT:
+    case SESSION_LOG_FIELD_U32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static uint32_t get_le(const uint8_t *p, uint8_t width)
+{
+    uint32_t v = 0;
+
+    for (uint8_t i = 0; i < width; i++)
+    {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static void put_le(uint8_t *p, uint32_t v, uint8_t width)
+{
+    for (uint8_t i = 0; i < width; i++)
+    {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+/* Small changes either way give small numbers: 0, -1, 1, -2 -> 0, 1, 2, 3 */
+static uint32_t zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static uint32_t unzigzag(uint32_t v)
+{
+    return (v >> 1) ^ (uint32_t)-(int32_t)(v & 1);
+}
+
+static size_t put_varint(uint8_t *out, uint32_t v)
+{
+    size_t len = 0;
+
+    while (v >= 0x80)
+    {
+        out[len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[len++] = (uint8_t)v;
+    return len;
+}
+
+/* Returns the bytes taken, 0 if the varint runs past len */
+static size_t get_varint(const uint8_t *in, size_t len, uint32_t *v)
+{
+    uint32_t result = 0;
+
+    for (size_t i = 0; i < len && i < SESSION_CODEC_VARINT_MAX; i++)
+    {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0)
+        {
+            *v = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static struct session_codec_stream *find_stream(struct session_codec *codec, uint8_t stream_id)
+{
+    for (uint8_t i = 0; i < codec->num_streams; i++)
+    {
+        if (codec->streams[i].stream_id == stream_id)
+        {
+            return &codec->streams[i];
+        }
+    }
+    return NULL;
+}
+
+void session_codec_init(struct session_codec *codec)
+{
+    memset(codec, 0, sizeof(*codec));
+}
+
+int session_codec_add_stream(struct session_codec *codec, uint8_t stream_id,
+                             uint8_t record_size, uint8_t num_fields,
+                             const struct session_log_field *fields)
+{
+    struct session_codec_stream *s;
+    size_t max_len = 1 + SESSION_CODEC_VARINT_MAX;
+
+    if (codec->num_streams >= SESSION_CODEC_STREAMS || num_fields > SESSION_CODEC_FIELDS ||
+        record_size < RECORD_HEADER_LEN || find_stream(codec, stream_id) != NULL)
+    {
+        return -1;
+    }
+
+    s = &codec->streams[codec->num_streams];
+    memset(s, 0, sizeof(*s));
+    for (uint8_t i = 0; i < num_fields; i++)
+    {
+        uint8_t width = field_width(fields[i].type);
+
+        if (width == 0 || fields[i].offset < RECORD_HEADER_LEN ||
+            fields[i].offset + width > record_size)
+        {
+            return -1;
+        }
+        s->type[i] = fields[i].type;
+        s->offset[i] = fields[i].offset;
+        /* A change of the full width takes one bit more than the width */
+        max_len += (8 * width + 1 + 6) / 7;
+    }
+    s->stream_id = stream_id;
+    s->record_size = record_size;
+    s->num_fields = num_fields;
+    s->max_len = (uint8_t)max_len;
+    codec->num_streams++;
+    return 0;
+}
+
+void session_codec_reset(struct session_codec *codec)
+{
+    for (uint8_t i = 0; i < codec->num_streams; i++)
+    {
+        struct session_codec_stream *s = &codec->streams[i];
+
+        /* The first frame id of a block is coded as is */
+        s->frame_id = UINT32_MAX;
+        memset(s->value, 0, sizeof(s->value));
+    }
+}
+
+size_t session_codec_max_len(const struct session_codec *codec, uint8_t stream_id)
+{
+    struct session_codec_stream *s = find_stream((struct session_codec *)codec, stream_id);
+
+    return s != NULL ? s->max_len : 0;
+}
+
+size_t session_codec_encode(struct session_codec *codec, const uint8_t *record, uint8_t *out)
+{
+    struct session_codec_stream *s = find_stream(codec, record[0]);
+    uint32_t frame_id;
+    size_t len = 0;
+
+    if (s == NULL)
+    {
+        return 0;
+    }
+
+    out[len++] = s->stream_id;
+    frame_id = get_le(&record[1], 4);
+    len += put_varint(&out[len], zigzag(frame_id - s->frame_id - 1));
+    s->frame_id = frame_id;
+
+    for (uint8_t i = 0; i < s->num_fields; i++)
+    {
+        uint8_t width = field_width(s->type[i]);
+        uint32_t v = get_le(&record[s->offset[i]], width);
+
+        len += put_varint(&out[len], zigzag(v - s->value[i]));
+        s->value[i] = v;
+    }
+    return len;
+}
+
+size_t session_codec_decode(struct session_codec *codec, const uint8_t *in, size_t len,
+                            uint8_t *record, size_t record_max)
+{
+    struct session_codec_stream *s;
+    size_t pos = 1;
+    size_t n;
+    uint32_t v;
+
+    if (len == 0 || (s = find_stream(codec, in[0])) == NULL || s->record_size > record_max)
+    {
+        return 0;
+    }
+
+    n = get_varint(&in[pos], len - pos, &v);
+    if (n == 0)
+    {
+        return 0;
+    }
+    pos += n;
+    s->frame_id += unzigzag(v) + 1;
+
+    memset(record, 0, s->record_size);
+    record[0] = s->stream_id;
+    put_le(&record[1], s->frame_id, 4);
+
+    for (uint8_t i = 0; i < s->num_fields; i++)
+    {
+        uint8_t width = field_width(s->type[i]);
+
+        n = get_varint(&in[pos], len - pos, &v);
+        if (n == 0)
+        {
+            return 0;
+        }
+        pos += n;
+        s->value[i] += unzigzag(v);
+        /* Changes wrap like the narrow field does */
+        if (width < 4)
+        {
+            s->value[i] &= (1u << (8 * width)) - 1;
+        }
+        put_le(&record[s->offset[i]], s->value[i], width);
+    }
+    return pos;
+}
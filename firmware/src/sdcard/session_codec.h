@@ -0,0 +1,85 @@
+#ifndef SESSION_CODEC_H
+#define SESSION_CODEC_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "session_log_format.h"
+
+/*
+ * Delta codec of SESSION_LOG_BLOCK_DELTA, see session_log_format.h. Shared
+ * with tools/session_decode, so plain C and no Zephyr headers.
+ *
+ * Every record is coded against the last record of its stream in the same
+ * block: the stream id as is, then the frame id step less one and every
+ * field's change as zig-zag varints. Floats change as the integer of their
+ * bits, which keeps the codec lossless. session_codec_reset() at the start
+ * of each block makes every block decode on its own.
+ */
+
+#define SESSION_CODEC_STREAMS 8
+#define SESSION_CODEC_FIELDS 16
+/* Longest varint of a 32 bit value */
+#define SESSION_CODEC_VARINT_MAX 5
+
+struct session_codec_stream
+{
+    uint8_t stream_id;
+    uint8_t record_size;
+    uint8_t num_fields;
+    uint8_t max_len; /* longest coded record */
+    uint8_t type[SESSION_CODEC_FIELDS];
+    uint8_t offset[SESSION_CODEC_FIELDS];
+
+    /* Last record in the block */
+    uint32_t frame_id;
+    uint32_t value[SESSION_CODEC_FIELDS];
+};
+
+struct session_codec
+{
+    uint8_t num_streams;
+    struct session_codec_stream streams[SESSION_CODEC_STREAMS];
+};
+
+/* Forget all streams */
+void session_codec_init(struct session_codec *codec);
+
+/**
+ * @brief Add a stream as described in the header block
+ *
+ * @return 0, -1 if there is no room or a field is outside the record
+ */
+int session_codec_add_stream(struct session_codec *codec, uint8_t stream_id,
+                             uint8_t record_size, uint8_t num_fields,
+                             const struct session_log_field *fields);
+
+/* Start of a block */
+void session_codec_reset(struct session_codec *codec);
+
+/**
+ * @brief Longest coded record of a stream, 0 if the stream is unknown
+ */
+size_t session_codec_max_len(const struct session_codec *codec, uint8_t stream_id);
+
+/**
+ * @brief Code one record, it starts with its stream id
+ *
+ * @p out needs room for session_codec_max_len() bytes.
+ *
+ * @return Bytes written, 0 if the stream is unknown
+ */
+size_t session_codec_encode(struct session_codec *codec, const uint8_t *record, uint8_t *out);
+
+/**
+ * @brief Decode one record from @p in into its raw layout at @p record
+ *
+ * @p record needs room for the record size of the stream, bytes outside
+ * the header and the fields are zero.
+ *
+ * @return Bytes taken from @p in, 0 if the stream is unknown or the record
+ *         is cut short
+ */
+size_t session_codec_decode(struct session_codec *codec, const uint8_t *in, size_t len,
+                            uint8_t *record, size_t record_max);
+
+#endif /* SESSION_CODEC_H */
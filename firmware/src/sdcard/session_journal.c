@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/fs/fs.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include "session_journal.h"
+#include "session_catalog.h"
+#include "sdcard_module.h"
+#include "ble/crc/crc16_koopman.h"
+
+#define SESSION_JOURNAL_PATH_MAX 32
+#define SESSION_JOURNAL_MAGIC 0x4A53 /* "SJ" */
+#define SESSION_JOURNAL_VERSION 1
+#define SESSION_JOURNAL_SECTOR 512
+/* Tail of a part searched for the last whole block, fits the largest block twice */
+#define SESSION_JOURNAL_SCAN 2048
+
+struct __attribute__((__packed__)) session_journal_record
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t active;
+    uint32_t seq; /* the higher of the two valid records is current */
+    char base[SESSION_PATH_MAX];
+    uint8_t parts_closed;
+    uint8_t reserved[3];
+    uint32_t bytes_closed;
+    struct session_journal_part parts[2];
+    struct session_catalog_entry entry;
+    uint16_t crc;
+};
+
+BUILD_ASSERT(sizeof(struct session_journal_record) <= SESSION_JOURNAL_SECTOR);
+
+/* Whole sectors, the card never sees a read-modify-write of a record */
+static uint8_t journal_buf[SESSION_JOURNAL_SECTOR] __aligned(32);
+static uint8_t journal_scan[SESSION_JOURNAL_SCAN];
+static struct fs_file_t journal_file;
+static bool journal_open;
+static const char *journal_root;
+static uint32_t journal_seq;
+/* Newest valid record found when the journal was opened */
+static struct session_journal_record journal_last;
+static bool journal_found;
+
+static uint32_t stat_commits;
+static uint32_t stat_errors;
+static uint32_t stat_max_us;
+static uint32_t stat_recovered;
+
+static bool session_journal_valid(const struct session_journal_record *rec)
+{
+    return sys_le16_to_cpu(rec->magic) == SESSION_JOURNAL_MAGIC &&
+           rec->version == SESSION_JOURNAL_VERSION &&
+           crc16_koopman((const uint8_t *)rec, offsetof(struct session_journal_record, crc)) ==
+               sys_le16_to_cpu(rec->crc);
+}
+
+/* Switch to the journal under root and find its newest record */
+static int session_journal_open(const char *root)
+{
+    struct session_journal_record *rec = (struct session_journal_record *)journal_buf;
+    char path[SESSION_JOURNAL_PATH_MAX];
+    int ret;
+
+    if (journal_open && strcmp(journal_root, root) == 0)
+    {
+        return 0;
+    }
+    if (journal_open)
+    {
+        fs_close(&journal_file);
+        journal_open = false;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", root, SESSION_JOURNAL_FILE);
+    fs_file_t_init(&journal_file);
+    ret = fs_open(&journal_file, path, FS_O_CREATE | FS_O_RDWR);
+    if (ret != 0)
+    {
+        printk("Failed to open the session journal %s [%d]\n", path, ret);
+        return ret;
+    }
+    journal_open = true;
+    journal_root = root;
+    journal_found = false;
+    journal_seq = 0;
+
+    for (off_t offset = 0; offset < 2 * SESSION_JOURNAL_SECTOR; offset += SESSION_JOURNAL_SECTOR)
+    {
+        if (fs_seek(&journal_file, offset, FS_SEEK_SET) != 0 ||
+            fs_read(&journal_file, journal_buf, sizeof(journal_buf)) != sizeof(journal_buf) ||
+            !session_journal_valid(rec))
+        {
+            continue;
+        }
+        if (!journal_found || sys_le32_to_cpu(rec->seq) > sys_le32_to_cpu(journal_last.seq))
+        {
+            journal_last = *rec;
+            journal_found = true;
+        }
+    }
+    if (journal_found)
+    {
+        journal_seq = sys_le32_to_cpu(journal_last.seq);
+    }
+    return 0;
+}
+
+static int session_journal_write(struct session_journal_record *rec)
+{
+    off_t offset;
+    int ret;
+
+    journal_seq++;
+    rec->magic = sys_cpu_to_le16(SESSION_JOURNAL_MAGIC);
+    rec->version = SESSION_JOURNAL_VERSION;
+    rec->seq = sys_cpu_to_le32(journal_seq);
+    rec->crc = sys_cpu_to_le16(
+        crc16_koopman((const uint8_t *)rec, offsetof(struct session_journal_record, crc)));
+
+    /* Never overwrite the last good record */
+    offset = (journal_seq & 1) * SESSION_JOURNAL_SECTOR;
+    ret = fs_seek(&journal_file, offset, FS_SEEK_SET);
+    if (ret == 0)
+    {
+        ret = fs_write(&journal_file, journal_buf, sizeof(journal_buf));
+        ret = ret == sizeof(journal_buf) ? fs_sync(&journal_file) : -EIO;
+    }
+    return ret;
+}
+
+int session_journal_commit(const struct session_journal_state *state)
+{
+    struct session_journal_record *rec = (struct session_journal_record *)journal_buf;
+    uint32_t start = k_cycle_get_32();
+    int ret;
+
+    /* The journal goes with the session, an idle record to the last one */
+    if (state->active)
+    {
+        session_journal_open(state->root);
+    }
+    if (!journal_open)
+    {
+        return -EBADF;
+    }
+
+    memset(journal_buf, 0, sizeof(journal_buf));
+    rec->active = state->active;
+    if (state->active)
+    {
+        strncpy(rec->base, state->base, sizeof(rec->base) - 1);
+        rec->parts_closed = state->parts_closed;
+        rec->bytes_closed = sys_cpu_to_le32(state->bytes_closed);
+        for (size_t i = 0; i < ARRAY_SIZE(rec->parts); i++)
+        {
+            rec->parts[i] = state->parts[i];
+            rec->parts[i].durable = sys_cpu_to_le32(state->parts[i].durable);
+        }
+        rec->entry = *session_catalog_pending();
+    }
+
+    ret = session_journal_write(rec);
+    if (ret != 0)
+    {
+        stat_errors++;
+        return ret;
+    }
+    stat_commits++;
+    stat_max_us = MAX(stat_max_us, k_cyc_to_us_floor32(k_cycle_get_32() - start));
+    return 0;
+}
+
+/*
+ * Find the end of the last whole block at or before len. The tail is read
+ * in one go and searched forwards, a CRC match marks a real block.
+ */
+static uint32_t session_journal_last_block(struct fs_file_t *file, uint32_t len,
+                                           uint32_t *time_ms)
+{
+    const size_t hdr_len = sizeof(struct session_log_block_header);
+    uint32_t from = len > sizeof(journal_scan) ? len - sizeof(journal_scan) : 0;
+    uint32_t end = from;
+    ssize_t got;
+
+    if (fs_seek(file, from, FS_SEEK_SET) != 0)
+    {
+        return from;
+    }
+    got = fs_read(file, journal_scan, len - from);
+    if (got < 0)
+    {
+        return from;
+    }
+
+    for (size_t pos = 0; pos + hdr_len + SESSION_LOG_CRC_LEN <= (size_t)got;)
+    {
+        const uint8_t *b = &journal_scan[pos];
+        uint16_t blen = sys_get_le16(&b[offsetof(struct session_log_block_header, len)]);
+
+        if (sys_get_le16(b) != SESSION_LOG_SYNC ||
+            pos + hdr_len + blen + SESSION_LOG_CRC_LEN > (size_t)got ||
+            crc16_koopman(b, hdr_len + blen) != sys_get_le16(&b[hdr_len + blen]))
+        {
+            pos++;
+            continue;
+        }
+        *time_ms = sys_get_le32(&b[offsetof(struct session_log_block_header, time_ms)]);
+        pos += hdr_len + blen + SESSION_LOG_CRC_LEN;
+        end = from + pos;
+    }
+    return end;
+}
+
+static void session_journal_replay(const char *root, const struct session_journal_record *rec)
+{
+    struct session_catalog_entry entry = rec->entry;
+    uint32_t bytes = sys_le32_to_cpu(rec->bytes_closed);
+    uint8_t parts = rec->parts_closed;
+    uint32_t time_ms = 0;
+    char path[SESSION_PATH_MAX + 8];
+
+    printk("Recovering session %u (%s)\n", sys_le32_to_cpu(entry.session_id), rec->base);
+
+    for (size_t i = 0; i < ARRAY_SIZE(rec->parts); i++)
+    {
+        struct session_journal_part jp = rec->parts[i];
+        uint32_t durable = sys_le32_to_cpu(jp.durable);
+        struct fs_file_t file;
+        uint32_t end;
+
+        if (!jp.open)
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), SESSION_PART_PATH_FMT, rec->base, jp.part);
+        if (durable == 0)
+        {
+            /* Prepared but never written */
+            fs_unlink(path);
+            continue;
+        }
+
+        fs_file_t_init(&file);
+        if (fs_open(&file, path, FS_O_RDWR) != 0)
+        {
+            printk("%s is gone\n", path);
+            continue;
+        }
+        end = session_journal_last_block(&file, durable, &time_ms);
+        fs_truncate(&file, end);
+        fs_close(&file);
+        printk("%s: kept %u of %u durable bytes\n", path, end, durable);
+
+        bytes += end;
+        parts = MAX(parts, jp.part + 1);
+    }
+
+    entry.flags = (entry.flags & ~SESSION_CATALOG_COMPLETE) | SESSION_CATALOG_RECOVERED;
+    entry.parts = parts;
+    entry.bytes = sys_cpu_to_le32(bytes);
+    if (sys_le32_to_cpu(entry.duration_ms) == 0)
+    {
+        /* Time of the last block that made it */
+        entry.duration_ms = sys_cpu_to_le32(time_ms);
+    }
+    /* A session is journaled under the root its parts are on */
+    session_catalog_append(root, &entry);
+    stat_recovered++;
+}
+
+int session_journal_recover(const char *root)
+{
+    int ret = session_journal_open(root);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+    if (!journal_found)
+    {
+        return 0;
+    }
+
+    if (journal_last.active)
+    {
+        session_journal_replay(root, &journal_last);
+        /* Done with it, a second power loss must not add it twice */
+        struct session_journal_state idle = {.active = false};
+
+        session_journal_commit(&idle);
+    }
+    return 0;
+}
+
+static int cmd_hub_journal(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "commits %u, errors %u, longest %u us, sessions recovered %u", stat_commits,
+                stat_errors, stat_max_us, stat_recovered);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), journal, NULL, "Session journal counters", cmd_hub_journal, 1, 0);
@@ -0,0 +1,60 @@
+#ifndef SESSION_JOURNAL_H
+#define SESSION_JOURNAL_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Power-loss journal of the running session, SESSION_JOURNAL_FILE under
+ * the storage root the session is written to.
+ *
+ * The SD writer commits the state of the session at least every
+ * SESSION_JOURNAL_MS while data is written and on every part change: the
+ * part files are synced first, then a record with the durable length of
+ * every open part and the catalog entry so far is written. Records go to
+ * two sectors in turn, a torn write leaves the other one intact. The parts
+ * are preallocated, so a sync only writes back the last sector and the
+ * directory entry and a commit takes a bounded time.
+ *
+ * After a power loss session_journal_recover() finds the record of the
+ * session that was running, cuts its parts to the last whole block within
+ * the durable length and adds it to the catalog flagged as recovered.
+ */
+
+#define SESSION_JOURNAL_FILE "journal.bin"
+/* Longest time written data waits for a commit */
+#define SESSION_JOURNAL_MS 1000
+
+struct session_journal_part
+{
+    uint8_t part;
+    uint8_t open;
+    uint16_t reserved;
+    uint32_t durable; /* bytes synced to the card */
+};
+
+struct session_journal_state
+{
+    bool active;
+    const char *root; /* SESSION_ROOT_SD or SESSION_ROOT_NOR */
+    const char *base; /* file name without _NN.bin */
+    uint8_t parts_closed;
+    uint32_t bytes_closed;
+    struct session_journal_part parts[2];
+};
+
+/**
+ * @brief Recover the session an earlier power loss cut off under @p root
+ *
+ * SD writer thread after the mount and the catalog load, before the first
+ * session starts.
+ */
+int session_journal_recover(const char *root);
+
+/**
+ * @brief Write a commit record, SD writer thread
+ *
+ * The open parts must be synced up to their durable length.
+ */
+int session_journal_commit(const struct session_journal_state *state);
+
+#endif /* SESSION_JOURNAL_H */
@@ -0,0 +1,376 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include "session_log.h"
+#include "sdcard_module.h"
+#include "session_catalog.h"
+#include "session_codec.h"
+#include "ble/crc/crc16_koopman.h"
+#include "can/stream_registry.h"
+#include "message_processor/message_processor.h"
+
+BUILD_ASSERT((int)SESSION_LOG_FIELD_U8 == SAMPLE_FIELD_U8 &&
+             (int)SESSION_LOG_FIELD_U16 == SAMPLE_FIELD_U16 &&
+             (int)SESSION_LOG_FIELD_FLOAT == SAMPLE_FIELD_FLOAT);
+/* Receive time and synchronised hub time behind the sample in every record */
+#define SESSION_LOG_TIMES_LEN (2 * sizeof(uint32_t))
+#define SESSION_LOG_RECORD_MAX (SENSOR_SAMPLE_SIZE_MAX + SESSION_LOG_TIMES_LEN)
+
+BUILD_ASSERT(sizeof(struct session_log_block_header) + SESSION_LOG_RECORD_MAX +
+             SESSION_LOG_CRC_LEN <= SESSION_LOG_BLOCK_SIZE);
+BUILD_ASSERT(SESSION_LOG_RECORD_MAX <= UINT8_MAX);
+
+/* Header block with the stream table, written at the start of every part */
+#define SESSION_LOG_HEADER_MAX 1024
+
+#if defined(CONFIG_APP_SESSION_LOG_DELTA)
+#define SESSION_LOG_RECORDS_TYPE SESSION_LOG_BLOCK_DELTA
+#else
+#define SESSION_LOG_RECORDS_TYPE SESSION_LOG_BLOCK_RECORDS
+#endif
+
+BUILD_ASSERT(SENSOR_COUNT <= SESSION_CODEC_STREAMS);
+/* A coded record is 1 + 5 bytes plus at most 5 per field and time */
+BUILD_ASSERT(sizeof(struct session_log_block_header) +
+             1 + SESSION_CODEC_VARINT_MAX * (1 + SESSION_CODEC_FIELDS) +
+             SESSION_LOG_CRC_LEN <= SESSION_LOG_BLOCK_SIZE);
+
+/* Block being filled, owned by the pipeline thread */
+static struct session_log_block block;
+static bool block_open;
+static int64_t block_opened_at;
+static uint16_t block_seq;
+/* Stream state of the delta codec, starts over with every block */
+static struct session_codec codec;
+
+static int64_t session_start_ms;
+/* Set once the header is out, the pipeline owns the output from then on */
+static atomic_t log_running;
+static atomic_t stop_pending;
+
+static uint32_t stat_records;
+static uint32_t stat_blocks;
+static uint32_t stat_bytes;
+static uint32_t stat_dropped;
+
+static uint32_t stat_parts;
+/* Record bytes before coding and time spent coding them */
+static uint32_t stat_raw_bytes;
+static uint64_t stat_encode_cycles;
+
+/* Per sensor of the running session, for the catalog */
+struct session_log_stream_stats
+{
+    uint32_t records;
+    uint32_t first_frame;
+    uint32_t last_frame;
+};
+
+static struct session_log_stream_stats session_streams[SENSOR_COUNT];
+static uint16_t session_dropped;
+static bool stop_counted;
+
+static uint8_t header_buf[SESSION_LOG_HEADER_MAX];
+static uint16_t header_payload_len;
+
+/* Fill in block header and CRC, data[] already holds the payload */
+static uint16_t session_log_seal(uint8_t *buf, uint8_t type, uint16_t payload_len,
+                                 uint32_t time_ms)
+{
+    struct session_log_block_header hdr = {
+        .sync = sys_cpu_to_le16(SESSION_LOG_SYNC),
+        .type = type,
+        .len = sys_cpu_to_le16(payload_len),
+        .seq = sys_cpu_to_le16(block_seq++),
+        .time_ms = sys_cpu_to_le32(time_ms),
+    };
+    uint16_t len = sizeof(hdr) + payload_len;
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    sys_put_le16(crc16_koopman(buf, len), &buf[len]);
+    return len + SESSION_LOG_CRC_LEN;
+}
+
+/* Seal the header for a part, block numbers start over in every file */
+static int session_log_write_header(uint8_t part, uint32_t time_ms)
+{
+    size_t part_pos = sizeof(struct session_log_block_header) +
+                      offsetof(struct session_log_file_header, part);
+    uint16_t len;
+    int ret;
+
+    header_buf[part_pos] = part;
+    block_seq = 0;
+    len = session_log_seal(header_buf, SESSION_LOG_BLOCK_HEADER, header_payload_len, time_ms);
+    ret = session_file_write(header_buf, len);
+    if (ret == 0)
+    {
+        stat_bytes += len;
+        stat_parts++;
+    }
+    return ret;
+}
+
+int session_log_start(void)
+{
+    struct session_log_file_header fh = {
+        .magic = SESSION_LOG_MAGIC,
+        .version = sys_cpu_to_le16(SESSION_LOG_VERSION),
+        .num_streams = SENSOR_COUNT,
+    };
+    char now[32];
+    size_t pos = sizeof(struct session_log_block_header) + sizeof(fh);
+
+    block_open = false;
+    block_seq = 0;
+    session_codec_init(&codec);
+    memset(session_streams, 0, sizeof(session_streams));
+    session_dropped = 0;
+    stop_counted = false;
+    atomic_clear(&stop_pending);
+    session_start_ms = k_uptime_get();
+    fh.start_uptime_ms = sys_cpu_to_le32((uint32_t)session_start_ms);
+    if (get_rtc_time(now, sizeof(now)) > 0)
+    {
+        strncpy(fh.start_time, now, sizeof(fh.start_time));
+    }
+    memcpy(&header_buf[sizeof(struct session_log_block_header)], &fh, sizeof(fh));
+
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        const struct sensor_desc *desc = &sensor_registry[i];
+        struct session_log_stream st = {
+            .stream_id = desc->stream_id,
+            .record_size = desc->sample_size + SESSION_LOG_TIMES_LEN,
+            .num_fields = desc->num_fields + 2,
+        };
+        struct session_log_field time_fields[] = {
+            {
+                .type = SESSION_LOG_FIELD_U32,
+                .offset = desc->sample_size,
+                .name = SESSION_LOG_RX_FIELD,
+                .unit = "us",
+            },
+            {
+                .type = SESSION_LOG_FIELD_U32,
+                .offset = desc->sample_size + sizeof(uint32_t),
+                .name = SESSION_LOG_SYNC_FIELD,
+                .unit = "us",
+            },
+        };
+
+        if (pos + sizeof(st) + st.num_fields * sizeof(struct session_log_field) +
+                SESSION_LOG_CRC_LEN > sizeof(header_buf))
+        {
+            return -ENOMEM;
+        }
+        strncpy(st.name, stream_registry_name(desc->stream_id), sizeof(st.name));
+        memcpy(&header_buf[pos], &st, sizeof(st));
+        pos += sizeof(st);
+        size_t fields_pos = pos;
+
+        for (uint8_t f = 0; f < desc->num_fields; f++)
+        {
+            struct session_log_field field = {
+                .type = desc->fields[f].type,
+                .offset = desc->fields[f].offset,
+                .decimals = desc->fields[f].decimals,
+            };
+
+            strncpy(field.name, desc->fields[f].name, sizeof(field.name));
+            strncpy(field.unit, desc->fields[f].unit, sizeof(field.unit));
+            memcpy(&header_buf[pos], &field, sizeof(field));
+            pos += sizeof(field);
+        }
+        memcpy(&header_buf[pos], time_fields, sizeof(time_fields));
+        pos += sizeof(time_fields);
+        /* Coded from the same table the decoder reads */
+        session_codec_add_stream(&codec, st.stream_id, st.record_size, st.num_fields,
+                                 (const struct session_log_field *)&header_buf[fields_pos]);
+    }
+
+    header_payload_len = pos - sizeof(struct session_log_block_header);
+    int ret = session_log_write_header(0, 0);
+    if (ret == 0)
+    {
+        atomic_set(&log_running, 1);
+    }
+    return ret;
+}
+
+static void session_log_flush(void)
+{
+    if (!block_open)
+    {
+        return;
+    }
+    block_open = false;
+
+    uint32_t first_ms;
+    memcpy(&first_ms, &block.data[offsetof(struct session_log_block_header, time_ms)],
+           sizeof(first_ms));
+
+    /* Blocks never straddle parts, each part decodes on its own */
+    if (session_file_rotate_due(block.len + SESSION_LOG_CRC_LEN))
+    {
+        int part = session_file_rotate();
+
+        if (part >= 0 && session_log_write_header(part, first_ms) != 0)
+        {
+            stat_dropped++;
+        }
+    }
+    block.len = session_log_seal(block.data, SESSION_LOG_RECORDS_TYPE,
+                                 block.len - sizeof(struct session_log_block_header), first_ms);
+    if (session_file_write(block.data, block.len) != 0)
+    {
+        stat_dropped++;
+        session_dropped++;
+        return;
+    }
+    stat_blocks++;
+    stat_bytes += block.len;
+}
+
+/* us since session start, wrapping with the 32-bit field */
+static uint32_t session_log_time(uint64_t us)
+{
+    int64_t t = (int64_t)(us - session_start_ms * USEC_PER_MSEC);
+
+    /* Received just before the start, it still belongs to the session */
+    return (uint32_t)MAX(t, 0);
+}
+
+void session_log_append(const struct sensor_desc *desc, const void *sample, uint64_t rx_us,
+                        uint64_t time_us)
+{
+    uint8_t record[SESSION_LOG_RECORD_MAX];
+    size_t record_len = desc->sample_size + SESSION_LOG_TIMES_LEN;
+#if defined(CONFIG_APP_SESSION_LOG_DELTA)
+    size_t max_len = session_codec_max_len(&codec, desc->stream_id);
+#else
+    size_t max_len = record_len;
+#endif
+
+    memcpy(record, sample, desc->sample_size);
+    sys_put_le32(session_log_time(rx_us), &record[desc->sample_size]);
+    sys_put_le32(session_log_time(time_us), &record[desc->sample_size + sizeof(uint32_t)]);
+
+    if (block_open && block.len + max_len + SESSION_LOG_CRC_LEN > SESSION_LOG_BLOCK_SIZE)
+    {
+        session_log_flush();
+    }
+    if (!block_open)
+    {
+        uint32_t time_ms;
+
+        block_opened_at = k_uptime_get();
+        time_ms = (uint32_t)(block_opened_at - session_start_ms);
+        /* The header is written on seal, keep the block time until then */
+        memcpy(&block.data[offsetof(struct session_log_block_header, time_ms)], &time_ms,
+               sizeof(time_ms));
+        block.len = sizeof(struct session_log_block_header);
+        block_open = true;
+        session_codec_reset(&codec);
+    }
+
+#if defined(CONFIG_APP_SESSION_LOG_DELTA)
+    uint32_t start = k_cycle_get_32();
+
+    block.len += session_codec_encode(&codec, record, &block.data[block.len]);
+    stat_encode_cycles += k_cycle_get_32() - start;
+#else
+    memcpy(&block.data[block.len], record, record_len);
+    block.len += record_len;
+#endif
+    stat_records++;
+    stat_raw_bytes += record_len;
+
+    struct session_log_stream_stats *st = &session_streams[desc - sensor_registry];
+    uint32_t frame_id = sample_frame_id(sample);
+
+    if (st->records++ == 0)
+    {
+        st->first_frame = frame_id;
+    }
+    st->last_frame = frame_id;
+}
+
+static void session_log_catalog(void)
+{
+    struct session_catalog_stream streams[SENSOR_COUNT];
+
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        const struct session_log_stream_stats *st = &session_streams[i];
+        /* Records come in frame order, see struct sample_reorder */
+        uint32_t expected = st->records > 0 ? st->last_frame - st->first_frame + 1 : 0;
+
+        streams[i].stream_id = sensor_registry[i].stream_id;
+        streams[i].records = st->records;
+        streams[i].lost = MIN(expected > st->records ? expected - st->records : 0, UINT16_MAX);
+    }
+    session_catalog_set_records(streams, SENSOR_COUNT, session_dropped);
+}
+
+void session_log_poll(void)
+{
+    if (!atomic_get(&log_running))
+    {
+        return;
+    }
+    if (atomic_get(&stop_pending))
+    {
+        session_log_flush();
+        if (!stop_counted)
+        {
+            session_log_catalog();
+            stop_counted = true;
+        }
+        /* Staged data still going out, the pipeline comes back next pass */
+        if (session_file_finish() != 0)
+        {
+            return;
+        }
+        atomic_clear(&stop_pending);
+        atomic_clear(&log_running);
+        return;
+    }
+    if (block_open && k_uptime_get() - block_opened_at >= SESSION_LOG_FLUSH_MS)
+    {
+        session_log_flush();
+    }
+    session_file_poll();
+}
+
+void session_log_stop(void)
+{
+    atomic_set(&stop_pending, 1);
+}
+
+static int cmd_hub_log(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "records %u, blocks %u, bytes %u, dropped blocks %u, parts %u",
+                stat_records, stat_blocks, stat_bytes, stat_dropped, stat_parts);
+    if (stat_records > 0)
+    {
+        shell_print(sh, "%u bytes per record on disk, %u raw", stat_bytes / stat_records,
+                    stat_raw_bytes / stat_records);
+    }
+    if (IS_ENABLED(CONFIG_APP_SESSION_LOG_DELTA) && stat_records > 0 && stat_bytes > 0)
+    {
+        shell_print(sh, "delta coding: ratio %u.%02u, %llu cycles per record",
+                    stat_raw_bytes / stat_bytes,
+                    (uint32_t)((uint64_t)(stat_raw_bytes % stat_bytes) * 100 / stat_bytes),
+                    stat_encode_cycles / stat_records);
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), log, NULL, "Binary session log counters", cmd_hub_log, 1, 0);
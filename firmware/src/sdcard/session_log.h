@@ -0,0 +1,57 @@
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+#include <stdint.h>
+#include "session_log_format.h"
+#include "sensors/sensor_registry.h"
+
+/*
+ * Writer side of the binary session log, see session_log_format.h.
+ *
+ * Records are collected into blocks on the sample pipeline thread. A block
+ * is sealed with its CRC when the next record does not fit, when it is
+ * SESSION_LOG_FLUSH_MS old or when the session stops, and is then queued for
+ * the session file write buffers, see session_file_write().
+ */
+
+/* Whole block on disk: header, records and CRC */
+#define SESSION_LOG_BLOCK_SIZE 512
+#define SESSION_LOG_FLUSH_MS 250
+
+struct session_log_block
+{
+    uint16_t len;
+    uint8_t data[SESSION_LOG_BLOCK_SIZE];
+};
+
+/**
+ * @brief Write the header block of a new session
+ *
+ * Called with the session file freshly opened and before any record is
+ * appended.
+ */
+int session_log_start(void);
+
+/**
+ * @brief Add one sample to the open block, pipeline thread only
+ *
+ * @param rx_us receive time of the sample, see can_sample_rx_time()
+ * @param time_us its hub time on the same clock, see can_sample_time()
+ */
+void session_log_append(const struct sensor_desc *desc, const void *sample, uint64_t rx_us,
+                        uint64_t time_us);
+
+/**
+ * @brief Seal an old block and handle a stop, pipeline thread only
+ *
+ * Called after every drain pass.
+ */
+void session_log_poll(void);
+
+/**
+ * @brief Seal the last block and close the file once it is written
+ *
+ * Call after the session stopped feeding records.
+ */
+void session_log_stop(void);
+
+#endif /* SESSION_LOG_H */
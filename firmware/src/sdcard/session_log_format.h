@@ -0,0 +1,157 @@
+#ifndef SESSION_LOG_FORMAT_H
+#define SESSION_LOG_FORMAT_H
+#include <stdint.h>
+
+/*
+ * Binary session log, on-disk layout. Shared with tools/session_decode, so
+ * plain C and no Zephyr headers. All fields are little endian.
+ *
+ * A file is a sequence of blocks:
+ *
+ *   struct session_log_block_header | payload (len bytes) | crc16 (LE)
+ *
+ * The CRC is crc16_koopman() over block header and payload. The sync word
+ * lets a reader find the next block after a damaged one, seq shows lost
+ * blocks.
+ *
+ * The first block is SESSION_LOG_BLOCK_HEADER and describes the file:
+ * struct session_log_file_header, then per stream a struct
+ * session_log_stream followed by its num_fields struct session_log_field.
+ *
+ * A long session is split over parts <name>_00.bin, <name>_01.bin, ...
+ * Each part starts with the same header block apart from its part number,
+ * times stay relative to the start of the session.
+ *
+ * SESSION_LOG_BLOCK_RECORDS carry samples back to back exactly as they come
+ * off the bus: stream id, frame id, data. From version 3 every record ends
+ * in its receive time, a field of its stream (SESSION_LOG_RX_FIELD,
+ * SESSION_LOG_FIELD_U32), and from version 4 in its hub time on the
+ * mainhub clock after that (SESSION_LOG_SYNC_FIELD), see can/hub_sync.h.
+ * Both are us since session start, wrapping after 71 minutes; the block
+ * time tells the lap. The size of a record follows from its stream id and
+ * the stream table.
+ *
+ * SESSION_LOG_BLOCK_DELTA carry the same records coded against the record
+ * before them of the same stream in that block (session_codec.h): stream id,
+ * then zig-zag varints of the frame id step less one and of each field's
+ * change. The first record of a stream in a block is coded against zero, so
+ * every block still decodes on its own.
+ */
+
+#define SESSION_LOG_SYNC 0xA55A
+#define SESSION_LOG_MAGIC "RPSL"
+/* 2 added SESSION_LOG_BLOCK_DELTA, 3 the receive time, 4 the synchronised hub time */
+#define SESSION_LOG_VERSION 4
+
+enum session_log_block_type
+{
+    SESSION_LOG_BLOCK_HEADER = 1,
+    SESSION_LOG_BLOCK_RECORDS = 2,
+    SESSION_LOG_BLOCK_DELTA = 3,
+};
+
+/* Same values as enum sample_field_type */
+enum session_log_field_type
+{
+    SESSION_LOG_FIELD_U8 = 0,
+    SESSION_LOG_FIELD_U16 = 1,
+    SESSION_LOG_FIELD_FLOAT = 2,
+    SESSION_LOG_FIELD_U32 = 3, /* only the times behind the sample */
+};
+
+#define SESSION_LOG_RX_FIELD "rx_time"
+#define SESSION_LOG_SYNC_FIELD "sync_time"
+
+struct __attribute__((__packed__)) session_log_block_header
+{
+    uint16_t sync;
+    uint8_t type;
+    uint8_t flags; /* 0 */
+    uint16_t len;  /* payload bytes */
+    uint16_t seq;  /* counts blocks from 0 in each file */
+    uint32_t time_ms; /* since session start, when the first record arrived */
+};
+
+#define SESSION_LOG_CRC_LEN 2
+
+struct __attribute__((__packed__)) session_log_file_header
+{
+    char magic[4];
+    uint16_t version;
+    uint8_t num_streams;
+    uint8_t part; /* number of this file within the session, from 0 */
+    uint32_t start_uptime_ms;
+    char start_time[20]; /* "YYYY-MM-DD HH:MM:SS" from the app, empty if unknown */
+};
+
+#define SESSION_LOG_NAME_LEN 8
+#define SESSION_LOG_FIELD_NAME_LEN 12
+
+struct __attribute__((__packed__)) session_log_stream
+{
+    uint8_t stream_id;
+    uint8_t record_size;
+    uint8_t num_fields;
+    uint8_t reserved;
+    char name[SESSION_LOG_NAME_LEN]; /* NUL padded, not terminated when full */
+};
+
+struct __attribute__((__packed__)) session_log_field
+{
+    uint8_t type;   /* enum session_log_field_type */
+    uint8_t offset; /* from the start of the record */
+    uint8_t decimals;
+    uint8_t reserved;
+    char name[SESSION_LOG_FIELD_NAME_LEN];
+    char unit[SESSION_LOG_FIELD_NAME_LEN];
+};
+
+/*
+ * Session catalog, SESSION_CATALOG_FILE next to the session files. One
+ * entry per finished session, appended when its last part is closed.
+ * Entries are fixed size and never rewritten, so entry n sits at
+ * n * sizeof(entry) and a sector holds a whole number of them. An entry
+ * whose CRC does not match was cut short by a power loss and is skipped.
+ */
+
+#define SESSION_CATALOG_FILE "sessions.idx"
+#define SESSION_CATALOG_MAGIC 0x5343 /* "CS" */
+#define SESSION_CATALOG_VERSION 1
+#define SESSION_CATALOG_ID_LEN 20
+#define SESSION_CATALOG_STREAMS 4
+
+/* Entry flags */
+#define SESSION_CATALOG_COMPLETE 0x01  /* stopped normally */
+#define SESSION_CATALOG_RECOVERED 0x02 /* cut off, restored from the journal at boot */
+#define SESSION_CATALOG_MIGRATED 0x04  /* recorded to the QSPI flash, copied to the card later */
+
+struct __attribute__((__packed__)) session_catalog_stream
+{
+    uint8_t stream_id;
+    uint8_t reserved;
+    uint16_t lost;    /* frames missing between the first and last record */
+    uint32_t records;
+};
+
+struct __attribute__((__packed__)) session_catalog_entry
+{
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t session_id; /* files are S<id % 10000>_NN.bin */
+    char instructor_id[SESSION_CATALOG_ID_LEN]; /* NUL padded */
+    char trainee_id[SESSION_CATALOG_ID_LEN];
+    char start_time[20]; /* as in the file header */
+    uint32_t start_uptime_ms;
+    uint32_t duration_ms;
+    uint32_t bytes; /* over all parts */
+    uint32_t records;
+    uint16_t dropped_blocks;
+    uint8_t parts;
+    uint8_t num_streams;
+    struct session_catalog_stream streams[SESSION_CATALOG_STREAMS];
+    uint8_t reserved[6];
+    uint16_t crc; /* crc16_koopman() over everything before it */
+};
+
+#endif /* SESSION_LOG_FORMAT_H */
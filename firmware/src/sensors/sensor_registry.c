@@ -0,0 +1,324 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include "sensor_registry.h"
+#include "text_format.h"
+#include "can/can_transport.h"
+#include "can/stream_registry.h"
+
+/*
+ * The distance and orientation streams drive live feedback, so a stalled
+ * drain should lose their stale samples first. Pressure and ADC samples keep
+ * the queued history and refuse the newest one instead.
+ */
+
+#ifdef CONFIG_APP_SENSOR_VL6180X
+SAMPLE_RING_DEFINE(vl_ring, sample_sensor1_t, SENSOR_RING_SIZE, SAMPLE_RING_DROP_OLDEST);
+
+static const struct sample_field vl_fields[] = {
+    SAMPLE_FIELD(sample_sensor1_t, distance_mm, SAMPLE_FIELD_U8, "Distance", "mm", 0),
+};
+#endif
+
+#ifdef CONFIG_APP_SENSOR_ADS7138
+SAMPLE_RING_DEFINE(ads_ring, sample_sensor2_t, SENSOR_RING_SIZE, SAMPLE_RING_DROP_NEWEST);
+
+static const struct sample_field ads_fields[] = {
+    SAMPLE_FIELD(sample_sensor2_t, ch1_mv, SAMPLE_FIELD_U16, "CH1", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch2_mv, SAMPLE_FIELD_U16, "CH2", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch3_mv, SAMPLE_FIELD_U16, "CH3", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch4_mv, SAMPLE_FIELD_U16, "CH4", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch5_mv, SAMPLE_FIELD_U16, "CH5", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch6_mv, SAMPLE_FIELD_U16, "CH6", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch7_mv, SAMPLE_FIELD_U16, "CH7", "mv", 0),
+    SAMPLE_FIELD(sample_sensor2_t, ch8_mv, SAMPLE_FIELD_U16, "CH8", "mv", 0),
+};
+#endif
+
+#ifdef CONFIG_APP_SENSOR_SDP810
+SAMPLE_RING_DEFINE(sdp_ring, sample_sensor3_t, SENSOR_RING_SIZE, SAMPLE_RING_DROP_NEWEST);
+
+static const struct sample_field sdp_fields[] = {
+    SAMPLE_FIELD(sample_sensor3_t, pressure, SAMPLE_FIELD_FLOAT, "Pressure", "mbar", 4),
+    SAMPLE_FIELD(sample_sensor3_t, temp, SAMPLE_FIELD_FLOAT, "Temp", "fahrenheit", 4),
+};
+#endif
+
+#ifdef CONFIG_APP_SENSOR_BHI360
+SAMPLE_RING_DEFINE(bhi_ring, sample_sensor4_t, SENSOR_RING_SIZE, SAMPLE_RING_DROP_OLDEST);
+
+static const struct sample_field bhi_fields[] = {
+    SAMPLE_FIELD(sample_sensor4_t, pitch_deg, SAMPLE_FIELD_FLOAT, "Pitch", "deg", 4),
+    SAMPLE_FIELD(sample_sensor4_t, roll_deg, SAMPLE_FIELD_FLOAT, "Roll", "deg", 4),
+    SAMPLE_FIELD(sample_sensor4_t, yaw_deg, SAMPLE_FIELD_FLOAT, "Yaw", "deg", 4),
+};
+#endif
+
+const struct sensor_desc sensor_registry[SENSOR_COUNT] = {
+#ifdef CONFIG_APP_SENSOR_VL6180X
+    {
+        .key = "vl",
+        .name = "VL6180X",
+        .hub = SENSORHUB_1,
+        .stream_id = SAMPLE_STREAM_ID(1, 1),
+        .retransmit_cmd = SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_1,
+        .hub_tx_id = 0x080,
+        .hub_rx_id = 0x180,
+        .raw_id = 0x090,
+        .sample_size = sizeof(sample_sensor1_t),
+        .period_us = CONFIG_APP_SENSOR_VL6180X_PERIOD_US,
+        .fields = vl_fields,
+        .num_fields = ARRAY_SIZE(vl_fields),
+        .format = sensor_format_csv,
+        .sinks = SENSOR_SINK_SD | SENSOR_SINK_USB,
+        .ring = SAMPLE_RING_OF(vl_ring, sample_sensor1_t),
+    },
+#endif
+#ifdef CONFIG_APP_SENSOR_ADS7138
+    {
+        .key = "ads",
+        .name = "ADS7138",
+        .hub = SENSORHUB_1,
+        .stream_id = SAMPLE_STREAM_ID(1, 2),
+        .retransmit_cmd = SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_2,
+        .hub_tx_id = 0x001,
+        .hub_rx_id = 0x101,
+        .sample_size = sizeof(sample_sensor2_t),
+        .period_us = CONFIG_APP_SENSOR_ADS7138_PERIOD_US,
+        .fields = ads_fields,
+        .num_fields = ARRAY_SIZE(ads_fields),
+        .format = sensor_format_csv,
+        .sinks = SENSOR_SINK_SD | SENSOR_SINK_USB,
+        .ring = SAMPLE_RING_OF(ads_ring, sample_sensor2_t),
+    },
+#endif
+#ifdef CONFIG_APP_SENSOR_SDP810
+    {
+        .key = "sdp",
+        .name = "SDP810",
+        .hub = SENSORHUB_1,
+        .stream_id = SAMPLE_STREAM_ID(1, 3),
+        .retransmit_cmd = SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_3,
+        .hub_tx_id = 0x050,
+        .hub_rx_id = 0x150,
+        .raw_id = 0x0D0,
+        .sample_size = sizeof(sample_sensor3_t),
+        .period_us = CONFIG_APP_SENSOR_SDP810_PERIOD_US,
+        .fields = sdp_fields,
+        .num_fields = ARRAY_SIZE(sdp_fields),
+        .format = sensor_format_csv,
+        .sinks = SENSOR_SINK_SD | SENSOR_SINK_USB,
+        .ring = SAMPLE_RING_OF(sdp_ring, sample_sensor3_t),
+    },
+#endif
+#ifdef CONFIG_APP_SENSOR_BHI360
+    {
+        .key = "bhi",
+        .name = "BHI360",
+        .hub = SENSORHUB_2,
+        .stream_id = SAMPLE_STREAM_ID(2, 1),
+        .retransmit_cmd = SYSTEM_CMD_RETRANSMIT_SAMPLE_SENSOR_1,
+        .hub_tx_id = 0x060,
+        .hub_rx_id = 0x160,
+        .sample_size = sizeof(sample_sensor4_t),
+        .period_us = CONFIG_APP_SENSOR_BHI360_PERIOD_US,
+        .fields = bhi_fields,
+        .num_fields = ARRAY_SIZE(bhi_fields),
+        .format = sensor_format_csv,
+        /* Orientation is streamed to the host for live view */
+        .sinks = SENSOR_SINK_SD | SENSOR_SINK_LIVE,
+        .ring = SAMPLE_RING_OF(bhi_ring, sample_sensor4_t),
+    },
+#endif
+};
+
+/* Integer fields as they are, floats as their float */
+static uint32_t sample_field_u32(const struct sample_field *field, const void *sample)
+{
+    const uint8_t *data = (const uint8_t *)sample + field->offset;
+    uint16_t u16;
+
+    if (field->type == SAMPLE_FIELD_U16)
+    {
+        memcpy(&u16, data, sizeof(u16));
+        return u16;
+    }
+    return *data;
+}
+
+static float sample_field_float(const struct sample_field *field, const void *sample)
+{
+    float f;
+
+    memcpy(&f, (const uint8_t *)sample + field->offset, sizeof(f));
+    return f;
+}
+
+float sample_field_value(const struct sample_field *field, const void *sample)
+{
+    if (field->type == SAMPLE_FIELD_FLOAT)
+    {
+        return sample_field_float(field, sample);
+    }
+    return sample_field_u32(field, sample);
+}
+
+/* One field as text, room for TEXT_NUM_MAX characters */
+static size_t sample_field_text(const struct sample_field *field, const void *sample, char *out)
+{
+    if (field->type == SAMPLE_FIELD_FLOAT)
+    {
+        return text_put_fixed(out, sample_field_float(field, sample), field->decimals);
+    }
+    return text_put_u32(out, sample_field_u32(field, sample));
+}
+
+int sensor_format_csv(const struct sensor_desc *desc, const void *sample, char *buf, size_t len)
+{
+    const sample_header_t *hdr = sample;
+    size_t pos = 0;
+
+    /* "255,4294967295" and the line end */
+    if (len < 16)
+    {
+        return -ENOMEM;
+    }
+
+    pos += text_put_u32(&buf[pos], hdr->stream_id);
+    buf[pos++] = ',';
+    pos += text_put_u32(&buf[pos], sample_frame_id(sample));
+    for (uint8_t i = 0; i < desc->num_fields; i++)
+    {
+        /* Separator, value, line end; the line is cut short like snprintf would */
+        if (len - pos < 1 + TEXT_NUM_MAX + 2)
+        {
+            break;
+        }
+        buf[pos++] = ',';
+        pos += sample_field_text(&desc->fields[i], sample, &buf[pos]);
+    }
+    buf[pos++] = '\n';
+    buf[pos] = '\0';
+
+    return pos;
+}
+
+void sensor_print_sample(const struct sensor_desc *desc, const void *sample)
+{
+    const sample_header_t *hdr = sample;
+    char value[TEXT_NUM_MAX + 1];
+
+    printk("Sensor: %s\n", stream_registry_name(hdr->stream_id));
+    printk("Frame ID: %u\n", sample_frame_id(sample));
+    for (uint8_t i = 0; i < desc->num_fields; i++)
+    {
+        const struct sample_field *field = &desc->fields[i];
+
+        value[sample_field_text(field, sample, value)] = '\0';
+        printk("%s: %s %s\n", field->name, value, field->unit);
+    }
+}
+
+#if defined(CONFIG_APP_TEXT_FORMAT_BENCH)
+#include <zephyr/shell/shell.h>
+
+#define TEXT_BENCH_SAMPLES 200
+
+/* The snprintf formatter sensor_format_csv() replaced, for comparison */
+static int sensor_format_csv_printf(const struct sensor_desc *desc, const void *sample,
+                                    char *buf, size_t len)
+{
+    const sample_header_t *hdr = sample;
+    int pos = snprintf(buf, len, "%u,%u", hdr->stream_id, sample_frame_id(sample));
+
+    for (uint8_t i = 0; i < desc->num_fields && pos < (int)len; i++)
+    {
+        const struct sample_field *field = &desc->fields[i];
+
+        if (field->type == SAMPLE_FIELD_FLOAT)
+        {
+            pos += snprintf(&buf[pos], len - pos, ",%.*f", field->decimals,
+                            (double)sample_field_float(field, sample));
+        }
+        else
+        {
+            pos += snprintf(&buf[pos], len - pos, ",%u", sample_field_u32(field, sample));
+        }
+    }
+    if (pos < (int)len)
+    {
+        pos += snprintf(&buf[pos], len - pos, "\n");
+    }
+
+    return pos;
+}
+
+/* Sample n of a made up series, every field moving through its range */
+static void text_bench_sample(const struct sensor_desc *desc, uint32_t n, uint8_t *sample)
+{
+    memset(sample, 0, desc->sample_size);
+    sample[0] = desc->stream_id;
+    memcpy(&sample[1], &n, sizeof(n));
+    for (uint8_t i = 0; i < desc->num_fields; i++)
+    {
+        const struct sample_field *field = &desc->fields[i];
+        uint16_t u16 = (uint16_t)(n * 331 + i * 1000);
+        float f = ((int32_t)n - TEXT_BENCH_SAMPLES / 2) * 0.7311f + i * 12.5f;
+
+        switch (field->type)
+        {
+        case SAMPLE_FIELD_U8:
+            sample[field->offset] = (uint8_t)(n + i);
+            break;
+        case SAMPLE_FIELD_U16:
+            memcpy(&sample[field->offset], &u16, sizeof(u16));
+            break;
+        case SAMPLE_FIELD_FLOAT:
+            memcpy(&sample[field->offset], &f, sizeof(f));
+            break;
+        }
+    }
+}
+
+static int cmd_hub_fmt(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    uint8_t sample[SENSOR_SAMPLE_SIZE_MAX];
+    char a[256];
+    char b[256];
+
+    shell_print(sh, "%-8s %12s %12s %8s %s", "sensor", "snprintf cyc", "fixed cyc", "speedup",
+                "mismatches");
+    for (size_t s = 0; s < SENSOR_COUNT; s++)
+    {
+        const struct sensor_desc *desc = &sensor_registry[s];
+        uint64_t printf_cycles = 0;
+        uint64_t fixed_cycles = 0;
+        uint32_t mismatches = 0;
+
+        for (uint32_t n = 0; n < TEXT_BENCH_SAMPLES; n++)
+        {
+            uint32_t start;
+
+            text_bench_sample(desc, n, sample);
+            start = k_cycle_get_32();
+            sensor_format_csv_printf(desc, sample, a, sizeof(a));
+            printf_cycles += k_cycle_get_32() - start;
+            start = k_cycle_get_32();
+            sensor_format_csv(desc, sample, b, sizeof(b));
+            fixed_cycles += k_cycle_get_32() - start;
+            mismatches += strcmp(a, b) != 0;
+        }
+        shell_print(sh, "%-8s %12llu %12llu %7llux %u", desc->key,
+                    printf_cycles / TEXT_BENCH_SAMPLES, fixed_cycles / TEXT_BENCH_SAMPLES,
+                    printf_cycles / MAX(fixed_cycles, 1), mismatches);
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), fmt, NULL, "Time the CSV formatter against snprintf", cmd_hub_fmt, 1, 0);
+#endif /* CONFIG_APP_TEXT_FORMAT_BENCH */
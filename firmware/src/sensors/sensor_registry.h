@@ -0,0 +1,109 @@
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+#include <stdint.h>
+#include <stddef.h>
+#include <zephyr/sys/util.h>
+#include "can/can_rx_types.h"
+#include "can/sample_ring.h"
+
+/*
+ * Sensor registry.
+ *
+ * Every sensor stream is described once in sensor_registry[]: where it comes
+ * from on the bus, what a sample looks like and where samples go. CAN ingest,
+ * the sample drain and the storage and USB writers only walk this table, so
+ * a new sensor is a Kconfig option, a sample struct and one table entry.
+ * Sensors that are compiled out take no ring, reassembly or reorder state.
+ */
+
+enum sample_field_type
+{
+    SAMPLE_FIELD_U8,
+    SAMPLE_FIELD_U16,
+    SAMPLE_FIELD_FLOAT,
+};
+
+/* One value in the data part of a sample */
+struct sample_field
+{
+    const char *name;
+    const char *unit;
+    uint8_t offset;
+    uint8_t type;
+    uint8_t decimals; /* SAMPLE_FIELD_FLOAT only */
+};
+
+#define SAMPLE_FIELD(_sample_type, _member, _field_type, _name, _unit, _decimals) \
+    {                                                                             \
+        .name = (_name),                                                          \
+        .unit = (_unit),                                                          \
+        .offset = offsetof(_sample_type, data._member),                           \
+        .type = (_field_type),                                                    \
+        .decimals = (_decimals),                                                  \
+    }
+
+/* Sinks a stream feeds */
+#define SENSOR_SINK_SD BIT(0)   /* session file, while a session runs */
+#define SENSOR_SINK_USB BIT(1)  /* CDC CSV mirror, while a session runs */
+#define SENSOR_SINK_LIVE BIT(2) /* CDC CSV line, also outside a session */
+
+struct sensor_desc;
+
+/* Writes one sample as text, returns the length like snprintf() */
+typedef int (*sensor_format_t)(const struct sensor_desc *desc, const void *sample,
+                               char *buf, size_t len);
+
+struct sensor_desc
+{
+    const char *key;  /* short name in shell output */
+    const char *name; /* stream name until the hub status names it */
+    uint8_t hub;      /* SENSORHUB_n */
+    uint8_t stream_id;
+    uint8_t retransmit_cmd;
+
+    /* Bus addresses, standard IDs */
+    uint16_t hub_tx_id; /* ISO-TP, the hub sends samples on it */
+    uint16_t hub_rx_id; /* ISO-TP, the hub takes flow control on it */
+    uint16_t raw_id;    /* raw sample frames, 0 if the stream has none */
+
+    uint8_t sample_size;
+    /* Nominal time between frame ids, frame_id * period_us is hub time */
+    uint32_t period_us;
+    const struct sample_field *fields;
+    uint8_t num_fields;
+
+    sensor_format_t format;
+    uint8_t sinks;
+    struct sample_ring *ring;
+};
+
+/* Samples queued per sensor between ingest and drain, power of two */
+#define SENSOR_RING_SIZE 32
+
+#define SENSOR_COUNT                                                             \
+    (IS_ENABLED(CONFIG_APP_SENSOR_VL6180X) + IS_ENABLED(CONFIG_APP_SENSOR_ADS7138) + \
+     IS_ENABLED(CONFIG_APP_SENSOR_SDP810) + IS_ENABLED(CONFIG_APP_SENSOR_BHI360))
+
+/* Largest sample of the enabled sensors */
+#define SENSOR_SAMPLE_SIZE_MAX                                                               \
+    MAX(MAX(IS_ENABLED(CONFIG_APP_SENSOR_VL6180X) ? sizeof(sample_sensor1_t) : 0,          \
+            IS_ENABLED(CONFIG_APP_SENSOR_ADS7138) ? sizeof(sample_sensor2_t) : 0),         \
+        MAX(IS_ENABLED(CONFIG_APP_SENSOR_SDP810) ? sizeof(sample_sensor3_t) : 0,           \
+            IS_ENABLED(CONFIG_APP_SENSOR_BHI360) ? sizeof(sample_sensor4_t) : 0))
+
+extern const struct sensor_desc sensor_registry[SENSOR_COUNT];
+
+/* A field of a sample as a number */
+float sample_field_value(const struct sample_field *field, const void *sample);
+
+/**
+ * @brief Format a sample as a CSV row: stream_id,frame_id,field...
+ */
+int sensor_format_csv(const struct sensor_desc *desc, const void *sample, char *buf, size_t len);
+
+/**
+ * @brief Print every field of a sample to the console
+ */
+void sensor_print_sample(const struct sensor_desc *desc, const void *sample);
+
+#endif /* SENSOR_REGISTRY_H */
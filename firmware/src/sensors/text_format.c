@@ -0,0 +1,76 @@
+#include <math.h>
+#include <string.h>
+#include "text_format.h"
+
+static const uint32_t pow10[TEXT_DECIMALS_MAX + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+/* Digits of value, at least min_digits with leading zeros */
+static size_t put_u64(char *out, uint64_t value, uint8_t min_digits)
+{
+    char tmp[20];
+    size_t n = 0;
+
+    do
+    {
+        tmp[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0 || n < min_digits);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+size_t text_put_u32(char *out, uint32_t value)
+{
+    return put_u64(out, value, 1);
+}
+
+size_t text_put_fixed(char *out, float value, uint8_t decimals)
+{
+    size_t pos = 0;
+    double scaled;
+    uint64_t n;
+    double rest;
+
+    if (decimals > TEXT_DECIMALS_MAX)
+    {
+        decimals = TEXT_DECIMALS_MAX;
+    }
+    if (isnan(value))
+    {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    if (signbit(value))
+    {
+        out[pos++] = '-';
+        value = -value;
+    }
+
+    /* 24 bit mantissa times at most 5^9 fits the 53 bits of a double */
+    scaled = (double)value * pow10[decimals];
+    if (!(scaled < 18446744073709549568.0))
+    {
+        memcpy(&out[pos], "inf", 3);
+        return pos + 3;
+    }
+    n = (uint64_t)scaled;
+    rest = scaled - (double)n;
+    if (rest > 0.5 || (rest == 0.5 && (n & 1)))
+    {
+        n++;
+    }
+
+    pos += put_u64(&out[pos], n / pow10[decimals], 1);
+    if (decimals > 0)
+    {
+        out[pos++] = '.';
+        pos += put_u64(&out[pos], n % pow10[decimals], decimals);
+    }
+    return pos;
+}
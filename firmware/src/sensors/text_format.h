@@ -0,0 +1,26 @@
+#ifndef TEXT_FORMAT_H
+#define TEXT_FORMAT_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Number to text for the sample CSV lines, no format string and no float
+ * printf. Each call writes straight into the output, which needs room for
+ * TEXT_NUM_MAX characters, and returns the characters written. Nothing is
+ * NUL terminated.
+ *
+ * text_put_fixed() prints exactly what "%.*f" prints for a float with up
+ * to TEXT_DECIMALS_MAX decimals: the float times 10^decimals is exact in a
+ * double, so rounding it half to even gives the same digits.
+ */
+
+/* Sign, 20 digits, point and the decimals */
+#define TEXT_NUM_MAX 32
+#define TEXT_DECIMALS_MAX 9
+
+size_t text_put_u32(char *out, uint32_t value);
+
+/* NaN and values past 2^64 / 10^decimals print as nan, inf and -inf */
+size_t text_put_fixed(char *out, float value, uint8_t decimals);
+
+#endif /* TEXT_FORMAT_H */
@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include "sample_log.h"
+#include "can/can_transport.h"
+
+BUILD_ASSERT(IS_POWER_OF_TWO(SAMPLE_LOG_SIZE), "sample log size must be a power of two");
+BUILD_ASSERT(SENSOR_COUNT <= UINT8_MAX);
+
+#define SAMPLE_LOG_MASK (SAMPLE_LOG_SIZE - 1)
+
+static struct sample_log_entry sample_log[SAMPLE_LOG_SIZE];
+/* Sequence number of the next entry published, the producer owns it */
+static atomic_t sample_log_head;
+
+static struct sample_log_cursor *cursors[SAMPLE_LOG_CURSORS_MAX];
+static atomic_t num_cursors;
+static uint32_t stat_published;
+
+/* Receive to publish, per sensor */
+struct sample_log_latency
+{
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+};
+
+static struct sample_log_latency latency[SENSOR_COUNT];
+
+void sample_log_attach(struct sample_log_cursor *cursor, const char *name)
+{
+    atomic_val_t slot = atomic_inc(&num_cursors);
+
+    cursor->name = name;
+    cursor->seq = (uint32_t)atomic_get(&sample_log_head);
+    cursor->reads = 0;
+    cursor->lost = 0;
+    cursor->max_lag = 0;
+    k_sem_init(&cursor->wake, 0, 1);
+
+    __ASSERT(slot < SAMPLE_LOG_CURSORS_MAX, "too many sample log cursors");
+    if (slot < SAMPLE_LOG_CURSORS_MAX)
+    {
+        cursors[slot] = cursor;
+    }
+}
+
+void sample_log_publish(const struct sensor_desc *desc, const void *sample)
+{
+    uint32_t head = (uint32_t)atomic_get(&sample_log_head);
+    struct sample_log_entry *entry = &sample_log[head & SAMPLE_LOG_MASK];
+
+    struct sample_log_latency *lat = &latency[desc - sensor_registry];
+    uint32_t lat_us;
+
+    entry->rx_us = can_sample_rx_time(sample);
+    entry->time_us = can_sample_time(sample);
+    entry->sensor = desc - sensor_registry;
+    memcpy(entry->data, sample, desc->sample_size);
+    lat_us = (uint32_t)MIN(can_rx_time_now() - entry->rx_us, UINT32_MAX);
+    lat->count++;
+    lat->sum_us += lat_us;
+    lat->max_us = MAX(lat->max_us, lat_us);
+    /* The entry is complete before a reader can see it */
+    atomic_set(&sample_log_head, head + 1);
+    stat_published++;
+}
+
+void sample_log_flush(void)
+{
+    atomic_val_t num = MIN(atomic_get(&num_cursors), SAMPLE_LOG_CURSORS_MAX);
+
+    for (atomic_val_t i = 0; i < num; i++)
+    {
+        k_sem_give(&cursors[i]->wake);
+    }
+}
+
+int sample_log_read(struct sample_log_cursor *cursor, struct sample_log_entry *entry)
+{
+    while (1)
+    {
+        uint32_t head = (uint32_t)atomic_get(&sample_log_head);
+        uint32_t lag = head - cursor->seq;
+
+        if (lag == 0)
+        {
+            return -EAGAIN;
+        }
+        /* The slot of head itself may be half written already */
+        if (lag > SAMPLE_LOG_SIZE - 1)
+        {
+            cursor->lost += lag - (SAMPLE_LOG_SIZE - 1);
+            cursor->seq = head - (SAMPLE_LOG_SIZE - 1);
+            lag = SAMPLE_LOG_SIZE - 1;
+        }
+        cursor->max_lag = MAX(cursor->max_lag, lag);
+
+        *entry = sample_log[cursor->seq & SAMPLE_LOG_MASK];
+
+        /* Lapped while copying, the copy may be torn */
+        if ((uint32_t)atomic_get(&sample_log_head) - cursor->seq > SAMPLE_LOG_SIZE - 1)
+        {
+            continue;
+        }
+        cursor->seq++;
+        cursor->reads++;
+        return 0;
+    }
+}
+
+int sample_log_wait(struct sample_log_cursor *cursor, k_timeout_t timeout)
+{
+    return k_sem_take(&cursor->wake, timeout);
+}
+
+uint32_t sample_log_lag(const struct sample_log_cursor *cursor)
+{
+    return (uint32_t)atomic_get(&sample_log_head) - cursor->seq;
+}
+
+static int cmd_hub_sinks(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    atomic_val_t num = MIN(atomic_get(&num_cursors), SAMPLE_LOG_CURSORS_MAX);
+
+    shell_print(sh, "%u samples published, log of %u entries", stat_published,
+                SAMPLE_LOG_SIZE);
+    shell_print(sh, "%-8s %10s %6s %8s %8s", "sink", "read", "lag", "max lag", "lost");
+    for (atomic_val_t i = 0; i < num; i++)
+    {
+        const struct sample_log_cursor *c = cursors[i];
+
+        shell_print(sh, "%-8s %10u %6u %8u %8u", c->name, c->reads, sample_log_lag(c),
+                    c->max_lag, c->lost);
+    }
+    shell_print(sh, "%-8s %10s %8s", "bus->log", "mean us", "max us");
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        const struct sample_log_latency *lat = &latency[i];
+
+        shell_print(sh, "%-8s %10u %8u", sensor_registry[i].key,
+                    lat->count > 0 ? (uint32_t)(lat->sum_us / lat->count) : 0, lat->max_us);
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), sinks, NULL, "Sample log cursors per sink", cmd_hub_sinks, 1, 0);
@@ -0,0 +1,77 @@
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include "sensors/sensor_registry.h"
+
+/*
+ * Sample log, the one place samples go after the pipeline put them in
+ * order.
+ *
+ * The pipeline thread copies every sample once into a ring of
+ * SAMPLE_LOG_SIZE entries and never waits. Each sink (session file, USB,
+ * later BLE or analytics) reads through its own cursor at its own pace and
+ * encodes what it wants. A sink that falls more than the ring behind is
+ * lapped: its cursor jumps ahead and the entries it missed count as lost on
+ * that cursor only. "hub sinks" shows lag and losses per cursor and how
+ * long samples took from the bus to the log.
+ *
+ * A cursor belongs to one consumer thread.
+ */
+
+/* Entries in the ring, power of two */
+#define SAMPLE_LOG_SIZE 512
+/* Attached cursors */
+#define SAMPLE_LOG_CURSORS_MAX 4
+
+struct sample_log_entry
+{
+    uint64_t rx_us;   /* receive time, see can_sample_rx_time() */
+    uint64_t time_us; /* hub time on the same clock, see can_sample_time() */
+    uint8_t sensor; /* index into sensor_registry */
+    uint8_t data[SENSOR_SAMPLE_SIZE_MAX];
+};
+
+struct sample_log_cursor
+{
+    const char *name;
+    uint32_t seq; /* next entry to read */
+    struct k_sem wake;
+
+    uint32_t reads;
+    uint32_t lost;
+    uint32_t max_lag;
+};
+
+/**
+ * @brief Start reading at the next entry published
+ */
+void sample_log_attach(struct sample_log_cursor *cursor, const char *name);
+
+/**
+ * @brief Copy a sample slot and its receive time into the log, pipeline
+ * thread only
+ */
+void sample_log_publish(const struct sensor_desc *desc, const void *sample);
+
+/**
+ * @brief Wake the cursors after a pass, pipeline thread only
+ */
+void sample_log_flush(void);
+
+/**
+ * @brief Take the next entry
+ *
+ * @return 0, -EAGAIN if the cursor is at the head
+ */
+int sample_log_read(struct sample_log_cursor *cursor, struct sample_log_entry *entry);
+
+/**
+ * @brief Wait for sample_log_flush() after the cursor ran empty
+ */
+int sample_log_wait(struct sample_log_cursor *cursor, k_timeout_t timeout);
+
+/* Entries published that the cursor has not read yet */
+uint32_t sample_log_lag(const struct sample_log_cursor *cursor);
+
+#endif /* SAMPLE_LOG_H */
@@ -0,0 +1,478 @@
+#include <math.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <stdlib.h>
+#include "sample_merge.h"
+#include "sample_log.h"
+#include "sample_pipeline.h"
+#include "sensors/text_format.h"
+
+#define SAMPLE_MERGE_STACK_SIZE 2048
+/* Below the sample pipeline, rows feed live views */
+#define SAMPLE_MERGE_PRIORITY 8
+
+#define SAMPLE_MERGE_RATE_MAX 1000
+/* Rows written at most for one sample, the rest of a gap is skipped */
+#define SAMPLE_MERGE_GAP_ROWS 8
+#define SAMPLE_MERGE_ROW_MASK (SAMPLE_MERGE_ROWS - 1)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(SAMPLE_MERGE_ROWS), "merged row ring must be a power of two");
+#define SAMPLE_MERGE_LATENCY_US (CONFIG_APP_SAMPLE_MERGE_LATENCY_MS * USEC_PER_MSEC)
+
+struct merge_sample
+{
+    uint64_t time_us;
+    uint8_t data[SENSOR_SAMPLE_SIZE_MAX];
+};
+
+struct merge_stream
+{
+    struct merge_sample queue[SAMPLE_MERGE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    struct merge_sample last; /* the newest sample merged */
+    bool has_last;
+    int64_t rx_ms;      /* uptime of the newest sample or the reset */
+    uint8_t column;     /* its first field in a row */
+    uint8_t num_fields; /* of those that fit in a row */
+};
+
+struct sample_merge_stats
+{
+    uint32_t rows;
+    uint32_t skipped_rows; /* passed over in a gap */
+    uint32_t forced;       /* taken from a full queue without waiting */
+    uint32_t late;         /* older than what was merged already */
+};
+
+K_THREAD_STACK_DEFINE(sample_merge_stack, SAMPLE_MERGE_STACK_SIZE);
+static struct k_thread sample_merge_thread_data;
+
+static atomic_t reset_pending;
+static atomic_t row_rate_hz = ATOMIC_INIT(CONFIG_APP_SAMPLE_MERGE_RATE_HZ);
+static atomic_t row_linear = ATOMIC_INIT(IS_ENABLED(CONFIG_APP_SAMPLE_MERGE_LINEAR));
+
+/* Owned by the merge thread */
+static struct sample_log_cursor merge_cursor;
+static struct merge_stream streams[SENSOR_COUNT];
+static uint64_t merged_us; /* time of the newest sample merged of any sensor */
+static uint64_t row_us;    /* time of the next row */
+static bool rows_started;
+static struct sample_merge_stats stats;
+
+/* Written by the merge thread only, read through the cursors */
+static struct sample_merge_row merge_rows[SAMPLE_MERGE_ROWS];
+/* Sequence number of the next row, the merge thread owns it */
+static atomic_t rows_head;
+static uint32_t rows_flushed;
+
+static struct sample_merge_cursor *cursors[SAMPLE_MERGE_CURSORS_MAX];
+static atomic_t num_cursors;
+
+static void merge_start(int64_t now)
+{
+    uint8_t column = 0;
+
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        struct merge_stream *st = &streams[i];
+
+        st->head = 0;
+        st->count = 0;
+        st->has_last = false;
+        /* Every sensor gets the latency to send its first sample */
+        st->rx_ms = now;
+        st->column = column;
+        st->num_fields = MIN(sensor_registry[i].num_fields, SAMPLE_MERGE_COLUMNS_MAX - column);
+        column += st->num_fields;
+    }
+    merged_us = 0;
+    rows_started = false;
+}
+
+static void merge_put_row(const struct sample_merge_row *row)
+{
+    uint32_t head = (uint32_t)atomic_get(&rows_head);
+
+    merge_rows[head & SAMPLE_MERGE_ROW_MASK] = *row;
+    /* The row is complete before a reader can see it */
+    atomic_set(&rows_head, head + 1);
+    stats.rows++;
+}
+
+/* Wake the cursors once a pass merged new rows */
+static void merge_flush(void)
+{
+    uint32_t head = (uint32_t)atomic_get(&rows_head);
+    atomic_val_t num = MIN(atomic_get(&num_cursors), SAMPLE_MERGE_CURSORS_MAX);
+
+    if (head == rows_flushed)
+    {
+        return;
+    }
+    rows_flushed = head;
+    for (atomic_val_t i = 0; i < num; i++)
+    {
+        k_sem_give(&cursors[i]->wake);
+    }
+}
+
+/* The fields of one sensor at row_us, from the samples around it */
+static void merge_row_sensor(struct sample_merge_row *row, size_t sensor,
+                             const struct merge_sample *after, bool linear)
+{
+    const struct sensor_desc *desc = &sensor_registry[sensor];
+    const struct merge_stream *st = &streams[sensor];
+    float frac = 0.0f;
+
+    if (!st->has_last)
+    {
+        for (uint8_t i = 0; i < st->num_fields; i++)
+        {
+            row->value[st->column + i] = NAN;
+        }
+        return;
+    }
+
+    if (linear && after != NULL)
+    {
+        frac = (float)(row_us - st->last.time_us) / (float)(after->time_us - st->last.time_us);
+    }
+    for (uint8_t i = 0; i < st->num_fields; i++)
+    {
+        float v = sample_field_value(&desc->fields[i], st->last.data);
+
+        if (frac > 0.0f)
+        {
+            v += (sample_field_value(&desc->fields[i], after->data) - v) * frac;
+        }
+        row->value[st->column + i] = v;
+    }
+    if (row_us - st->last.time_us <= SAMPLE_MERGE_LATENCY_US)
+    {
+        row->valid |= BIT(sensor);
+    }
+}
+
+/* Rows up to the sample of @p sensor about to be merged */
+static void merge_rows_before(size_t sensor, const struct merge_sample *next)
+{
+    uint64_t period_us = USEC_PER_SEC / (uint32_t)atomic_get(&row_rate_hz);
+    bool linear = atomic_get(&row_linear);
+
+    if (!rows_started)
+    {
+        row_us = ROUND_UP(next->time_us, period_us);
+        rows_started = true;
+    }
+    /* After a gap only the last few rows are worth writing */
+    if (next->time_us > row_us + SAMPLE_MERGE_GAP_ROWS * period_us)
+    {
+        uint64_t skip = (next->time_us - row_us) / period_us - SAMPLE_MERGE_GAP_ROWS;
+
+        row_us += skip * period_us;
+        stats.skipped_rows += skip;
+    }
+
+    while (row_us < next->time_us)
+    {
+        struct sample_merge_row row = {.time_us = row_us};
+
+        for (size_t i = 0; i < SENSOR_COUNT; i++)
+        {
+            const struct merge_stream *st = &streams[i];
+            const struct merge_sample *after = NULL;
+
+            /* Everything queued is past the row, the head is the next sample */
+            if (i == sensor)
+            {
+                after = next;
+            }
+            else if (st->count > 0)
+            {
+                after = &st->queue[st->head];
+            }
+            merge_row_sensor(&row, i, after, linear);
+        }
+        merge_put_row(&row);
+        row_us += period_us;
+    }
+}
+
+/* Merge the oldest queued sample of all sensors, false if none is queued */
+static bool merge_pop(void)
+{
+    struct merge_stream *min = NULL;
+    size_t sensor = 0;
+
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        struct merge_stream *st = &streams[i];
+
+        if (st->count > 0 &&
+            (min == NULL || st->queue[st->head].time_us < min->queue[min->head].time_us))
+        {
+            min = st;
+            sensor = i;
+        }
+    }
+    if (min == NULL)
+    {
+        return false;
+    }
+
+    merge_rows_before(sensor, &min->queue[min->head]);
+    min->last = min->queue[min->head];
+    min->has_last = true;
+    min->head = (min->head + 1) % SAMPLE_MERGE_DEPTH;
+    min->count--;
+    merged_us = min->last.time_us;
+    return true;
+}
+
+/* Merge while no sensor that may still send has an empty queue */
+static void merge_drain(int64_t now)
+{
+    while (1)
+    {
+        for (size_t i = 0; i < SENSOR_COUNT; i++)
+        {
+            const struct merge_stream *st = &streams[i];
+
+            if (st->count == 0 && now - st->rx_ms < CONFIG_APP_SAMPLE_MERGE_LATENCY_MS)
+            {
+                return;
+            }
+        }
+        if (!merge_pop())
+        {
+            return;
+        }
+    }
+}
+
+static void merge_push(const struct sample_log_entry *entry, int64_t now)
+{
+    const struct sensor_desc *desc = &sensor_registry[entry->sensor];
+    struct merge_stream *st = &streams[entry->sensor];
+    uint64_t time_us = entry->time_us;
+    struct merge_sample *tail;
+
+    st->rx_ms = now;
+    if (st->count > 0)
+    {
+        tail = &st->queue[(st->head + st->count - 1) % SAMPLE_MERGE_DEPTH];
+    }
+    else
+    {
+        tail = st->has_last ? &st->last : NULL;
+    }
+    if ((tail != NULL && time_us <= tail->time_us) || time_us < merged_us)
+    {
+        stats.late++;
+        return;
+    }
+
+    while (st->count == SAMPLE_MERGE_DEPTH)
+    {
+        merge_pop();
+        stats.forced++;
+    }
+    tail = &st->queue[(st->head + st->count) % SAMPLE_MERGE_DEPTH];
+    tail->time_us = time_us;
+    memcpy(tail->data, entry->data, desc->sample_size);
+    st->count++;
+}
+
+static void sample_merge_thread(void *arg1, void *arg2, void *arg3)
+{
+    ARG_UNUSED(arg1);
+    ARG_UNUSED(arg2);
+    ARG_UNUSED(arg3);
+    struct sample_log_entry entry;
+
+    sample_log_attach(&merge_cursor, "merge");
+    merge_start(k_uptime_get());
+
+    while (1)
+    {
+        if (atomic_cas(&reset_pending, 1, 0))
+        {
+            /* What is still in the log counted frames before the reset */
+            while (sample_log_read(&merge_cursor, &entry) == 0)
+            {
+            }
+            merge_start(k_uptime_get());
+        }
+
+        while (sample_log_read(&merge_cursor, &entry) == 0)
+        {
+            merge_push(&entry, k_uptime_get());
+            merge_drain(k_uptime_get());
+        }
+        merge_drain(k_uptime_get());
+        merge_flush();
+
+        sample_log_wait(&merge_cursor, K_MSEC(SAMPLE_PIPELINE_PERIOD_MS));
+    }
+}
+
+int sample_merge_init(void)
+{
+    k_tid_t tid;
+
+    tid = k_thread_create(&sample_merge_thread_data, sample_merge_stack,
+                          K_THREAD_STACK_SIZEOF(sample_merge_stack), sample_merge_thread, NULL,
+                          NULL, NULL, SAMPLE_MERGE_PRIORITY, 0, K_NO_WAIT);
+    if (!tid)
+    {
+        printk("ERROR spawning sample merge thread\n");
+        return -EIO;
+    }
+    k_thread_name_set(tid, "sample_merge");
+
+    return 0;
+}
+
+void sample_merge_reset(void)
+{
+    atomic_set(&reset_pending, 1);
+}
+
+void sample_merge_attach(struct sample_merge_cursor *cursor, const char *name)
+{
+    atomic_val_t slot = atomic_inc(&num_cursors);
+
+    cursor->name = name;
+    cursor->seq = (uint32_t)atomic_get(&rows_head);
+    cursor->reads = 0;
+    cursor->lost = 0;
+    k_sem_init(&cursor->wake, 0, 1);
+
+    __ASSERT(slot < SAMPLE_MERGE_CURSORS_MAX, "too many merged row cursors");
+    if (slot < SAMPLE_MERGE_CURSORS_MAX)
+    {
+        cursors[slot] = cursor;
+    }
+}
+
+/* Copy of row seq, false if it was overwritten before or while copying */
+static bool merge_copy_row(uint32_t seq, struct sample_merge_row *row)
+{
+    /* The slot of head itself may be half written already */
+    if ((uint32_t)atomic_get(&rows_head) - seq > SAMPLE_MERGE_ROWS - 1)
+    {
+        return false;
+    }
+    *row = merge_rows[seq & SAMPLE_MERGE_ROW_MASK];
+    return (uint32_t)atomic_get(&rows_head) - seq <= SAMPLE_MERGE_ROWS - 1;
+}
+
+int sample_merge_read(struct sample_merge_cursor *cursor, struct sample_merge_row *row)
+{
+    while (1)
+    {
+        uint32_t head = (uint32_t)atomic_get(&rows_head);
+        uint32_t lag = head - cursor->seq;
+
+        if (lag == 0)
+        {
+            return -EAGAIN;
+        }
+        if (lag > SAMPLE_MERGE_ROWS - 1)
+        {
+            cursor->lost += lag - (SAMPLE_MERGE_ROWS - 1);
+            cursor->seq = head - (SAMPLE_MERGE_ROWS - 1);
+        }
+        if (merge_copy_row(cursor->seq, row))
+        {
+            cursor->seq++;
+            cursor->reads++;
+            return 0;
+        }
+    }
+}
+
+int sample_merge_wait(struct sample_merge_cursor *cursor, k_timeout_t timeout)
+{
+    return k_sem_take(&cursor->wake, timeout);
+}
+
+int sample_merge_latest(struct sample_merge_row *row)
+{
+    while (1)
+    {
+        uint32_t head = (uint32_t)atomic_get(&rows_head);
+
+        if (head == 0)
+        {
+            return -EAGAIN;
+        }
+        if (merge_copy_row(head - 1, row))
+        {
+            return 0;
+        }
+    }
+}
+
+static int cmd_hub_merge(const struct shell *sh, size_t argc, char **argv)
+{
+    struct sample_merge_row row;
+
+    for (size_t i = 1; i < argc; i++)
+    {
+        unsigned long rate = strtoul(argv[i], NULL, 10);
+
+        if (strcmp(argv[i], "hold") == 0 || strcmp(argv[i], "linear") == 0)
+        {
+            atomic_set(&row_linear, strcmp(argv[i], "linear") == 0);
+        }
+        else if (rate >= 1 && rate <= SAMPLE_MERGE_RATE_MAX)
+        {
+            atomic_set(&row_rate_hz, rate);
+        }
+        else
+        {
+            shell_error(sh, "usage: hub merge [<rows per second>] [hold|linear]");
+            return -EINVAL;
+        }
+    }
+
+    shell_print(sh, "%u rows/s, %s, latency %u ms", (uint32_t)atomic_get(&row_rate_hz),
+                atomic_get(&row_linear) ? "linear" : "hold", CONFIG_APP_SAMPLE_MERGE_LATENCY_MS);
+    shell_print(sh, "%u rows, %u skipped; samples %u forced, %u late", stats.rows,
+                stats.skipped_rows, stats.forced, stats.late);
+    for (atomic_val_t i = 0; i < MIN(atomic_get(&num_cursors), SAMPLE_MERGE_CURSORS_MAX); i++)
+    {
+        const struct sample_merge_cursor *c = cursors[i];
+
+        shell_print(sh, "  %-8s %u read, %u behind, %u lost", c->name, c->reads,
+                    (uint32_t)atomic_get(&rows_head) - c->seq, c->lost);
+    }
+    if (sample_merge_latest(&row) != 0)
+    {
+        return 0;
+    }
+    shell_print(sh, "latest row at %llu us:", row.time_us);
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        const struct sensor_desc *desc = &sensor_registry[i];
+        const struct merge_stream *st = &streams[i];
+
+        for (uint8_t f = 0; f < st->num_fields; f++)
+        {
+            char value[TEXT_NUM_MAX + 1];
+
+            value[text_put_fixed(value, row.value[st->column + f], 4)] = '\0';
+            shell_print(sh, "  %-4s %-9s %12s%s", desc->key, desc->fields[f].name, value,
+                        (row.valid & BIT(i)) ? "" : " (stale)");
+        }
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), merge, NULL, "Merged rows of all sensors, rate and interpolation",
+                 cmd_hub_merge, 1, 2);
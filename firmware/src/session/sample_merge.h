@@ -0,0 +1,128 @@
+#ifndef SAMPLE_MERGE_H
+#define SAMPLE_MERGE_H
+#include <errno.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include "sensors/sensor_registry.h"
+
+/*
+ * Sample merger, all sensors side by side on one timebase.
+ *
+ * Every sample comes with its hub time on the mainhub clock (hub_sync.h),
+ * so the sensors of both hubs line up. The merger reads the sample log on
+ * its own cursor, queues up to SAMPLE_MERGE_DEPTH samples per sensor and
+ * takes them in time order across the sensors, a k-way merge. Each
+ * multiple of the row period the merge passes becomes a row with every
+ * field of every sensor at that time: the last sample before it held, or
+ * the line between the samples around it.
+ *
+ * A row waits until every sensor has a sample past it. A sensor that sent
+ * nothing for CONFIG_APP_SAMPLE_MERGE_LATENCY_MS is not waited for and a
+ * full queue gives up its oldest sample at once, so both the memory and the
+ * delay of a row are bounded.
+ *
+ * Rows go to a ring of SAMPLE_MERGE_ROWS read like the sample log: every
+ * consumer (live plotting, analytics) attaches its own cursor and loses
+ * nothing while it keeps up. A consumer that falls a whole ring behind
+ * skips ahead and counts the rows it missed, the merger never waits.
+ */
+
+/* Samples queued per sensor */
+#define SAMPLE_MERGE_DEPTH 32
+/* Fields in a row, of all sensors in registry order */
+#define SAMPLE_MERGE_COLUMNS_MAX 16
+/* Rows in the ring, power of two */
+#define SAMPLE_MERGE_ROWS 32
+/* Attached cursors */
+#define SAMPLE_MERGE_CURSORS_MAX 2
+
+BUILD_ASSERT(SENSOR_COUNT <= 8, "valid mask of struct sample_merge_row");
+
+struct sample_merge_row
+{
+    uint64_t time_us; /* mainhub clock, see can_rx_time_now() */
+    uint8_t valid;    /* BIT(sensor) if its fields are current */
+    float value[SAMPLE_MERGE_COLUMNS_MAX];
+};
+
+/* A cursor belongs to one consumer thread */
+struct sample_merge_cursor
+{
+    const char *name;
+    uint32_t seq; /* next row to read */
+    struct k_sem wake;
+
+    uint32_t reads;
+    uint32_t lost;
+};
+
+#if defined(CONFIG_APP_SAMPLE_MERGE)
+
+/**
+ * @brief Start the merge thread
+ */
+int sample_merge_init(void);
+
+/**
+ * @brief Start over on a new timebase, with the frame counters of a session
+ */
+void sample_merge_reset(void);
+
+/**
+ * @brief Start reading at the next row merged
+ */
+void sample_merge_attach(struct sample_merge_cursor *cursor, const char *name);
+
+/**
+ * @brief Take the next row
+ *
+ * @return 0, -EAGAIN if the cursor is at the newest row
+ */
+int sample_merge_read(struct sample_merge_cursor *cursor, struct sample_merge_row *row);
+
+/**
+ * @brief Wait for new rows after the cursor ran empty
+ */
+int sample_merge_wait(struct sample_merge_cursor *cursor, k_timeout_t timeout);
+
+/**
+ * @brief Copy of the latest merged row
+ *
+ * @return 0, -EAGAIN before the first row
+ */
+int sample_merge_latest(struct sample_merge_row *row);
+
+#else
+
+static inline int sample_merge_init(void)
+{
+    return 0;
+}
+
+static inline void sample_merge_reset(void)
+{
+}
+
+static inline void sample_merge_attach(struct sample_merge_cursor *cursor, const char *name)
+{
+}
+
+static inline int sample_merge_read(struct sample_merge_cursor *cursor,
+                                    struct sample_merge_row *row)
+{
+    return -ENOTSUP;
+}
+
+static inline int sample_merge_wait(struct sample_merge_cursor *cursor, k_timeout_t timeout)
+{
+    return -ENOTSUP;
+}
+
+static inline int sample_merge_latest(struct sample_merge_row *row)
+{
+    return -ENOTSUP;
+}
+
+#endif /* CONFIG_APP_SAMPLE_MERGE */
+
+#endif /* SAMPLE_MERGE_H */
@@ -0,0 +1,228 @@
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include "sample_pipeline.h"
+#include "sample_log.h"
+#include "sample_merge.h"
+#include "can/can_transport.h"
+#include "can/sample_seq.h"
+#include "sdcard/sdcard_module.h"
+
+#define SAMPLE_PIPELINE_STACK_SIZE 2048
+/* Below CAN ingest and the hub commands */
+#define SAMPLE_PIPELINE_PRIORITY 6
+
+/* Samples taken off one ring per pass */
+#define SAMPLE_BATCH_MAX 32
+
+enum sample_pipeline_stage
+{
+    STAGE_TAKE,    /* ring and reorder window */
+    STAGE_PUBLISH, /* copies into the sample log */
+    STAGE_RELEASE, /* slots back to the slab */
+    STAGE_FILE,    /* session file sink */
+    STAGE_COUNT,
+};
+
+static const char *const stage_names[STAGE_COUNT] = {
+    [STAGE_TAKE] = "take",
+    [STAGE_PUBLISH] = "publish",
+    [STAGE_RELEASE] = "release",
+    [STAGE_FILE] = "file",
+};
+
+struct sample_pipeline_stats
+{
+    uint64_t cycles[STAGE_COUNT];
+    uint32_t max_cycles[STAGE_COUNT];
+    uint32_t passes;
+    uint32_t samples;
+    uint32_t max_batch;
+    uint32_t fill_wakeups;
+    uint32_t period_wakeups;
+};
+
+K_THREAD_STACK_DEFINE(sample_pipeline_stack, SAMPLE_PIPELINE_STACK_SIZE);
+static struct k_thread sample_pipeline_thread_data;
+static K_SEM_DEFINE(sample_pipeline_wake, 0, 1);
+
+/* Set at session start, the pipeline drops its reorder state */
+static atomic_t reorder_reset_pending;
+
+/* Owned by the pipeline thread */
+static void *sample_batch[SAMPLE_BATCH_MAX];
+static void *ordered_batch[SAMPLE_REORDER_WINDOW + SAMPLE_BATCH_MAX];
+static struct sample_pipeline_stats stats;
+
+/* Retransmitted frames are put back in order before they are written */
+static struct sample_reorder sample_reorders[SENSOR_COUNT] = {
+    [0 ... SENSOR_COUNT - 1] = {.release = can_sample_release},
+};
+
+void sample_pipeline_notify(struct sample_ring *ring)
+{
+    /* Only the put that reaches the mark wakes, not every one above it */
+    if (sample_ring_used(ring) == SAMPLE_PIPELINE_WAKE_FILL)
+    {
+        k_sem_give(&sample_pipeline_wake);
+    }
+}
+
+void sample_pipeline_reset(void)
+{
+    atomic_set(&reorder_reset_pending, 1);
+    sample_merge_reset();
+}
+
+static void stage_account(enum sample_pipeline_stage stage, uint32_t start)
+{
+    uint32_t cycles = k_cycle_get_32() - start;
+
+    stats.cycles[stage] += cycles;
+    stats.max_cycles[stage] = MAX(stats.max_cycles[stage], cycles);
+}
+
+/* One pass over all rings, true if a ring had more than one batch queued */
+static bool sample_pipeline_drain(void)
+{
+    bool reset = atomic_cas(&reorder_reset_pending, 1, 0);
+    int64_t now = k_uptime_get();
+    bool more = false;
+
+    /* Drain even when no session runs so the sample slots are recycled */
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        const struct sensor_desc *desc = &sensor_registry[i];
+        uint32_t start = k_cycle_get_32();
+        size_t taken;
+        size_t num;
+
+        if (reset)
+        {
+            sample_reorder_reset(&sample_reorders[i]);
+        }
+
+        taken = sample_ring_get_batch(desc->ring, sample_batch, SAMPLE_BATCH_MAX);
+        num = sample_reorder_process(&sample_reorders[i], sample_batch, taken, ordered_batch,
+                                     now);
+        stage_account(STAGE_TAKE, start);
+        more |= taken == SAMPLE_BATCH_MAX;
+
+        if (num == 0)
+        {
+            continue;
+        }
+
+        start = k_cycle_get_32();
+        for (size_t j = 0; j < num; j++)
+        {
+            sample_log_publish(desc, ordered_batch[j]);
+        }
+        stage_account(STAGE_PUBLISH, start);
+
+        start = k_cycle_get_32();
+        for (size_t j = 0; j < num; j++)
+        {
+            can_sample_release(ordered_batch[j]);
+        }
+        stage_account(STAGE_RELEASE, start);
+
+        stats.samples += num;
+        stats.max_batch = MAX(stats.max_batch, num);
+
+        /* The file sink keeps up batch by batch, the others by their cursors */
+        start = k_cycle_get_32();
+        session_file_sink_poll();
+        stage_account(STAGE_FILE, start);
+    }
+    sample_log_flush();
+    session_log_poll();
+    stats.passes++;
+
+    return more;
+}
+
+static void sample_pipeline_thread(void *arg1, void *arg2, void *arg3)
+{
+    ARG_UNUSED(arg1);
+    ARG_UNUSED(arg2);
+    ARG_UNUSED(arg3);
+
+    while (1)
+    {
+        if (k_sem_take(&sample_pipeline_wake, K_MSEC(SAMPLE_PIPELINE_PERIOD_MS)) == 0)
+        {
+            stats.fill_wakeups++;
+        }
+        else
+        {
+            stats.period_wakeups++;
+        }
+
+        while (sample_pipeline_drain())
+        {
+        }
+    }
+}
+
+int sample_pipeline_init(void)
+{
+    k_tid_t tid;
+
+    tid = k_thread_create(&sample_pipeline_thread_data, sample_pipeline_stack,
+                          K_THREAD_STACK_SIZEOF(sample_pipeline_stack),
+                          sample_pipeline_thread, NULL, NULL, NULL,
+                          SAMPLE_PIPELINE_PRIORITY, 0, K_NO_WAIT);
+    if (!tid)
+    {
+        printk("ERROR spawning sample pipeline thread\n");
+        return -EIO;
+    }
+    k_thread_name_set(tid, "sample_pipe");
+
+    return sample_merge_init();
+}
+
+static int cmd_hub_reorder(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-6s %8s %9s %8s %8s", "stream", "held", "reordered", "lost", "stale");
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        struct sample_reorder *ro = &sample_reorders[i];
+
+        shell_print(sh, "%-6s %8u %9u %8u %8u", sensor_registry[i].key, ro->pending,
+                    ro->reordered, ro->lost, ro->stale);
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), reorder, NULL, "Reorder window counters per sample stream",
+                 cmd_hub_reorder, 1, 0);
+
+static int cmd_hub_pipeline(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%u passes, %u samples, largest batch %u", stats.passes, stats.samples,
+                stats.max_batch);
+    shell_print(sh, "wakeups: %u on ring fill, %u on period", stats.fill_wakeups,
+                stats.period_wakeups);
+    shell_print(sh, "%-8s %10s %10s %8s", "stage", "total us", "ns/sample", "max us");
+    for (size_t i = 0; i < STAGE_COUNT; i++)
+    {
+        uint64_t total_ns = k_cyc_to_ns_floor64(stats.cycles[i]);
+
+        shell_print(sh, "%-8s %10llu %10llu %8u", stage_names[i], total_ns / 1000,
+                    stats.samples ? total_ns / stats.samples : 0,
+                    k_cyc_to_us_floor32(stats.max_cycles[i]));
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), pipeline, NULL, "Sample pipeline batches and stage timings",
+                 cmd_hub_pipeline, 1, 0);
@@ -0,0 +1,41 @@
+#ifndef SAMPLE_PIPELINE_H
+#define SAMPLE_PIPELINE_H
+#include "can/sample_ring.h"
+#include "sensors/sensor_registry.h"
+
+/*
+ * Sample pipeline.
+ *
+ * One thread takes the samples of every sensor ring, puts retransmitted
+ * frames back in order, publishes them once to the sample log
+ * (sample_log.h), where every sink reads them, and releases the slots.
+ * It wakes when a ring fills up to SAMPLE_PIPELINE_WAKE_FILL or at the
+ * latest every SAMPLE_PIPELINE_PERIOD_MS, and keeps draining while rings
+ * return full batches. Encoding never runs in interrupt context.
+ */
+
+/* Longest a sample waits on its ring at low rates */
+#define SAMPLE_PIPELINE_PERIOD_MS 10
+/* Ring fill that wakes the pipeline before the period is over */
+#define SAMPLE_PIPELINE_WAKE_FILL (SENSOR_RING_SIZE / 2)
+
+/**
+ * @brief Start the pipeline thread
+ */
+int sample_pipeline_init(void);
+
+/**
+ * @brief Tell the pipeline a sample was put on @p ring
+ *
+ * Called by the ring producer after every put, from a thread or an ISR.
+ */
+void sample_pipeline_notify(struct sample_ring *ring);
+
+/**
+ * @brief Drop the reorder state before the next batch
+ *
+ * The hubs restart their frame counters with a session.
+ */
+void sample_pipeline_reset(void);
+
+#endif /* SAMPLE_PIPELINE_H */
@@ -0,0 +1,404 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include "sample_sub.h"
+
+static const char *const sink_names[SAMPLE_SINK_COUNT] = {
+    [SAMPLE_SINK_SD] = "sd",
+    [SAMPLE_SINK_USB] = "usb",
+    [SAMPLE_SINK_BLE] = "ble",
+};
+
+static const char *const agg_names[SAMPLE_AGG_COUNT] = {
+    [SAMPLE_AGG_LAST] = "last",
+    [SAMPLE_AGG_MEAN] = "mean",
+    [SAMPLE_AGG_MIN] = "min",
+    [SAMPLE_AGG_MAX] = "max",
+};
+
+static struct sample_sub subs[SAMPLE_SINK_COUNT][SENSOR_COUNT];
+static struct k_spinlock subs_lock;
+/* Bumped on every change, the filters copy their row again */
+static atomic_t subs_gen = ATOMIC_INIT(1);
+
+static int sample_sub_defaults(void)
+{
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        uint8_t sinks = sensor_registry[i].sinks;
+
+        if (sinks & SENSOR_SINK_SD)
+        {
+            subs[SAMPLE_SINK_SD][i].decimate = 1;
+        }
+        if (sinks & (SENSOR_SINK_USB | SENSOR_SINK_LIVE))
+        {
+            subs[SAMPLE_SINK_USB][i].decimate = 1;
+        }
+        if (sinks & SENSOR_SINK_LIVE)
+        {
+            subs[SAMPLE_SINK_USB][i].flags |= SAMPLE_SUB_ALWAYS;
+        }
+    }
+    return 0;
+}
+
+SYS_INIT(sample_sub_defaults, APPLICATION, 0);
+
+static void field_put(const struct sample_field *field, uint8_t *sample, double value)
+{
+    uint8_t *p = sample + field->offset;
+    uint16_t u16;
+    float f;
+
+    switch (field->type)
+    {
+    case SAMPLE_FIELD_U8:
+        *p = (uint8_t)(value + 0.5);
+        break;
+    case SAMPLE_FIELD_U16:
+        u16 = (uint16_t)(value + 0.5);
+        memcpy(p, &u16, sizeof(u16));
+        break;
+    default:
+        f = (float)value;
+        memcpy(p, &f, sizeof(f));
+        break;
+    }
+}
+
+static void acc_add(struct sample_sub_acc *acc, const struct sensor_desc *desc,
+                    const uint8_t *sample)
+{
+    uint8_t num_fields = MIN(desc->num_fields, SAMPLE_SUB_FIELDS_MAX);
+
+    for (uint8_t i = 0; i < num_fields; i++)
+    {
+        float v = sample_field_value(&desc->fields[i], sample);
+
+        if (acc->num == 0)
+        {
+            acc->sum[i] = v;
+            acc->min[i] = v;
+            acc->max[i] = v;
+        }
+        else
+        {
+            acc->sum[i] += v;
+            acc->min[i] = MIN(acc->min[i], v);
+            acc->max[i] = MAX(acc->max[i], v);
+        }
+    }
+    acc->num++;
+}
+
+/* The latest sample with its fields replaced by the aggregate */
+static void acc_take(struct sample_sub_acc *acc, const struct sensor_desc *desc, uint8_t agg,
+                     uint8_t *sample)
+{
+    uint8_t num_fields = MIN(desc->num_fields, SAMPLE_SUB_FIELDS_MAX);
+
+    for (uint8_t i = 0; i < num_fields; i++)
+    {
+        double v;
+
+        switch (agg)
+        {
+        case SAMPLE_AGG_MEAN:
+            v = acc->sum[i] / acc->num;
+            break;
+        case SAMPLE_AGG_MIN:
+            v = acc->min[i];
+            break;
+        default:
+            v = acc->max[i];
+            break;
+        }
+        field_put(&desc->fields[i], sample, v);
+    }
+    acc->num = 0;
+}
+
+static void filter_reload(struct sample_sub_filter *filter, uint32_t gen)
+{
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+
+    memcpy(filter->sub, subs[filter->sink], sizeof(filter->sub));
+    k_spin_unlock(&subs_lock, key);
+
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        filter->acc[i].num = 0;
+        /* The first sample at any rate passes */
+        filter->acc[i].has_last = false;
+    }
+    filter->gen = gen;
+}
+
+void sample_sub_filter_init(struct sample_sub_filter *filter, enum sample_sink sink)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->sink = sink;
+}
+
+bool sample_sub_filter(struct sample_sub_filter *filter, const struct sample_log_entry *in,
+                       struct sample_log_entry *out, bool session)
+{
+    uint32_t gen = (uint32_t)atomic_get(&subs_gen);
+    const struct sensor_desc *desc = &sensor_registry[in->sensor];
+    const struct sample_sub *sub = &filter->sub[in->sensor];
+    struct sample_sub_acc *acc = &filter->acc[in->sensor];
+    bool take;
+
+    if (gen != filter->gen)
+    {
+        filter_reload(filter, gen);
+    }
+    if ((sub->decimate == 0 && sub->rate_hz == 0) ||
+        (!session && !(sub->flags & SAMPLE_SUB_ALWAYS)))
+    {
+        acc->num = 0;
+        return false;
+    }
+
+    /* Every sample passes, nothing to count */
+    if (sub->rate_hz == 0 && sub->decimate == 1)
+    {
+        filter->passed++;
+        if (out != in)
+        {
+            *out = *in;
+        }
+        return true;
+    }
+
+    if (sub->agg != SAMPLE_AGG_LAST)
+    {
+        acc_add(acc, desc, in->data);
+    }
+    else
+    {
+        acc->num++;
+    }
+
+    if (sub->rate_hz != 0)
+    {
+        /* By sample time, a batch or backlog drained at once keeps its rate */
+        uint64_t period_us = USEC_PER_SEC / sub->rate_hz;
+        bool on_time = acc->has_last && in->time_us >= acc->last_us;
+
+        take = !on_time || in->time_us - acc->last_us >= period_us;
+        if (take)
+        {
+            /* Keep to the period unless a gap or a clock restart came between */
+            acc->last_us = on_time && in->time_us - acc->last_us < 2 * period_us
+                               ? acc->last_us + period_us
+                               : in->time_us;
+            acc->has_last = true;
+        }
+    }
+    else
+    {
+        take = acc->num >= sub->decimate;
+    }
+
+    if (!take)
+    {
+        filter->folded++;
+        return false;
+    }
+
+    if (out != in)
+    {
+        *out = *in;
+    }
+    if (sub->agg != SAMPLE_AGG_LAST)
+    {
+        acc_take(acc, desc, sub->agg, out->data);
+    }
+    acc->num = 0;
+    filter->passed++;
+    return true;
+}
+
+int sample_sub_set(enum sample_sink sink, int sensor, const struct sample_sub *sub)
+{
+    k_spinlock_key_t key;
+
+    if ((unsigned int)sink >= SAMPLE_SINK_COUNT || sensor < -1 || sensor >= SENSOR_COUNT ||
+        sub->decimate > SAMPLE_SUB_DECIMATE_MAX || sub->rate_hz > SAMPLE_SUB_RATE_MAX ||
+        sub->agg >= SAMPLE_AGG_COUNT)
+    {
+        return -EINVAL;
+    }
+
+    key = k_spin_lock(&subs_lock);
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensor < 0 || i == (size_t)sensor)
+        {
+            subs[sink][i] = *sub;
+        }
+    }
+    k_spin_unlock(&subs_lock, key);
+    atomic_inc(&subs_gen);
+
+    return 0;
+}
+
+int sample_sub_sensor_by_stream(uint8_t stream_id)
+{
+    for (size_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensor_registry[i].stream_id == stream_id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int name_index(const char *const *names, size_t num, const char *name)
+{
+    for (size_t i = 0; i < num; i++)
+    {
+        if (strcmp(names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int sample_sub_parse(size_t argc, char **argv)
+{
+    struct sample_sub sub = {0};
+    int sink;
+    int sensor = -1;
+    char *end;
+    unsigned long value;
+
+    if (argc < 3)
+    {
+        return -EINVAL;
+    }
+
+    sink = name_index(sink_names, SAMPLE_SINK_COUNT, argv[0]);
+    if (strcmp(argv[1], "all") != 0)
+    {
+        sensor = -2;
+        for (size_t i = 0; i < SENSOR_COUNT; i++)
+        {
+            if (strcmp(sensor_registry[i].key, argv[1]) == 0)
+            {
+                sensor = i;
+            }
+        }
+    }
+    if (sink < 0 || sensor == -2)
+    {
+        return -EINVAL;
+    }
+
+    if (strcmp(argv[2], "off") != 0)
+    {
+        value = strtoul(argv[2], &end, 10);
+        if (end == argv[2] || value == 0 || value > UINT16_MAX)
+        {
+            return -EINVAL;
+        }
+        if (strcmp(end, "hz") == 0)
+        {
+            sub.rate_hz = value;
+        }
+        else if (*end == '\0')
+        {
+            sub.decimate = value;
+        }
+        else
+        {
+            return -EINVAL;
+        }
+    }
+
+    for (size_t i = 3; i < argc; i++)
+    {
+        int agg = name_index(agg_names, SAMPLE_AGG_COUNT, argv[i]);
+
+        if (agg >= 0)
+        {
+            sub.agg = agg;
+        }
+        else if (strcmp(argv[i], "always") == 0)
+        {
+            sub.flags |= SAMPLE_SUB_ALWAYS;
+        }
+        else
+        {
+            return -EINVAL;
+        }
+    }
+
+    return sample_sub_set(sink, sensor, &sub);
+}
+
+int sample_sub_format(enum sample_sink sink, size_t sensor, char *buf, size_t len)
+{
+    struct sample_sub sub;
+    char setting[12];
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+
+    sub = subs[sink][sensor];
+    k_spin_unlock(&subs_lock, key);
+
+    if (sub.rate_hz != 0)
+    {
+        snprintf(setting, sizeof(setting), "%uhz", sub.rate_hz);
+    }
+    else if (sub.decimate != 0)
+    {
+        snprintf(setting, sizeof(setting), "%u", sub.decimate);
+    }
+    else
+    {
+        strcpy(setting, "off");
+    }
+
+    return snprintf(buf, len, "%s,%s,%s,%s%s", sink_names[sink], sensor_registry[sensor].key,
+                    setting, agg_names[sub.agg],
+                    (sub.flags & SAMPLE_SUB_ALWAYS) ? ",always" : "");
+}
+
+static int cmd_hub_sub(const struct shell *sh, size_t argc, char **argv)
+{
+    char line[48];
+
+    if (argc > 1)
+    {
+        int ret = sample_sub_parse(argc - 1, &argv[1]);
+
+        if (ret != 0)
+        {
+            shell_error(sh, "usage: hub sub <sd|usb|ble> <sensor|all> <n|<n>hz|off> "
+                            "[last|mean|min|max] [always]");
+            return ret;
+        }
+    }
+
+    for (size_t sink = 0; sink < SAMPLE_SINK_COUNT; sink++)
+    {
+        for (size_t i = 0; i < SENSOR_COUNT; i++)
+        {
+            sample_sub_format(sink, i, line, sizeof(line));
+            shell_print(sh, "%s", line);
+        }
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((hub), sub, NULL, "Show or change which samples each sink takes", cmd_hub_sub,
+                 1, 5);
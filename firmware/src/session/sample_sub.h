@@ -0,0 +1,118 @@
+#ifndef SAMPLE_SUB_H
+#define SAMPLE_SUB_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "sample_log.h"
+
+/*
+ * Sample subscriptions, which samples each sink takes from the sample log.
+ *
+ * Every sink has a subscription per sensor: every n-th sample or at most so
+ * many per second, each one either the latest sample or the mean, minimum or
+ * maximum of the fields since the one before. The sink applies it as it
+ * reads its cursor, before it encodes anything, so it never formats what it
+ * would throw away. The defaults come from the sinks of the sensor
+ * descriptor; the BLE preview starts with nothing.
+ *
+ * The table is changed at runtime by the "sub" command on USB, the
+ * CMD_COMMAND_SUBSCRIBE command over BLE and "hub sub" on the shell.
+ */
+
+enum sample_sink
+{
+    SAMPLE_SINK_SD,  /* session file */
+    SAMPLE_SINK_USB, /* CSV over the CDC port */
+    SAMPLE_SINK_BLE, /* preview notifications */
+    SAMPLE_SINK_COUNT,
+};
+
+enum sample_agg
+{
+    SAMPLE_AGG_LAST,
+    SAMPLE_AGG_MEAN,
+    SAMPLE_AGG_MIN,
+    SAMPLE_AGG_MAX,
+    SAMPLE_AGG_COUNT,
+};
+
+/* Also outside a session */
+#define SAMPLE_SUB_ALWAYS BIT(0)
+
+#define SAMPLE_SUB_DECIMATE_MAX 1000
+#define SAMPLE_SUB_RATE_MAX 1000
+/* Fields aggregated per sample, later ones pass the latest value */
+#define SAMPLE_SUB_FIELDS_MAX 8
+
+struct sample_sub
+{
+    uint16_t decimate; /* every n-th sample, 0 with rate_hz 0 is off */
+    uint16_t rate_hz;  /* at most this many per second, replaces decimate */
+    uint8_t agg;       /* enum sample_agg */
+    uint8_t flags;
+};
+
+/* Samples folded into the next one a sink takes */
+struct sample_sub_acc
+{
+    uint32_t num;
+    bool has_last;
+    uint64_t last_us; /* sample time the rate counts from */
+    double sum[SAMPLE_SUB_FIELDS_MAX];
+    float min[SAMPLE_SUB_FIELDS_MAX];
+    float max[SAMPLE_SUB_FIELDS_MAX];
+};
+
+/* Owned by the thread of one sink */
+struct sample_sub_filter
+{
+    enum sample_sink sink;
+    uint32_t gen;
+    struct sample_sub sub[SENSOR_COUNT];
+    struct sample_sub_acc acc[SENSOR_COUNT];
+
+    uint32_t passed;
+    uint32_t folded;
+};
+
+void sample_sub_filter_init(struct sample_sub_filter *filter, enum sample_sink sink);
+
+/**
+ * @brief Put a sample through the subscription of its sensor
+ *
+ * @param session true while a session runs
+ * @param out the sample to send when it returns true, may be @p in
+ *
+ * @return true if the sink takes a sample now
+ */
+bool sample_sub_filter(struct sample_sub_filter *filter, const struct sample_log_entry *in,
+                       struct sample_log_entry *out, bool session);
+
+/**
+ * @brief Change a subscription
+ *
+ * @param sensor index into sensor_registry, -1 for all sensors
+ *
+ * @return 0, -EINVAL for an unknown sink or sensor or a value out of range
+ */
+int sample_sub_set(enum sample_sink sink, int sensor, const struct sample_sub *sub);
+
+/* Index into sensor_registry of a stream, -1 if none */
+int sample_sub_sensor_by_stream(uint8_t stream_id);
+
+/**
+ * @brief Change a subscription from text
+ *
+ * <sink> <sensor|all> <n|<n>hz|off> [last|mean|min|max] [always], with
+ * the sink and sensor by their short names.
+ */
+int sample_sub_parse(size_t argc, char **argv);
+
+/**
+ * @brief One line of the table: sink,sensor,setting,aggregation[,always]
+ *
+ * @return the length like snprintf()
+ */
+int sample_sub_format(enum sample_sink sink, size_t sensor, char *buf, size_t len);
+
+#endif /* SAMPLE_SUB_H */
@@ -11,6 +11,8 @@
 #include <zephyr/drivers/uart.h>
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/usbd.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
 
 #include <zephyr/fs/fs.h>
 #include <zephyr/storage/disk_access.h>
@@ -22,8 +24,15 @@
 #include "ble/ble_protocol.h"
 #include "ble_notifications.h"
 #include "can/can_transport.h"
+#include "sensors/sensor_registry.h"
+#include "sensors/text_format.h"
 #include "sdcard/sdcard_module.h"
+#include "sdcard/session_catalog.h"
 #include "led_handler.h"
+#include "sample_pipeline.h"
+#include "sample_log.h"
+#include "sample_sub.h"
+#include "boot.h"
 
 /* External declaration for protocol test function */
 extern void test_ble_protocol(void);
@@ -35,27 +44,51 @@ extern void test_ble_protocol(void);
 #define BUF_SIZE 64
 #define START_CMD "start"
 #define STOP_CMD "stop"
+#define SESSIONS_CMD "sessions"
+#define SUB_CMD "sub"
 
 LOG_MODULE_REGISTER(session, LOG_LEVEL_INF);
 
 const struct device *const uart_dev = DEVICE_DT_GET_ONE(zephyr_cdc_acm_uart);
-K_THREAD_STACK_DEFINE(cdc_read_thread_stack, 1024);
+/* Reads the session catalog for the sessions command */
+K_THREAD_STACK_DEFINE(cdc_read_thread_stack, 2048);
 struct k_thread cdc_read_thread_stack_data;
 
-K_THREAD_STACK_DEFINE(cdc_write_thread_stack, 1024);
+/* Holds one CSV line */
+K_THREAD_STACK_DEFINE(cdc_write_thread_stack, 1536);
 struct k_thread cdc_write_thread_stack_data;
 
+K_THREAD_STACK_DEFINE(ble_sample_thread_stack, 1024);
+struct k_thread ble_sample_thread_data;
+
 /* Global connection tracking variables - declared at file scope */
 struct bt_conn *current_conn = NULL;
 bool is_connected = false;
 uint32_t connection_time = 0;           /* Time when connection was established */
 uint32_t connection_ready_delay = 2000; /* Delay in ms before sending notifications */
 
-static struct k_timer sample_timer;
-
 /* Global notification buffer and state */
 static uint8_t notify_buffer[244] = {0}; /* Increased from 20 to 64 bytes to accommodate protocol format */
 
+/* Rate limiter for notifications to prevent buffer overflow */
+#define MIN_NOTIFICATION_INTERVAL 100 /* Min 100ms between notifications for STM32H7 */
+/* Protocol notifications and ACKs, sample batches have their own budget */
+static uint32_t last_notification_time = 0;
+static uint32_t last_sample_notification_time = 0;
+
+/*
+ * ATT MTU of the connection, 0 without one. Cached by the connection
+ * callbacks so the sample thread never touches current_conn, which a
+ * disconnect can drop at any time.
+ */
+static atomic_t ble_mtu;
+
+/* Subscribed sample batches over BLE, for hub ble */
+static uint32_t ble_batches_sent;
+static uint32_t ble_batches_deferred;
+static uint32_t ble_batches_dropped;
+static uint32_t ble_samples_dropped;
+
 /* Forward declarations for CPR session management */
 bool is_cpr_session_active(void);
 void start_cpr_session(void);
@@ -157,8 +190,8 @@ static int send_command_ack(uint8_t cmd_byte)
  *    [6] BT_GATT_CHARACTERISTIC(...                            <-- CPR State Char
  */
 
-/* Helper function for checking connection and sending notifications */
-int send_notification_safely(const void *data, uint16_t len)
+/* Checks the connection and sends unless a notification went out on @p last_time too recently */
+static int send_notification_limited(const void *data, uint16_t len, uint32_t *last_time)
 {
     /* Index 4 is the notification characteristic value attribute, from counting in service definition */
     static const int NOTIFY_CHAR_INDEX = 4;
@@ -169,10 +202,6 @@ int send_notification_safely(const void *data, uint16_t len)
     /* Track last ENOTSUP warning time to avoid log spam */
     static uint32_t last_enotsup_warning = 0;
 
-    /* Rate limiter for notifications to prevent buffer overflow */
-    static uint32_t last_notification_time = 0;
-    static const uint32_t MIN_NOTIFICATION_INTERVAL = 100; /* Min 100ms between notifications for STM32H7 */
-
     /* We need extern declaration for custom_svc which is defined by BT_GATT_SERVICE_DEFINE macro */
     extern const struct bt_gatt_service_static custom_svc;
 
@@ -199,10 +228,9 @@ int send_notification_safely(const void *data, uint16_t len)
     }
 
     /* Check if we're sending notifications too quickly */
-    if (now - last_notification_time < MIN_NOTIFICATION_INTERVAL)
+    if (now - *last_time < MIN_NOTIFICATION_INTERVAL)
     {
-        LOG_DBG("Rate limiting notification, too soon after previous (%u ms)",
-                now - last_notification_time);
+        LOG_DBG("Rate limiting notification, too soon after previous (%u ms)", now - *last_time);
         return -EAGAIN;
     }
 
@@ -213,7 +241,7 @@ int send_notification_safely(const void *data, uint16_t len)
     /* Update last notification time if successful or if we encountered buffer issues */
     if (err == 0 || err == -ENOMEM)
     {
-        last_notification_time = now;
+        *last_time = now;
     }
 
     /* Handle any errors */
@@ -273,7 +301,7 @@ int send_notification_safely(const void *data, uint16_t len)
                 last_backoff_time = now_err;
             }
             /* Increase backoff time to 250ms to allow stack to recover */
-            last_notification_time = now + 200;
+            *last_time = now + 200;
         }
         else if (err == -BT_ATT_ERR_UNLIKELY || err == -ENOTCONN)
         {
@@ -286,6 +314,7 @@ int send_notification_safely(const void *data, uint16_t len)
             }
 
             /* Reset connection on critical errors */
+            atomic_clear(&ble_mtu);
             if (current_conn)
             {
                 bt_conn_unref(current_conn);
@@ -302,6 +331,25 @@ int send_notification_safely(const void *data, uint16_t len)
     return err;
 }
 
+/* Helper function for checking connection and sending notifications */
+int send_notification_safely(const void *data, uint16_t len)
+{
+    return send_notification_limited(data, len, &last_notification_time);
+}
+
+/*
+ * Sample batches do not use up the budget of protocol notifications and
+ * ACKs, and hold back for a period after one of those went out.
+ */
+static int send_sample_notification(const void *data, uint16_t len)
+{
+    if (k_uptime_get_32() - last_notification_time < MIN_NOTIFICATION_INTERVAL)
+    {
+        return -EAGAIN;
+    }
+    return send_notification_limited(data, len, &last_sample_notification_time);
+}
+
 /* Constants moved to ble_notifications.h */
 bool notify_enabled = false;
 static bool connection_notif_reset_needed = true; /* Track when we need to reset notification states */
@@ -363,39 +411,54 @@ void start_cpr_session(void)
     LOG_INF("Current state before start: active=%d, start_time=%u",
             cpr_session_active, cpr_session_start_time);
 
-    /* Safety check to prevent activation during system startup */
-    if (k_uptime_get_32() < 1000)
+    /* Sessions need the card or the QSPI flash, both mount in the background during boot */
+    const char *root = session_storage_root();
+
+    if (boot_wait(BIT(BOOT_STAGE_SD), K_NO_WAIT) != 0 || root == NULL)
     {
-        LOG_ERR("PREVENTING CPR session start during early boot (uptime < 1s)");
+        LOG_ERR("PREVENTING CPR session start, no session storage mounted");
         return;
     }
 
     /* Always start a new session */
     cpr_session_start_time = k_uptime_get_32();
+    /* Hubs restart their frame counters with the session */
+    sample_pipeline_reset();
     LOG_INF("CPR session started - timer initialized at %u", cpr_session_start_time);
 
     /* We'll send notification from the timer handler after detecting state change */
     /* This is safer because the timer handler has context to access BLE services */
     LOG_INF("CPR session start: Notification will be sent via timer handler");
-    char instructor_id[64];
+    char instructor_id[64] = "";
     get_instructor_id(instructor_id, sizeof(instructor_id));
-    char start_time[64];
-    get_time_data(start_time, sizeof(start_time));
+    char trainee_id[64] = "";
+    get_trainee_id(trainee_id, sizeof(trainee_id));
+    char start_time[64] = "";
+    get_rtc_time(start_time, sizeof(start_time));
+    int session_id = session_catalog_begin(instructor_id, trainee_id, start_time);
+    if (session_id < 0)
+    {
+        printk("Last session is still being closed\n");
+        return;
+    }
+    /* 8.3 names, S0001_00.bin and on */
     snprintf(session_file_name, sizeof(session_file_name),
-             "%s/cpr%d.csv\0", "/SD:", 0x01);
+             "%s/S%04u", root, session_id % 10000);
     printf("file_name: %s\n", session_file_name);
-    int ret = fs_open(&session_file, session_file_name, FS_O_CREATE | FS_O_WRITE);
+    int ret = open_session_file(session_file_name);
     if (ret < 0)
     {
         printk("Failed to create file: %d\n", ret);
+        session_catalog_abort();
         return;
     }
-    const char *csv_header = "sensor_name,frame_id,data0,data1,data2,data3,data4,data5,data6,data7\n";
-    ssize_t written = fs_write(&session_file, csv_header, strlen(csv_header));
-    if (written < 0)
+    /* Binary log in parts, tools/session_decode turns it into CSV */
+    ret = session_log_start();
+    if (ret < 0)
     {
-        printk("Failed to write CSV header: %d\n", (int)written);
-        fs_close(&session_file);
+        printk("Failed to write session header: %d\n", ret);
+        close_session_file();
+        session_catalog_abort();
         return;
     }
     cpr_session_active = true;
@@ -437,7 +500,8 @@ void stop_cpr_session(void)
     /* Reset session state */
     cpr_session_active = false;
     cpr_session_start_time = 0;
-    fs_close(&session_file);
+    /* The writer closes the file after the last block */
+    session_log_stop();
     /* Store elapsed time for notification via timer handler */
     LOG_INF("CPR session stop: Notification with duration %u seconds will be sent via timer handler", elapsed_sec);
 }
@@ -896,6 +960,7 @@ static void advertising_work_handler(struct k_work *work)
         {
             LOG_ERR("Advertising retry limit reached. Giving up after %d attempts", retry_count);
             retry_count = 0; /* Reset for next time */
+            boot_stage_end(BOOT_STAGE_ADV, err);
         }
     }
     else
@@ -903,6 +968,7 @@ static void advertising_work_handler(struct k_work *work)
         LOG_INF("Advertising started successfully after %d %s",
                 retry_count, retry_count == 0 ? "attempt" : "retries");
         retry_count = 0; /* Reset for next time */
+        boot_stage_end(BOOT_STAGE_ADV, 0);
     }
 }
 
@@ -924,10 +990,14 @@ static void bt_ready(int err)
     if (err)
     {
         LOG_ERR("Bluetooth init failed (err %d)", err);
+        boot_stage_end(BOOT_STAGE_BT, err);
+        boot_stage_end(BOOT_STAGE_ADV, err);
         return;
     }
 
     LOG_INF("Bluetooth initialized successfully");
+    boot_stage_end(BOOT_STAGE_BT, 0);
+    boot_stage_begin(BOOT_STAGE_ADV);
 
     /* The service is already registered automatically by BT_GATT_SERVICE_DEFINE */
     LOG_INF("GATT service ready");
@@ -958,11 +1028,15 @@ static void connected(struct bt_conn *conn, uint8_t err)
         bt_conn_unref(current_conn);
     }
     current_conn = bt_conn_ref(conn);
+    atomic_set(&ble_mtu, bt_gatt_get_mtu(conn));
     is_connected = true;
     connection_time = k_uptime_get_32(); /* Record when connection was established */
 
     /* Ensure CPR session is inactive when a new connection is established */
-    cpr_session_active = false;
+    if (cpr_session_active)
+    {
+        stop_cpr_session();
+    }
     cpr_session_start_time = 0;
 
     /* Reset notification tracking for all notification types on new connection */
@@ -989,6 +1063,7 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
     LOG_INF("**********************************************");
 
     /* Clear connection tracking */
+    atomic_clear(&ble_mtu);
     if (current_conn)
     {
         bt_conn_unref(current_conn);
@@ -1007,53 +1082,308 @@ static struct bt_conn_cb conn_callbacks = {
     .disconnected = disconnected,
 };
 
+/* The MTU exchange comes after the connection */
+static void att_mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
+{
+    ARG_UNUSED(rx);
+
+    if (conn == current_conn)
+    {
+        atomic_set(&ble_mtu, tx);
+    }
+}
+
+static struct bt_gatt_cb gatt_callbacks = {
+    .att_mtu_updated = att_mtu_updated,
+};
+
 
 /* Forward declaration for advertising timer */
 static void start_adv_with_delay(void);
 
+/* Whole lines only, the live CSV and the command answers share the port */
+static K_MUTEX_DEFINE(usb_write_lock);
+
+/*
+ * uart_fifo_fill() takes what fits in the CDC ring buffer, wait for room
+ * for the rest. A slow host shows up as lag of the caller.
+ */
+static int usb_write_all(const char *data, size_t len)
+{
+    int ret = 0;
+
+    k_mutex_lock(&usb_write_lock, K_FOREVER);
+    while (len > 0)
+    {
+        int written = uart_fifo_fill(uart_dev, (const uint8_t *)data, len);
+
+        if (written < 0)
+        {
+            ret = written;
+            break;
+        }
+        data += written;
+        len -= written;
+        if (len > 0)
+        {
+            k_msleep(1);
+        }
+    }
+    k_mutex_unlock(&usb_write_lock);
+
+    return ret;
+}
+
+/* One CSV line per finished session, read from the catalog in a few reads */
+static void send_session_list(void)
+{
+    static struct session_catalog_entry entries[4];
+    char line[128];
+
+    /* The live CSV waits until the list is out */
+    k_mutex_lock(&usb_write_lock, K_FOREVER);
+    for (uint32_t first = 0; first < session_catalog_count(); first += ARRAY_SIZE(entries))
+    {
+        int num = session_catalog_read(first, entries, ARRAY_SIZE(entries));
+
+        if (num < 0)
+        {
+            printk("Session catalog read failed: %d\n", num);
+            k_mutex_unlock(&usb_write_lock);
+            return;
+        }
+        for (int i = 0; i < num; i++)
+        {
+            int len = session_catalog_format(&entries[i], line, sizeof(line) - 1);
+
+            len = MIN(len, (int)sizeof(line) - 2);
+            line[len++] = '\n';
+            usb_write_all(line, len);
+        }
+    }
+    usb_write_all("end\n", strlen("end\n"));
+    k_mutex_unlock(&usb_write_lock);
+}
+
+/*
+ * "sub <sink> <sensor|all> <n|<n>hz|off> [last|mean|min|max] [always]"
+ * changes a subscription, then the whole table goes out like "sessions".
+ */
+static void process_sub_command(const char *cmd)
+{
+    char buf[BUF_SIZE + 1];
+    char *argv[8];
+    size_t argc = 0;
+    char *save;
+    char line[48];
+
+    strncpy(buf, cmd + strlen(SUB_CMD), sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for (char *tok = strtok_r(buf, " \r\n", &save); tok != NULL && argc < ARRAY_SIZE(argv);
+         tok = strtok_r(NULL, " \r\n", &save))
+    {
+        argv[argc++] = tok;
+    }
+
+    if (argc > 0 && sample_sub_parse(argc, argv) != 0)
+    {
+        usb_write_all("error\n", strlen("error\n"));
+        return;
+    }
+    k_mutex_lock(&usb_write_lock, K_FOREVER);
+    for (size_t sink = 0; sink < SAMPLE_SINK_COUNT; sink++)
+    {
+        for (size_t i = 0; i < SENSOR_COUNT; i++)
+        {
+            int len = sample_sub_format(sink, i, line, sizeof(line) - 1);
+
+            len = MIN(len, (int)sizeof(line) - 2);
+            line[len++] = '\n';
+            usb_write_all(line, len);
+        }
+    }
+    usb_write_all("end\n", strlen("end\n"));
+    k_mutex_unlock(&usb_write_lock);
+}
+
 /* LED timer handler */
 void process_command(const char *cmd)
 {
     if (strncmp(cmd, START_CMD, strlen(START_CMD)) == 0)
     {
         printk("CAN sending started\n");
-        uart_fifo_fill(uart_dev, "CAN sending started\n", strlen("CAN sending started\n"));
+        usb_write_all("CAN sending started\n", strlen("CAN sending started\n"));
         start_cpr_session();
         can_transmit_start_msg();
     }
     else if (strncmp(cmd, STOP_CMD, strlen(STOP_CMD)) == 0)
     {
         printk("CAN sending stopped\n");
-        uart_fifo_fill(uart_dev, "CAN sending stopped\n", strlen("CAN sending stopped\n"));
+        usb_write_all("CAN sending stopped\n", strlen("CAN sending stopped\n"));
         stop_cpr_session();
         can_transmit_stop_msg();
     }
+    else if (strncmp(cmd, SESSIONS_CMD, strlen(SESSIONS_CMD)) == 0)
+    {
+        send_session_list();
+    }
+    else if (strncmp(cmd, SUB_CMD, strlen(SUB_CMD)) == 0)
+    {
+        process_sub_command(cmd);
+    }
 }
-#define CSV_QUEUE_SIZE 25 // Number of queued lines
 #define CSV_LINE_MAX_LEN 256
-char line[128];
-K_MSGQ_DEFINE(csv_usb_msgq, CSV_LINE_MAX_LEN, CSV_QUEUE_SIZE, 4);
+
+/* Live CSV over USB, read from the sample log at the pace of the host */
 void cdc_write_thread(void *arg1, void *arg2, void *arg3)
 {
-    int written = 0;
-while (1) {
-    if (k_msgq_get(&csv_usb_msgq, &line, K_MSEC(1)) == 0) {
-        if (cpr_session_active) {
-            written = uart_fifo_fill(uart_dev, line, strlen(line));
-            if (written < 0) {
-                printk("USB Write failed: %d\n", written);
+    static struct sample_log_cursor usb_cursor;
+    static struct sample_sub_filter usb_filter;
+    struct sample_log_entry entry;
+    char line[CSV_LINE_MAX_LEN];
+
+    sample_log_attach(&usb_cursor, "usb");
+    sample_sub_filter_init(&usb_filter, SAMPLE_SINK_USB);
+    while (1)
+    {
+        if (sample_log_read(&usb_cursor, &entry) != 0)
+        {
+            sample_log_wait(&usb_cursor, K_MSEC(SAMPLE_PIPELINE_PERIOD_MS));
+            continue;
+        }
+
+        if (!sample_sub_filter(&usb_filter, &entry, &entry, cpr_session_active))
+        {
+            continue;
+        }
+
+        const struct sensor_desc *desc = &sensor_registry[entry.sensor];
+        /* Room for the receive time behind the fields */
+        int len = desc->format(desc, entry.data, line, sizeof(line) - 1 - TEXT_NUM_MAX);
+
+        if (len > 0)
+        {
+            /* us of uptime, low 32 bits */
+            line[len - 1] = ',';
+            len += text_put_u32(&line[len], (uint32_t)entry.rx_us);
+            line[len++] = '\n';
+
+            int err = usb_write_all(line, len);
+
+            if (err < 0)
+            {
+                printk("USB Write failed: %d\n", err);
             }
         }
     }
 }
 
+/* send_sample_notification() lets one batch out per 100 ms */
+#define BLE_SAMPLE_PERIOD_MS MIN_NOTIFICATION_INTERVAL
+
+/* Subscribed samples as they are, packed into one notification per period */
+void ble_sample_thread(void *arg1, void *arg2, void *arg3)
+{
+    static struct sample_log_cursor ble_cursor;
+    static struct sample_sub_filter ble_filter;
+    static uint8_t payload[sizeof(notify_buffer) - 6];
+    static uint8_t frame[sizeof(notify_buffer)];
+    struct sample_log_entry entry;
+    int64_t sent_at = 0;
+    size_t len = 0;
+    uint32_t count = 0;
+
+    sample_log_attach(&ble_cursor, "ble");
+    sample_sub_filter_init(&ble_filter, SAMPLE_SINK_BLE);
+    while (1)
+    {
+        if (sample_log_read(&ble_cursor, &entry) != 0)
+        {
+            sample_log_wait(&ble_cursor, K_MSEC(SAMPLE_PIPELINE_PERIOD_MS));
+        }
+        else if (is_connected && notify_enabled && atomic_get(&ble_mtu) > 3 + 6 &&
+                 sample_sub_filter(&ble_filter, &entry, &entry, cpr_session_active))
+        {
+            /* ATT header and the protocol frame around the payload */
+            size_t max = MIN(sizeof(payload), (size_t)atomic_get(&ble_mtu) - 3 - 6);
+            uint8_t size = sensor_registry[entry.sensor].sample_size;
+
+            /* The last batch could not go out in time, the newer one wins */
+            if (len + size + sizeof(uint32_t) > max)
+            {
+                ble_batches_dropped++;
+                ble_samples_dropped += count;
+                len = 0;
+                count = 0;
+            }
+            if (size + sizeof(uint32_t) <= max)
+            {
+                memcpy(&payload[len], entry.data, size);
+                sys_put_le32((uint32_t)entry.rx_us, &payload[len + size]);
+                len += size + sizeof(uint32_t);
+                count++;
+            }
+            else
+            {
+                ble_samples_dropped++;
+            }
+        }
+
+        if (len > 0 && k_uptime_get() - sent_at >= BLE_SAMPLE_PERIOD_MS)
+        {
+            int n = format_ble_command(frame, sizeof(frame), NOTIFY_TYPE_SAMPLES, payload, len);
+
+            sent_at = k_uptime_get();
+            if (n > 0)
+            {
+                int err = send_sample_notification(frame, n);
+
+                if (err == -EAGAIN)
+                {
+                    ble_batches_deferred++;
+                }
+                else
+                {
+                    if (err == 0)
+                    {
+                        ble_batches_sent++;
+                    }
+                    else
+                    {
+                        ble_batches_dropped++;
+                        ble_samples_dropped += count;
+                    }
+                    len = 0;
+                    count = 0;
+                }
+            }
+        }
+    }
+}
+
+static int cmd_hub_ble(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "sample batches: %u sent, %u deferred, %u dropped (%u samples)",
+                ble_batches_sent, ble_batches_deferred, ble_batches_dropped, ble_samples_dropped);
+
+    return 0;
 }
 
+SHELL_SUBCMD_ADD((hub), ble, NULL, "Subscribed samples sent over BLE", cmd_hub_ble, 1, 0);
+
 void cdc_read_thread(void *arg1, void *arg2, void *arg3)
 {
     uint8_t buf[BUF_SIZE];
     size_t len = 0;
 
+    /* Enumeration is left to this thread so it does not hold up boot */
+    boot_stage_begin(BOOT_STAGE_USB);
+    int err = usb_enable(NULL);
+    boot_stage_end(BOOT_STAGE_USB, err == -EALREADY ? 0 : err);
+
     while (1)
     {
         int r = uart_fifo_read(uart_dev, buf + len, BUF_SIZE - len);
@@ -1071,93 +1401,89 @@ void cdc_read_thread(void *arg1, void *arg2, void *arg3)
     }
 }
 
-static uint8_t vl_buf[512];
-static uint8_t ads_buf[512];
-static uint8_t bhi_buf[512];
-static uint8_t sdp_buf[512];
-static void notify_sample_handler(struct k_timer *timer)
+static void led_boot_flash_off(struct k_work *work)
 {
-    if (!cpr_session_active)
-    {
-        return;
-    }
+    led_off();
+}
 
-    // VL6180x
-    {
-        size_t bytes_read = ring_buf_get(&vl_ring, vl_buf, sizeof(vl_buf));
-        uint8_t num_samples = bytes_read / sizeof(sample_sensor1_t);
-        if (num_samples > 0)
-        {
-            write_vl_to_session_file((sample_sensor1_t *)vl_buf, num_samples);
-        }
-    }
+static K_WORK_DELAYABLE_DEFINE(led_boot_flash_work, led_boot_flash_off);
+
+/*
+ * Starts the session side without waiting on any of it: Bluetooth comes up
+ * in bt_ready(), the SD card mounts on the sd_writer thread and USB enables
+ * on the rx_usb thread. See boot.h.
+ */
+int session_init()
+{
+    int err;
+    k_tid_t tid;
+
+    /* Explicitly ensure CPR session is inactive on startup */
+    cpr_session_active = false;
+    cpr_session_start_time = 0;
+    LOG_INF("CPR session explicitly set to inactive on startup");
 
-    // SDP810
+    /* Initialize the message processor */
+    err = message_processor_init();
+    if (err)
     {
-        size_t bytes_read = ring_buf_get(&sdp_ring, sdp_buf, sizeof(sdp_buf));
-        uint8_t num_samples = bytes_read / sizeof(sample_sensor3_t);
-        if (num_samples > 0)
-        {
-            write_sdp_to_session_file((sample_sensor3_t *)sdp_buf, num_samples);
-        }
+        LOG_ERR("Message processor initialization failed (err %d)", err);
     }
-
-    // ADS7138
+    else
     {
-        size_t bytes_read = ring_buf_get(&ads_ring, ads_buf, sizeof(ads_buf));
-        uint8_t num_samples = bytes_read / sizeof(sample_sensor2_t);
-        if (num_samples > 0)
-        {
-            write_ads_to_session_file((sample_sensor2_t *)ads_buf, num_samples);
-        }
+        LOG_INF("Message processor initialized successfully");
     }
 
-    // BHI360
+    /* Initialize the advertising work queue item */
+    k_work_init_delayable(&adv_work, advertising_work_handler);
+
+    /* Register connection callbacks */
+    bt_conn_cb_register(&conn_callbacks);
+    bt_gatt_cb_register(&gatt_callbacks);
+
+    /* Initialize Bluetooth subsystem, advertising starts from bt_ready() */
+    printk("Bluetooth application with GATT service and Message Processor\n");
+    LOG_INF("Starting Bluetooth application with GATT service and Message Processor");
+    boot_stage_begin(BOOT_STAGE_BT);
+    err = bt_enable(bt_ready);
+    if (err)
     {
-        size_t bytes_read = ring_buf_get(&bhi_ring, bhi_buf, sizeof(bhi_buf));
-        uint8_t num_samples = bytes_read / sizeof(sample_sensor4_t);
-        if (num_samples > 0)
-        {
-            write_bhi_to_session_file((sample_sensor4_t *)bhi_buf, num_samples);
-        }
+        LOG_ERR("Bluetooth init failed (err %d)", err);
+        boot_stage_end(BOOT_STAGE_BT, err);
+        boot_stage_end(BOOT_STAGE_ADV, err);
     }
-}
 
-int session_init()
-{
     init_sdcard();
 
-    fs_file_t_init(&session_file);
-    int err;
-    k_tid_t tid;
     if (!device_is_ready(uart_dev))
     {
         printf("CDC ACM device not ready");
-        return 0;
-    }
-    usb_enable(NULL);
-    tid = k_thread_create(&cdc_read_thread_stack_data, cdc_read_thread_stack,
-                          K_THREAD_STACK_SIZEOF(cdc_read_thread_stack),
-                          cdc_read_thread, NULL, NULL, NULL,
-                          2, 0, K_NO_WAIT);
-    if (!tid)
-    {
-        printk("ERROR spawning rx thread\n");
-        return 0;
+        boot_stage_end(BOOT_STAGE_USB, -ENODEV);
     }
-    k_thread_name_set(tid, "rx_usb");
-    tid = k_thread_create(&cdc_write_thread_stack_data, cdc_write_thread_stack,
-                          K_THREAD_STACK_SIZEOF(cdc_write_thread_stack),
-                          cdc_write_thread, NULL, NULL, NULL,
-                          2, 0, K_NO_WAIT);
-    if (!tid)
+    else
     {
-        printk("ERROR spawning rx thread\n");
-        return 0;
+        tid = k_thread_create(&cdc_read_thread_stack_data, cdc_read_thread_stack,
+                              K_THREAD_STACK_SIZEOF(cdc_read_thread_stack),
+                              cdc_read_thread, NULL, NULL, NULL,
+                              2, 0, K_NO_WAIT);
+        if (!tid)
+        {
+            printk("ERROR spawning rx thread\n");
+            boot_stage_end(BOOT_STAGE_USB, -EIO);
+            return 0;
+        }
+        k_thread_name_set(tid, "rx_usb");
+        tid = k_thread_create(&cdc_write_thread_stack_data, cdc_write_thread_stack,
+                              K_THREAD_STACK_SIZEOF(cdc_write_thread_stack),
+                              cdc_write_thread, NULL, NULL, NULL,
+                              2, 0, K_NO_WAIT);
+        if (!tid)
+        {
+            printk("ERROR spawning rx thread\n");
+            return 0;
+        }
+        k_thread_name_set(tid, "tx_usb");
     }
-    k_thread_name_set(tid, "tx_usb");
-    printk("Bluetooth application with GATT service and Message Processor\n");
-    LOG_INF("Starting Bluetooth application with GATT service and Message Processor");
 
     /* Initialize our basic implementation module */
     basic_implementation_init();
@@ -1173,44 +1499,26 @@ int session_init()
         LOG_INF("LED initialized successfully");
         /* Flash the LED once to indicate we're running */
         led_on();
-        k_sleep(K_MSEC(500));
-        led_off();
+        k_work_schedule(&led_boot_flash_work, K_MSEC(500));
     }
     led_handler_init();
 
     /* Initialize notification timer */
     k_timer_init(&notify_timer, notify_timer_handler, NULL);
-    k_timer_init(&sample_timer, notify_sample_handler, NULL);
-    k_timer_start(&sample_timer, K_MSEC(10), K_MSEC(10));
-
-    /* Initialize the advertising work queue item */
-    k_work_init_delayable(&adv_work, advertising_work_handler);
 
-    /* Initialize the message processor */
-    err = message_processor_init();
-    if (err)
+    tid = k_thread_create(&ble_sample_thread_data, ble_sample_thread_stack,
+                          K_THREAD_STACK_SIZEOF(ble_sample_thread_stack),
+                          ble_sample_thread, NULL, NULL, NULL,
+                          7, 0, K_NO_WAIT);
+    if (!tid)
     {
-        LOG_ERR("Message processor initialization failed (err %d)", err);
+        printk("ERROR spawning ble sample thread\n");
     }
     else
     {
-        LOG_INF("Message processor initialized successfully");
-    }
-
-    /* Explicitly ensure CPR session is inactive on startup */
-    cpr_session_active = false;
-    cpr_session_start_time = 0;
-    LOG_INF("CPR session explicitly set to inactive on startup");
-
-    /* Register connection callbacks */
-    bt_conn_cb_register(&conn_callbacks);
-
-    /* Initialize Bluetooth subsystem */
-    err = bt_enable(bt_ready);
-    if (err)
-    {
-        LOG_ERR("Bluetooth init failed (err %d)", err);
+        k_thread_name_set(tid, "tx_ble");
     }
+    sample_pipeline_init();
 
     return 0;
 }
@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+"""
+Sample throughput of the sensorhub bus, classic CAN against CAN FD.
+
+Without --iface the script prints the samples/s every sensor stream can reach
+at a given bus load, from worst-case frame lengths (bit stuffing included) of
+the ISO-TP traffic the hubs produce:
+
+  classic  one sample per PDU, single or first/consecutive frames plus the
+           flow control frame of the mainhub
+  fd       as many samples as fit in one 64-byte single frame, with bit-rate
+           switching for the data phase
+
+With --iface the script plays a sensorhub on a SocketCAN interface (vcan0 or
+a USB adapter wired to the board) and sends one stream paced to the chosen
+bus load. "hub rate" on the mainhub shell then shows what arrived. A virtual
+bus has no bit timing, the pacing comes from the same frame model.
+
+  ./can_throughput.py --load 50
+  ./can_throughput.py --iface vcan0 --mode fd --stream ads --load 50 --seconds 10
+
+Linux only for --iface, no packages beyond the standard library.
+"""
+
+import argparse
+import math
+import socket
+import struct
+import sys
+import time
+
+# name: (sample size, hub tx id, mainhub flow control id), see can_addr_decl.h
+# and can_rx_types.h
+STREAMS = {
+    "vl": (6, 0x080, 0x180),
+    "ads": (21, 0x001, 0x101),
+    "sdp": (13, 0x050, 0x150),
+    "bhi": (17, 0x060, 0x160),
+}
+
+# (hub id << 4) | sensor number
+STREAM_IDS = {"vl": 0x11, "ads": 0x12, "sdp": 0x13, "bhi": 0x21}
+
+FD_LENGTHS = (0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64)
+
+
+def fd_frame_len(payload):
+    return next(n for n in FD_LENGTHS if n >= payload)
+
+
+def classic_frame_bits(data_len):
+    """Base frame with worst-case stuffing and interframe space"""
+    return 8 * data_len + 47 + (34 + 8 * data_len - 1) // 4
+
+
+def fd_frame_time(data_len, nominal, data):
+    """Base FD frame with BRS, worst-case stuffing, in seconds"""
+    # SOF, ID, RRS, IDE, FDF, res, BRS at the nominal rate plus stuffing
+    arb_bits = 17 + 16 // 4
+    # CRC delimiter, ACK, ACK delimiter, EOF, interframe space
+    tail_bits = 13
+    crc_bits = 17 if data_len <= 16 else 21
+    # ESI, DLC, data, stuff count, CRC, fixed stuff bits, dynamic stuffing
+    data_bits = (1 + 4 + 8 * data_len + 4 + crc_bits + math.ceil((4 + crc_bits) / 4) +
+                 (5 + 8 * data_len - 1) // 4)
+    return (arb_bits + tail_bits) / nominal + data_bits / data
+
+
+def classic_pdu_frames(sample_size):
+    """CAN payload lengths of one ISO-TP PDU carrying one sample, no padding"""
+    if sample_size <= 7:
+        return [1 + sample_size], []
+    frames = [8]
+    left = sample_size - 6
+    while left > 0:
+        frames.append(1 + min(7, left))
+        left -= 7
+    # flow control frame sent back by the mainhub
+    return frames, [3]
+
+
+def fd_batch(sample_size):
+    # Single frame with the escape length byte, 62 bytes of payload
+    return max(1, 62 // sample_size)
+
+
+def pdu_time(mode, sample_size, nominal, data):
+    if mode == "classic":
+        frames, fc = classic_pdu_frames(sample_size)
+        bits = sum(classic_frame_bits(n) for n in frames + fc)
+        return bits / nominal, 1
+    n = fd_batch(sample_size)
+    return fd_frame_time(fd_frame_len(2 + n * sample_size), nominal, data), n
+
+
+def report(args):
+    print(f"bus load {args.load:.0f}%, nominal {args.bitrate} bit/s, "
+          f"FD data phase {args.data_bitrate} bit/s\n")
+    print(f"{'stream':<7}{'size':>5}{'classic':>12}{'fd':>12}{'per fd pdu':>12}{'gain':>8}")
+    for name, (size, _, _) in STREAMS.items():
+        rates = {}
+        for mode in ("classic", "fd"):
+            t, n = pdu_time(mode, size, args.bitrate, args.data_bitrate)
+            rates[mode] = args.load / 100 / t * n
+        print(f"{name:<7}{size:>5}{rates['classic']:>12.0f}{rates['fd']:>12.0f}"
+              f"{fd_batch(size):>12}{rates['fd'] / rates['classic']:>7.1f}x")
+    print("\nsamples/s for one stream alone on the bus")
+
+
+def isotp_frames(mode, payload):
+    """Split one PDU into CAN payloads, the bool marks where flow control is awaited"""
+    if mode == "fd":
+        if len(payload) <= 7:
+            return [(bytes([len(payload)]) + payload, False)]
+        frame = bytes([0, len(payload)]) + payload
+        return [(frame.ljust(fd_frame_len(len(frame)), b"\xcc"), False)]
+    if len(payload) <= 7:
+        return [(bytes([len(payload)]) + payload, False)]
+    frames = [(bytes([0x10 | (len(payload) >> 8), len(payload) & 0xFF]) + payload[:6], True)]
+    sn = 1
+    for i in range(6, len(payload), 7):
+        frames.append((bytes([0x20 | sn]) + payload[i:i + 7], False))
+        sn = (sn + 1) & 0xF
+    return frames
+
+
+def play(args):
+    size, tx_id, fc_id = STREAMS[args.stream]
+    stream_id = STREAM_IDS[args.stream]
+    sock = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+    if args.mode == "fd":
+        sock.setsockopt(socket.SOL_CAN_RAW, socket.CAN_RAW_FD_FRAMES, 1)
+    sock.bind((args.iface,))
+    sock.settimeout(1.0)
+
+    t, n = pdu_time(args.mode, size, args.bitrate, args.data_bitrate)
+    period = t / (args.load / 100)
+    frame_id = 0
+    sent = 0
+    start = time.monotonic()
+    deadline = start + args.seconds
+
+    while time.monotonic() < deadline:
+        payload = b""
+        for _ in range(n):
+            sample = struct.pack("<BI", stream_id, frame_id)
+            payload += sample.ljust(size, b"\0")
+            frame_id += 1
+
+        for data, await_fc in isotp_frames(args.mode, payload):
+            if args.mode == "fd":
+                flags = 0x01 if len(data) > 8 else 0  # CANFD_BRS
+                sock.send(struct.pack("=IBBxx64s", tx_id, len(data), flags, data))
+            else:
+                sock.send(struct.pack("=IB3x8s", tx_id, len(data), data))
+            if await_fc and not wait_flow_control(sock, fc_id):
+                print("no flow control from the mainhub", file=sys.stderr)
+                return 1
+        sent += n
+
+        wait = start + sent / n * period - time.monotonic()
+        if wait > 0:
+            time.sleep(wait)
+
+    elapsed = time.monotonic() - start
+    print(f"{args.stream} {args.mode}: {sent} samples in {elapsed:.1f} s, "
+          f"{sent / elapsed:.0f} samples/s, {n} per PDU")
+    return 0
+
+
+def wait_flow_control(sock, fc_id):
+    try:
+        while True:
+            frame = sock.recv(72)
+            can_id, _ = struct.unpack_from("=IB", frame)
+            if can_id & socket.CAN_SFF_MASK == fc_id and frame[8] & 0xF0 == 0x30:
+                return True
+    except socket.timeout:
+        return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--load", type=float, default=50, help="bus load in percent")
+    parser.add_argument("--bitrate", type=int, default=500000, help="nominal bit rate")
+    parser.add_argument("--data-bitrate", type=int, default=2000000, help="FD data phase bit rate")
+    parser.add_argument("--iface", help="SocketCAN interface to send on, e.g. vcan0")
+    parser.add_argument("--mode", choices=("classic", "fd"), default="classic")
+    parser.add_argument("--stream", choices=STREAMS, default="ads")
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    if args.iface:
+        return play(args)
+    report(args)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,667 @@
+/*
+ * Decode a binary session log (sdcard/session_log_format.h) into the CSV
+ * layout the firmware used to write:
+ *
+ *   # stream,<id>,<name>
+ *   stream_id,frame_id,data0,...
+ *
+ * Version 3 files end every line in the receive time of the sample, version
+ * 4 then in its hub time on the mainhub clock, both us since session start.
+ *
+ * usage: session_decode [-s] [-b] [-o out.csv] <cprN_00.bin> [cprN_01.bin ...]
+ *
+ * The parts of a session are decoded in the order given into one CSV.
+ * Without -o the CSV goes to stdout. -s prints a summary of blocks, CRC
+ * errors, lost blocks and records per stream to stderr instead. -b codes
+ * the records of the session again as the firmware would, raw and delta,
+ * and prints the sizes per stream and the time taken per record.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc16_koopman.h"
+#include "session_codec.h"
+#include "session_log_format.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MAX_FIELDS SESSION_CODEC_FIELDS
+/* SESSION_LOG_BLOCK_SIZE of the firmware, sdcard/session_log.h */
+#define BLOCK_SIZE 512
+/* Coding passes of -b are repeated for at least this long */
+#define BENCH_MIN_NS 200000000LL
+
+struct stream
+{
+    bool known;
+    uint8_t record_size;
+    uint8_t num_fields;
+    char name[SESSION_LOG_NAME_LEN + 1];
+    struct session_log_field fields[MAX_FIELDS];
+
+    uint64_t records;
+    uint64_t frame_gaps;
+    bool seen;
+    uint32_t last_frame_id;
+};
+
+struct decoder
+{
+    struct stream streams[256];
+    struct session_codec codec;
+    bool have_header;
+    int part;
+    uint64_t parts;
+    uint64_t missing_parts;
+    char start_time[21];
+    FILE *out;
+
+    uint64_t blocks;
+    uint64_t bad_crc;
+    uint64_t lost_blocks;
+    uint64_t skipped_bytes;
+    uint64_t bad_records;
+    bool have_seq;
+    uint16_t next_seq;
+
+    /* -b: every record in its raw layout, in file order */
+    bool keep;
+    uint8_t *kept;
+    size_t kept_len;
+    size_t kept_cap;
+};
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static float get_lef(const uint8_t *p)
+{
+    uint32_t raw = get_le32(p);
+    float f;
+
+    memcpy(&f, &raw, sizeof(f));
+    return f;
+}
+
+static bool decode_header(struct decoder *dec, const uint8_t *p, size_t len)
+{
+    const struct session_log_file_header *fh = (const void *)p;
+    size_t pos = sizeof(*fh);
+
+    if (len < sizeof(*fh) || memcmp(fh->magic, SESSION_LOG_MAGIC, sizeof(fh->magic)) != 0)
+    {
+        fprintf(stderr, "not a session log\n");
+        return false;
+    }
+    uint16_t version = get_le16((const uint8_t *)&fh->version);
+
+    /* Version 1 files only lack the delta blocks */
+    if (version < 1 || version > SESSION_LOG_VERSION)
+    {
+        fprintf(stderr, "unsupported version %u\n", get_le16((const uint8_t *)&fh->version));
+        return false;
+    }
+    /* Every part repeats the header, only the part number changes */
+    if (dec->part >= 0 && fh->part != dec->part + 1)
+    {
+        fprintf(stderr, "part %u follows part %d\n", fh->part, dec->part);
+        if (fh->part > dec->part)
+        {
+            dec->missing_parts += fh->part - dec->part - 1;
+        }
+    }
+    dec->part = fh->part;
+    dec->parts++;
+    if (dec->have_header)
+    {
+        return true;
+    }
+    memcpy(dec->start_time, fh->start_time, sizeof(fh->start_time));
+
+    for (uint8_t i = 0; i < fh->num_streams; i++)
+    {
+        const struct session_log_stream *st = (const void *)&p[pos];
+        struct stream *s;
+
+        if (pos + sizeof(*st) > len)
+        {
+            return false;
+        }
+        pos += sizeof(*st);
+        s = &dec->streams[st->stream_id];
+        if (st->num_fields > MAX_FIELDS ||
+            pos + st->num_fields * sizeof(struct session_log_field) > len)
+        {
+            return false;
+        }
+        s->known = true;
+        s->record_size = st->record_size;
+        s->num_fields = st->num_fields;
+        memcpy(s->name, st->name, SESSION_LOG_NAME_LEN);
+        memcpy(s->fields, &p[pos], st->num_fields * sizeof(struct session_log_field));
+        pos += st->num_fields * sizeof(struct session_log_field);
+        if (session_codec_add_stream(&dec->codec, st->stream_id, st->record_size,
+                                     st->num_fields, s->fields) != 0)
+        {
+            fprintf(stderr, "stream %u cannot be delta coded\n", st->stream_id);
+        }
+    }
+
+    if (dec->out != NULL)
+    {
+        if (dec->start_time[0] != '\0')
+        {
+            fprintf(dec->out, "# start,%s\n", dec->start_time);
+        }
+        for (int id = 0; id < 256; id++)
+        {
+            if (dec->streams[id].known)
+            {
+                fprintf(dec->out, "# stream,%d,%s\n", id, dec->streams[id].name);
+            }
+        }
+        fprintf(dec->out, "stream_id,frame_id,data0,data1,data2,data3,data4,data5,data6,data7\n");
+    }
+    dec->have_header = true;
+    return true;
+}
+
+static void write_record(struct decoder *dec, const struct stream *s, const uint8_t *rec)
+{
+    fprintf(dec->out, "%u,%u", rec[0], get_le32(&rec[1]));
+    for (uint8_t i = 0; i < s->num_fields; i++)
+    {
+        const struct session_log_field *f = &s->fields[i];
+        const uint8_t *v = &rec[f->offset];
+
+        switch (f->type)
+        {
+        case SESSION_LOG_FIELD_U8:
+            fprintf(dec->out, ",%u", v[0]);
+            break;
+        case SESSION_LOG_FIELD_U16:
+            fprintf(dec->out, ",%u", get_le16(v));
+            break;
+        case SESSION_LOG_FIELD_FLOAT:
+            fprintf(dec->out, ",%.*f", f->decimals, get_lef(v));
+            break;
+        case SESSION_LOG_FIELD_U32:
+            fprintf(dec->out, ",%u", get_le32(v));
+            break;
+        default:
+            fprintf(dec->out, ",");
+            break;
+        }
+    }
+    fprintf(dec->out, "\n");
+}
+
+static void keep_record(struct decoder *dec, const uint8_t *rec, size_t len)
+{
+    if (dec->kept_len + len > dec->kept_cap)
+    {
+        size_t cap = dec->kept_cap > 0 ? 2 * dec->kept_cap : 65536;
+        uint8_t *kept = realloc(dec->kept, cap);
+
+        if (kept == NULL)
+        {
+            dec->keep = false;
+            fprintf(stderr, "out of memory, no benchmark\n");
+            return;
+        }
+        dec->kept = kept;
+        dec->kept_cap = cap;
+    }
+    memcpy(&dec->kept[dec->kept_len], rec, len);
+    dec->kept_len += len;
+}
+
+static void decode_record(struct decoder *dec, struct stream *s, const uint8_t *rec)
+{
+    uint32_t frame_id = get_le32(&rec[1]);
+
+    if (s->seen && frame_id > s->last_frame_id + 1)
+    {
+        s->frame_gaps += frame_id - s->last_frame_id - 1;
+    }
+    s->seen = true;
+    s->last_frame_id = frame_id;
+    s->records++;
+
+    if (dec->out != NULL)
+    {
+        write_record(dec, s, rec);
+    }
+    if (dec->keep)
+    {
+        keep_record(dec, rec, s->record_size);
+    }
+}
+
+static void decode_records(struct decoder *dec, const uint8_t *p, size_t len)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        struct stream *s = &dec->streams[p[pos]];
+
+        /* Without the size the rest of the block cannot be split */
+        if (!s->known || s->record_size < 5 || pos + s->record_size > len)
+        {
+            dec->bad_records++;
+            return;
+        }
+        decode_record(dec, s, &p[pos]);
+        pos += s->record_size;
+    }
+}
+
+static void decode_delta(struct decoder *dec, const uint8_t *p, size_t len)
+{
+    uint8_t rec[256];
+    size_t pos = 0;
+
+    session_codec_reset(&dec->codec);
+    while (pos < len)
+    {
+        size_t n = session_codec_decode(&dec->codec, &p[pos], len - pos, rec, sizeof(rec));
+
+        /* An unknown stream or a cut record ends the block */
+        if (n == 0)
+        {
+            dec->bad_records++;
+            return;
+        }
+        decode_record(dec, &dec->streams[rec[0]], rec);
+        pos += n;
+    }
+}
+
+static void decode(struct decoder *dec, const uint8_t *buf, size_t size)
+{
+    const size_t hdr_len = sizeof(struct session_log_block_header);
+    size_t pos = 0;
+
+    /* Block numbers start over in every part */
+    dec->have_seq = false;
+
+    while (pos + hdr_len + SESSION_LOG_CRC_LEN <= size)
+    {
+        const uint8_t *b = &buf[pos];
+
+        if (get_le16(b) != SESSION_LOG_SYNC)
+        {
+            pos++;
+            dec->skipped_bytes++;
+            continue;
+        }
+
+        uint16_t len = get_le16(&b[offsetof(struct session_log_block_header, len)]);
+        if (pos + hdr_len + len + SESSION_LOG_CRC_LEN > size ||
+            crc16_koopman(b, hdr_len + len) != get_le16(&b[hdr_len + len]))
+        {
+            /* A sync word in the data or a damaged block, look further */
+            dec->bad_crc++;
+            pos++;
+            dec->skipped_bytes++;
+            continue;
+        }
+
+        uint16_t seq = get_le16(&b[offsetof(struct session_log_block_header, seq)]);
+        if (dec->have_seq && seq != dec->next_seq)
+        {
+            dec->lost_blocks += (uint16_t)(seq - dec->next_seq);
+        }
+        dec->have_seq = true;
+        dec->next_seq = seq + 1;
+        dec->blocks++;
+
+        switch (b[offsetof(struct session_log_block_header, type)])
+        {
+        case SESSION_LOG_BLOCK_HEADER:
+            if (!decode_header(dec, &b[hdr_len], len))
+            {
+                return;
+            }
+            break;
+        case SESSION_LOG_BLOCK_RECORDS:
+            if (dec->have_header)
+            {
+                decode_records(dec, &b[hdr_len], len);
+            }
+            break;
+        case SESSION_LOG_BLOCK_DELTA:
+            if (dec->have_header)
+            {
+                decode_delta(dec, &b[hdr_len], len);
+            }
+            break;
+        default:
+            break;
+        }
+        pos += hdr_len + len + SESSION_LOG_CRC_LEN;
+    }
+    dec->skipped_bytes += size - pos;
+}
+
+static void print_summary(const struct decoder *dec)
+{
+    fprintf(stderr, "start:         %s\n", dec->start_time[0] ? dec->start_time : "unknown");
+    fprintf(stderr, "parts:         %llu\n", (unsigned long long)dec->parts);
+    fprintf(stderr, "missing parts: %llu\n", (unsigned long long)dec->missing_parts);
+    fprintf(stderr, "blocks:        %llu\n", (unsigned long long)dec->blocks);
+    fprintf(stderr, "lost blocks:   %llu\n", (unsigned long long)dec->lost_blocks);
+    fprintf(stderr, "bad blocks:    %llu\n", (unsigned long long)dec->bad_crc);
+    fprintf(stderr, "skipped bytes: %llu\n", (unsigned long long)dec->skipped_bytes);
+    fprintf(stderr, "bad records:   %llu\n", (unsigned long long)dec->bad_records);
+    fprintf(stderr, "%-6s %-8s %10s %10s\n", "stream", "name", "records", "gaps");
+    for (int id = 0; id < 256; id++)
+    {
+        const struct stream *s = &dec->streams[id];
+
+        if (s->known)
+        {
+            fprintf(stderr, "%-6d %-8s %10llu %10llu\n", id, s->name,
+                    (unsigned long long)s->records, (unsigned long long)s->frame_gaps);
+        }
+    }
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Decode a coded block again and compare it with the records it came from */
+static uint64_t bench_verify(const struct decoder *dec, const uint8_t *p, size_t len,
+                             const uint8_t *raw, size_t raw_len)
+{
+    struct session_codec check = dec->codec;
+    uint8_t rec[256];
+    size_t pos = 0;
+    size_t raw_pos = 0;
+    uint64_t bad = 0;
+
+    session_codec_reset(&check);
+    while (pos < len && raw_pos < raw_len)
+    {
+        size_t n = session_codec_decode(&check, &p[pos], len - pos, rec, sizeof(rec));
+        size_t size = dec->streams[raw[raw_pos]].record_size;
+
+        if (n == 0)
+        {
+            return bad + 1;
+        }
+        bad += memcmp(rec, &raw[raw_pos], size) != 0;
+        pos += n;
+        raw_pos += size;
+    }
+    return bad + (pos != len || raw_pos != raw_len);
+}
+
+/*
+ * Pack the kept records into blocks the way the firmware does and return
+ * the bytes on disk. Per stream record bytes go to stream_bytes if given,
+ * blocks that do not decode back to their records are counted in bad.
+ */
+static size_t bench_pack(struct decoder *dec, bool delta, uint64_t *stream_bytes,
+                         uint64_t *bad)
+{
+    const size_t hdr_len = sizeof(struct session_log_block_header);
+    static uint8_t block[BLOCK_SIZE];
+    size_t block_first = 0;
+    size_t used = 0;
+    size_t total = 0;
+    size_t pos = 0;
+
+    while (pos < dec->kept_len)
+    {
+        const uint8_t *rec = &dec->kept[pos];
+        size_t size = dec->streams[rec[0]].record_size;
+        size_t max = delta ? session_codec_max_len(&dec->codec, rec[0]) : size;
+        size_t n;
+
+        if (used > 0 && used + max + SESSION_LOG_CRC_LEN > BLOCK_SIZE)
+        {
+            if (bad != NULL)
+            {
+                *bad += bench_verify(dec, &block[hdr_len], used - hdr_len,
+                                     &dec->kept[block_first], pos - block_first);
+            }
+            total += used + SESSION_LOG_CRC_LEN;
+            used = 0;
+        }
+        if (used == 0)
+        {
+            used = hdr_len;
+            block_first = pos;
+            session_codec_reset(&dec->codec);
+        }
+
+        if (delta)
+        {
+            n = session_codec_encode(&dec->codec, rec, &block[used]);
+        }
+        else
+        {
+            memcpy(&block[used], rec, size);
+            n = size;
+        }
+        used += n;
+        if (stream_bytes != NULL)
+        {
+            stream_bytes[rec[0]] += n;
+        }
+        pos += size;
+    }
+    if (used > 0)
+    {
+        if (bad != NULL)
+        {
+            *bad += bench_verify(dec, &block[hdr_len], used - hdr_len, &dec->kept[block_first],
+                                 pos - block_first);
+        }
+        total += used + SESSION_LOG_CRC_LEN;
+    }
+    return total;
+}
+
+static void print_bench(struct decoder *dec)
+{
+    static uint64_t raw_bytes[256];
+    static uint64_t delta_bytes[256];
+    uint64_t records = 0;
+    uint64_t bad = 0;
+    uint64_t passes = 0;
+    size_t raw_disk = bench_pack(dec, false, raw_bytes, NULL);
+    size_t delta_disk = bench_pack(dec, true, delta_bytes, &bad);
+
+    for (int id = 0; id < 256; id++)
+    {
+        records += dec->streams[id].records;
+    }
+    if (records == 0 || delta_disk == 0)
+    {
+        fprintf(stderr, "no records to code\n");
+        return;
+    }
+
+    /* Coding only, the block packing is the same as on the hub */
+    int64_t start = now_ns();
+    uint64_t cycles = now_cycles();
+    int64_t elapsed;
+
+    do
+    {
+        bench_pack(dec, true, NULL, NULL);
+        passes++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+    cycles = now_cycles() - cycles;
+
+    fprintf(stderr, "%-6s %-8s %10s %12s %12s %7s\n", "stream", "name", "records", "raw bytes",
+            "delta bytes", "ratio");
+    for (int id = 0; id < 256; id++)
+    {
+        const struct stream *s = &dec->streams[id];
+
+        if (s->known && s->records > 0)
+        {
+            fprintf(stderr, "%-6d %-8s %10llu %12llu %12llu %7.2f\n", id, s->name,
+                    (unsigned long long)s->records, (unsigned long long)raw_bytes[id],
+                    (unsigned long long)delta_bytes[id],
+                    (double)raw_bytes[id] / (delta_bytes[id] ? delta_bytes[id] : 1));
+        }
+    }
+    fprintf(stderr, "on disk:      raw %zu, delta %zu bytes, ratio %.2f\n", raw_disk,
+            delta_disk, (double)raw_disk / delta_disk);
+    fprintf(stderr, "encode:       %.1f ns per record", (double)elapsed / (passes * records));
+#ifdef HAVE_TSC
+    fprintf(stderr, ", %.1f TSC cycles", (double)cycles / (passes * records));
+#endif
+    fprintf(stderr, " (host, \"hub log\" shows the hub)\n");
+    fprintf(stderr, "round trip:   %s\n", bad == 0 ? "ok" : "MISMATCH");
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf = NULL;
+    long len;
+
+    if (f == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(len > 0 ? len : 1);
+        if (buf != NULL && fread(buf, 1, len, f) != (size_t)len)
+        {
+            free(buf);
+            buf = NULL;
+        }
+        *size = len;
+    }
+    if (buf == NULL)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+    }
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    static struct decoder dec = {.part = -1};
+    const char *out_path = NULL;
+    bool summary = false;
+    bool bench = false;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (strcmp(argv[arg], "-s") == 0)
+        {
+            summary = true;
+        }
+        else if (strcmp(argv[arg], "-b") == 0)
+        {
+            bench = true;
+        }
+        else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc)
+        {
+            out_path = argv[++arg];
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (arg >= argc || argv[arg][0] == '-')
+    {
+        fprintf(stderr, "usage: %s [-s] [-b] [-o out.csv] <session_00.bin> [session_01.bin ...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    dec.keep = bench;
+    if (summary || bench)
+    {
+        dec.out = NULL;
+    }
+    else if (out_path != NULL)
+    {
+        dec.out = fopen(out_path, "w");
+        if (dec.out == NULL)
+        {
+            perror(out_path);
+            return 1;
+        }
+    }
+    else
+    {
+        dec.out = stdout;
+    }
+
+    for (; arg < argc; arg++)
+    {
+        size_t size;
+        uint8_t *buf = read_file(argv[arg], &size);
+
+        if (buf == NULL)
+        {
+            return 1;
+        }
+        decode(&dec, buf, size);
+        free(buf);
+    }
+
+    if (summary)
+    {
+        print_summary(&dec);
+    }
+    if (bench && dec.keep)
+    {
+        print_bench(&dec);
+    }
+    else if (dec.out != NULL && dec.out != stdout)
+    {
+        fclose(dec.out);
+    }
+
+    if (!dec.have_header)
+    {
+        fprintf(stderr, "no valid header block\n");
+        return 1;
+    }
+    return 0;
+}